@@ -5,6 +5,12 @@ public:
     virtual size_t add(const uint8_t *data, size_t size)= 0;
     virtual size_t get(uint8_t *data, size_t size)= 0;
     virtual bool eof()= 0;
+    virtual ~decompressor() { }
 };
 
+// compressors use the same interface: add() input, get() output,
+// the end of the input is signalled with add(NULL, 0).
+// decompressors accept add(NULL, 0) too, so they can report a truncated stream.
+typedef decompressor compressor;
+
 #endif
@@ -0,0 +1,184 @@
+#ifndef __COMPRESS_LZ4_H__
+#define __COMPRESS_LZ4_H__
+
+#include <lz4frame.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "compress/compressor.h"
+#include "compress/registry.h"
+
+// lz4 frame format (de)compression, with the same add/get interface as ZlibCompress.
+// link with -llz4.
+struct lz4error {
+    size_t code;
+    std::string msg;
+    lz4error(size_t code, const char*msg)
+        : code(code), msg(msg)
+    {
+    }
+    ~lz4error()
+    {
+        printf("LZ4[%s]: %s\n", LZ4F_getErrorName(code), msg.c_str());
+    }
+};
+
+class Lz4Decompress : public decompressor {
+    LZ4F_dctx *_ctx;
+    const uint8_t *_in;
+    size_t _insize;
+    bool _eof;
+public:
+    Lz4Decompress()
+        : _ctx(NULL), _in(NULL), _insize(0), _eof(false)
+    {
+        size_t ret= LZ4F_createDecompressionContext(&_ctx, LZ4F_VERSION);
+        if (LZ4F_isError(ret))
+            throw lz4error(ret, "LZ4F_createDecompressionContext");
+    }
+    virtual ~Lz4Decompress()
+    {
+        LZ4F_freeDecompressionContext(_ctx);
+    }
+    // prepare for decompressing a new frame, keeping the allocated state
+    void reset()
+    {
+        LZ4F_resetDecompressionContext(_ctx);
+        _in= NULL;
+        _insize= 0;
+        _eof= false;
+    }
+    // returns amount of compressed data actually used
+    virtual size_t add(const uint8_t *data, size_t size)
+    {
+        if (_insize) // don't update in-buffer when we still have one
+            return 0;
+        _in= data;
+        _insize= size;
+
+        return size;
+    }
+
+    // returns amount of decompressed data
+    virtual size_t get(uint8_t *data, size_t size)
+    {
+        if (_eof)
+            return 0;
+        size_t outsize= size;
+        size_t used= _insize;
+        size_t ret= LZ4F_decompress(_ctx, data, &outsize, _in, &used, NULL);
+        if (LZ4F_isError(ret))
+            throw lz4error(ret, "LZ4F_decompress");
+        _in += used;
+        _insize -= used;
+        if (ret==0)
+            _eof= true;
+
+        return outsize;
+    }
+    virtual bool eof() { return _eof; }
+    size_t left() const { return _insize; }
+};
+
+// LZ4F needs room for a whole compressed chunk, so output is staged in
+// an internal buffer, and copied out by get().
+class Lz4Compress : public compressor {
+    enum { CHUNK= 65536 };
+    LZ4F_cctx *_ctx;
+    LZ4F_preferences_t _prefs;
+    const uint8_t *_in;
+    size_t _insize;
+    std::vector<uint8_t> _out;
+    size_t _outpos;
+    size_t _outlen;
+    bool _started;
+    bool _finishing;
+    bool _ended;
+
+    void stage()
+    {
+        _outpos= _outlen= 0;
+        if (!_started) {
+            size_t ret= LZ4F_compressBegin(_ctx, &_out[0], _out.size(), &_prefs);
+            if (LZ4F_isError(ret))
+                throw lz4error(ret, "LZ4F_compressBegin");
+            _outlen += ret;
+            _started= true;
+        }
+        if (_insize) {
+            size_t want= std::min(_insize, size_t(CHUNK));
+            size_t ret= LZ4F_compressUpdate(_ctx, &_out[_outlen], _out.size()-_outlen, _in, want, NULL);
+            if (LZ4F_isError(ret))
+                throw lz4error(ret, "LZ4F_compressUpdate");
+            _outlen += ret;
+            _in += want;
+            _insize -= want;
+        }
+        else if (_finishing) {
+            size_t ret= LZ4F_compressEnd(_ctx, &_out[_outlen], _out.size()-_outlen, NULL);
+            if (LZ4F_isError(ret))
+                throw lz4error(ret, "LZ4F_compressEnd");
+            _outlen += ret;
+            _ended= true;
+        }
+    }
+public:
+    Lz4Compress(int level= 0)
+        : _ctx(NULL), _in(NULL), _insize(0), _outpos(0), _outlen(0), _started(false), _finishing(false), _ended(false)
+    {
+        memset(&_prefs, 0, sizeof(_prefs));
+        _prefs.compressionLevel= level;
+        _prefs.frameInfo.contentChecksumFlag= LZ4F_contentChecksumEnabled;
+
+        size_t ret= LZ4F_createCompressionContext(&_ctx, LZ4F_VERSION);
+        if (LZ4F_isError(ret))
+            throw lz4error(ret, "LZ4F_createCompressionContext");
+        _out.resize(LZ4F_HEADER_SIZE_MAX+LZ4F_compressBound(CHUNK, &_prefs));
+    }
+    virtual ~Lz4Compress()
+    {
+        LZ4F_freeCompressionContext(_ctx);
+    }
+    // prepare for compressing a new frame, keeping the allocated state
+    void reset()
+    {
+        // compressBegin restarts the context
+        _in= NULL;
+        _insize= 0;
+        _outpos= _outlen= 0;
+        _started= _finishing= _ended= false;
+    }
+    // returns amount of data actually used, add(NULL,0) ends the input.
+    virtual size_t add(const uint8_t *data, size_t size)
+    {
+        if (data==NULL) {
+            _finishing= true;
+            return 0;
+        }
+        if (_insize || _finishing)
+            return 0;
+        _in= data;
+        _insize= size;
+
+        return size;
+    }
+
+    // returns amount of compressed data
+    virtual size_t get(uint8_t *data, size_t size)
+    {
+        if (_outpos==_outlen && !_ended && (_insize || _finishing || !_started))
+            stage();
+        size_t want= std::min(size, _outlen-_outpos);
+        if (want)
+            memcpy(data, &_out[_outpos], want);
+        _outpos += want;
+        return want;
+    }
+    virtual bool eof() { return _ended && _outpos==_outlen; }
+    size_t left() const { return _insize; }
+};
+
+inline const bool lz4_registered= compressorregistry::add("lz4", compressorregistry::magic(std::string("\x04\x22\x4d\x18", 4)),
+        []() { return std::make_shared<Lz4Decompress>(); },
+        []() { return std::make_shared<Lz4Compress>(); });
+#endif
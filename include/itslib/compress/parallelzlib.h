@@ -0,0 +1,298 @@
+#ifndef __COMPRESS_PARALLELZLIB_H__
+#define __COMPRESS_PARALLELZLIB_H__
+
+#include <zlib.h>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "compress/compressor.h"
+#include "compress/zliballoc.h"
+#include "compress/zliberr.h"
+
+// ParallelZlibCompress is a pigz style deflate compressor.
+//
+// the input is cut in blocks, which are compressed on a pool of threads
+// as raw deflate streams, each using the last 32k of the preceding block as
+// dictionary. all but the last block end with a sync flush, so they end on
+// a byte boundary and can simply be concatenated.
+// the checksums of the blocks are combined into the zlib or gzip trailer.
+//
+// the result is a single valid zlib or gzip stream, compressing slightly
+// worse than ZlibCompress at the same level.
+//
+// usage is the same as ZlibCompress: add() input, get() output, and
+// end the input with add(NULL, 0).
+// add() may use less than offered when too many blocks are pending, then
+// get() will wait for the oldest block.
+class ParallelZlibCompress : public compressor {
+public:
+    struct options {
+        int level;
+        int memlevel;
+        size_t blocksize;
+        unsigned nthreads;      // 0 -> one per core
+        bool gzip;              // gzip instead of zlib framing
+        options() : level(Z_DEFAULT_COMPRESSION), memlevel(8), blocksize(128*1024), nthreads(0), gzip(false) { }
+    };
+private:
+    enum { DICTSIZE= 32768 };
+    typedef std::shared_ptr<std::vector<uint8_t> > ByteVector_ptr;
+
+    struct job {
+        ByteVector_ptr input;
+        ByteVector_ptr prev;        // for the dictionary, NULL for the first block
+        bool last;
+
+        std::vector<uint8_t> output;
+        uLong check;                // crc32 or adler32 of input
+        bool done;
+        bool failed;
+    };
+    typedef std::shared_ptr<job> job_ptr;
+
+    options _opt;
+    std::vector<std::thread> _threads;
+    std::mutex _mtx;
+    std::condition_variable _condwork;
+    std::condition_variable _conddone;
+    std::deque<job_ptr> _work;      // waiting for a worker
+    std::deque<job_ptr> _pending;   // all unfinished jobs, in stream order
+    bool _stopping;
+
+    ByteVector_ptr _curblock;
+    ByteVector_ptr _prevblock;
+    bool _finishing;
+
+    std::vector<uint8_t> _out;      // output waiting to be returned by get
+    size_t _outpos;
+    uLong _check;
+    uint64_t _totalin;
+    bool _trailerdone;
+    bool _eof;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (true) {
+            while (!_stopping && _work.empty())
+                _condwork.wait(lock);
+            if (_stopping)
+                return;
+            job_ptr j= _work.front();
+            _work.pop_front();
+            lock.unlock();
+
+            try {
+                compressblock(*j);
+            }
+            catch(...) {
+                j->failed= true;
+            }
+
+            lock.lock();
+            j->done= true;
+            _conddone.notify_all();
+        }
+    }
+    void compressblock(job& j)
+    {
+        const std::vector<uint8_t>& in= *j.input;
+        j.check= _opt.gzip ? crc32(0, NULL, 0) : adler32(0, NULL, 0);
+        if (!in.empty())
+            j.check= _opt.gzip ? crc32(j.check, &in[0], in.size()) : adler32(j.check, &in[0], in.size());
+
+        ZlibAllocator a;
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        a.initstream(zs);
+        int stat= deflateInit2(&zs, _opt.level, Z_DEFLATED, -15, _opt.memlevel, Z_DEFAULT_STRATEGY);
+        if (stat!=Z_OK)
+            throw zliberror(stat, "deflateInit2");
+
+        if (j.prev && !j.prev->empty()) {
+            size_t dictlen= std::min(j.prev->size(), size_t(DICTSIZE));
+            deflateSetDictionary(&zs, &j.prev->back()+1-dictlen, dictlen);
+        }
+
+        j.output.resize(deflateBound(&zs, in.size())+16);
+        zs.next_in= in.empty() ? NULL : const_cast<uint8_t*>(&in[0]);
+        zs.avail_in= in.size();
+        while (true) {
+            zs.next_out= &j.output[zs.total_out];
+            zs.avail_out= j.output.size()-zs.total_out;
+            stat= deflate(&zs, j.last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (stat!=Z_OK && stat!=Z_STREAM_END && stat!=Z_BUF_ERROR) {
+                deflateEnd(&zs);
+                throw zliberror(stat, "deflate");
+            }
+            if (stat==Z_STREAM_END || (!j.last && zs.avail_out>0))
+                break;
+            j.output.resize(j.output.size()*2);
+        }
+        j.output.resize(zs.total_out);
+        deflateEnd(&zs);
+    }
+
+    void submit(bool last)
+    {
+        job_ptr j= std::make_shared<job>();
+        j->input= _curblock;
+        j->prev= _prevblock;
+        j->last= last;
+        j->check= 0;
+        j->done= false;
+        j->failed= false;
+
+        _prevblock= _curblock;
+        _curblock= std::make_shared<std::vector<uint8_t> >();
+        _curblock->reserve(_opt.blocksize);
+
+        std::unique_lock<std::mutex> lock(_mtx);
+        _work.push_back(j);
+        _pending.push_back(j);
+        lock.unlock();
+        _condwork.notify_one();
+    }
+    size_t maxpending() const { return 2*_threads.size(); }
+
+    void writeheader()
+    {
+        if (_opt.gzip) {
+            // magic, deflate, no flags, no mtime, no extra flags, os=unix
+            const uint8_t hdr[10]= { 0x1f, 0x8b, 8, 0, 0,0,0,0, 0, 3 };
+            _out.insert(_out.end(), hdr, hdr+sizeof(hdr));
+        }
+        else {
+            int flevel= _opt.level==Z_DEFAULT_COMPRESSION || _opt.level==6 ? 2 : _opt.level>6 ? 3 : _opt.level>=2 ? 1 : 0;
+            unsigned h= (0x78<<8) | (flevel<<6);
+            h += 31 - h%31;
+            _out.push_back(h>>8);
+            _out.push_back(h);
+        }
+    }
+    void writetrailer()
+    {
+        uint8_t trl[8];
+        if (_opt.gzip) {
+            for (int i=0 ; i<4 ; i++) {
+                trl[i]= _check>>(8*i);
+                trl[4+i]= _totalin>>(8*i);
+            }
+            _out.insert(_out.end(), trl, trl+8);
+        }
+        else {
+            for (int i=0 ; i<4 ; i++)
+                trl[i]= _check>>(24-8*i);
+            _out.insert(_out.end(), trl, trl+4);
+        }
+    }
+    // move finished blocks, in order, to _out.
+    // when 'block' is set, wait for the oldest one.
+    void collect(bool block)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (!_pending.empty()) {
+            job_ptr j= _pending.front();
+            if (!j->done) {
+                if (!block)
+                    break;
+                _conddone.wait(lock);
+                continue;
+            }
+            _pending.pop_front();
+            block= false;
+            if (j->failed)
+                throw zliberror(Z_STREAM_ERROR, "parallel deflate");
+
+            _out.insert(_out.end(), j->output.begin(), j->output.end());
+            size_t len= j->input->size();
+            _check= _opt.gzip ? crc32_combine(_check, j->check, len) : adler32_combine(_check, j->check, len);
+            _totalin += len;
+            if (j->last) {
+                writetrailer();
+                _trailerdone= true;
+            }
+        }
+    }
+public:
+    ParallelZlibCompress(const options& opt= options())
+        : _opt(opt), _stopping(false), _finishing(false), _outpos(0), _totalin(0), _trailerdone(false), _eof(false)
+    {
+        unsigned n= _opt.nthreads ? _opt.nthreads : std::thread::hardware_concurrency();
+        if (n==0)
+            n= 1;
+        if (_opt.blocksize==0)
+            _opt.blocksize= 128*1024;
+        _check= _opt.gzip ? crc32(0, NULL, 0) : adler32(0, NULL, 0);
+        _curblock= std::make_shared<std::vector<uint8_t> >();
+        _curblock->reserve(_opt.blocksize);
+        writeheader();
+        for (unsigned i=0 ; i<n ; i++)
+            _threads.emplace_back([this]() { worker(); });
+    }
+    virtual ~ParallelZlibCompress()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stopping= true;
+        }
+        _condwork.notify_all();
+        for (auto i= _threads.begin() ; i!=_threads.end() ; ++i)
+            i->join();
+    }
+
+    // returns amount of data actually used, add(NULL,0) ends the input.
+    virtual size_t add(const uint8_t *data, size_t size)
+    {
+        if (_finishing)
+            return 0;
+        if (data==NULL) {
+            submit(true);
+            _finishing= true;
+            return 0;
+        }
+        size_t used= 0;
+        while (used<size) {
+            if (_curblock->size()==_opt.blocksize) {
+                {
+                    std::unique_lock<std::mutex> lock(_mtx);
+                    if (_pending.size()>=maxpending())
+                        break;
+                }
+                submit(false);
+            }
+            size_t want= std::min(size-used, _opt.blocksize-_curblock->size());
+            _curblock->insert(_curblock->end(), data+used, data+used+want);
+            used += want;
+        }
+        return used;
+    }
+
+    // returns amount of compressed data
+    virtual size_t get(uint8_t *data, size_t size)
+    {
+        if (_outpos==_out.size()) {
+            _out.clear();
+            _outpos= 0;
+            bool mustwait;
+            {
+                std::unique_lock<std::mutex> lock(_mtx);
+                mustwait= _pending.size()>=maxpending() || (_finishing && !_pending.empty());
+            }
+            collect(mustwait);
+        }
+        size_t want= std::min(size, _out.size()-_outpos);
+        if (want)
+            memcpy(data, &_out[_outpos], want);
+        _outpos += want;
+        if (_trailerdone && _outpos==_out.size())
+            _eof= true;
+        return want;
+    }
+    virtual bool eof() { return _eof; }
+};
+#endif
@@ -0,0 +1,95 @@
+#ifndef _COMPRESS_REGISTRY_H_
+#define _COMPRESS_REGISTRY_H_
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "compress/compressor.h"
+
+// compressorregistry maps codec names and magic bytes to compressor and decompressor factories.
+//
+// codecs register themselves from their header: including compress/zlib.h adds "zlib" and "gzip",
+// compress/zstd.h adds "zstd", compress/lz4.h adds "lz4".
+// so only the codecs a program was built with can be detected.
+//
+//   auto c= compressorregistry::detect(hdr, n);
+//   if (c) d= c->newdecompressor();
+//
+class compressorregistry {
+public:
+    typedef std::shared_ptr<decompressor> decompressor_ptr;
+    typedef std::shared_ptr<compressor> compressor_ptr;
+
+    // should return true when the first 'n' bytes of a stream are in this format.
+    typedef std::function<bool(const uint8_t *p, size_t n)> matcher_t;
+    typedef std::function<decompressor_ptr()> decompressorfactory_t;
+    typedef std::function<compressor_ptr()> compressorfactory_t;
+
+    enum { MAXMAGIC= 16 };  // nr of bytes passed to the matchers by detect
+
+    struct codec {
+        std::string name;
+        matcher_t match;
+        decompressorfactory_t newdecompressor;
+        compressorfactory_t newcompressor;
+    };
+private:
+    struct state {
+        std::mutex mtx;
+        std::deque<codec> codecs;   // deque: pointers stay valid when adding
+    };
+    static state& registry()
+    {
+        static state s;
+        return s;
+    }
+public:
+    // adding a name twice replaces the earlier codec.
+    // returns true, so it can be used to initialize a static.
+    static bool add(const std::string& name, matcher_t match, decompressorfactory_t d, compressorfactory_t c)
+    {
+        state& s= registry();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for (auto i= s.codecs.begin() ; i!=s.codecs.end() ; ++i)
+            if (i->name==name) {
+                i->match= match;
+                i->newdecompressor= d;
+                i->newcompressor= c;
+                return true;
+            }
+        s.codecs.push_back(codec{name, match, d, c});
+        return true;
+    }
+    // returns NULL for unknown names
+    static const codec *find(const std::string& name)
+    {
+        state& s= registry();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for (auto i= s.codecs.begin() ; i!=s.codecs.end() ; ++i)
+            if (i->name==name)
+                return &*i;
+        return NULL;
+    }
+    // returns the codec matching the start of a stream, or NULL
+    static const codec *detect(const uint8_t *p, size_t n)
+    {
+        state& s= registry();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for (auto i= s.codecs.begin() ; i!=s.codecs.end() ; ++i)
+            if (i->match(p, n))
+                return &*i;
+        return NULL;
+    }
+
+    // a matcher comparing with a fixed byte string
+    static matcher_t magic(const std::string& bytes)
+    {
+        return [bytes](const uint8_t *p, size_t n) {
+            return n>=bytes.size() && memcmp(p, bytes.data(), bytes.size())==0;
+        };
+    }
+};
+#endif
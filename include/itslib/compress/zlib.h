@@ -2,26 +2,75 @@
 #define __COMPRESS_ZLIB_H__
 
 #include <zlib.h>
+#include <memory>
+#include <vector>
 #include "compress/compressor.h"
 #include "compress/zliballoc.h"
 #include "compress/zliberr.h"
+#include "compress/registry.h"
+
+// a per thread cache of idle stream objects, for code which decompresses many
+// small messages: a released stream is reset() instead of destroyed, and handed
+// out again by the next get() on the same thread.
+//
+//   zlibstreamcache<ZlibDecompress>::ptr z= zlibstreamcache<ZlibDecompress>::get();
+//
+template<typename T>
+class zlibstreamcache {
+    enum { MAXCACHED= 8 };
+    static std::vector<std::unique_ptr<T> >& idle()
+    {
+        thread_local std::vector<std::unique_ptr<T> > list;
+        return list;
+    }
+public:
+    struct releaser {
+        void operator()(T *p) const
+        {
+            std::unique_ptr<T> owner(p);
+            auto& list= idle();
+            if (list.size()>=MAXCACHED)
+                return;
+            try {
+                p->reset();
+            }
+            catch(...) {
+                return;
+            }
+            list.push_back(std::move(owner));
+        }
+    };
+    typedef std::unique_ptr<T, releaser> ptr;
+
+    static ptr get()
+    {
+        auto& list= idle();
+        if (list.empty())
+            return ptr(new T());
+        T *p= list.back().release();
+        list.pop_back();
+        return ptr(p);
+    }
+};
 
 class ZlibDecompress : public decompressor {
     ZlibAllocator _a;
     z_stream _zs;
     bool _eof;
+    bool _inputdone;    // add(NULL, 0) was called
 public:
-    ZlibDecompress()
-        : _eof(false)
+    // windowbits: 15 for zlib, 15+16 for gzip, 15+32 to detect either
+    ZlibDecompress(ZlibAllocator::policy_t policy= ZlibAllocator::POOLED, int windowbits= 15)
+        : _a(policy), _eof(false), _inputdone(false)
     {
         memset(&_zs, 0, sizeof(_zs));
         _a.initstream(_zs);
-        int stat= inflateInit(&_zs);
+        int stat= inflateInit2(&_zs, windowbits);
         if (stat!=Z_OK)
             throw zliberror(stat, "inflateInit2");
     }
-    ZlibDecompress(const uint8_t *data, size_t size)
-        : _eof(false)
+    ZlibDecompress(const uint8_t *data, size_t size, ZlibAllocator::policy_t policy= ZlibAllocator::POOLED)
+        : _a(policy), _eof(false), _inputdone(false)
     {
         memset(&_zs, 0, sizeof(_zs));
         _a.initstream(_zs);
@@ -32,9 +81,29 @@ public:
         if (stat!=Z_OK)
             throw zliberror(stat, "inflateInit");
     }
-    // returns amount of compressed data actually used
+    virtual ~ZlibDecompress()
+    {
+        inflateEnd(&_zs);
+    }
+    // prepare for decompressing a new stream, keeping the allocated state
+    void reset()
+    {
+        _zs.next_in= NULL;
+        _zs.avail_in= 0;
+        int stat= inflateReset(&_zs);
+        if (stat!=Z_OK)
+            throw zliberror(stat, "inflateReset");
+        _eof= false;
+        _inputdone= false;
+    }
+    // returns amount of compressed data actually used.
+    // add(NULL,0) ends the input, after that get() throws when the stream is truncated.
     virtual size_t add(const uint8_t *data, size_t size)
     {
+        if (data==NULL) {
+            _inputdone= true;
+            return 0;
+        }
         if (_zs.avail_in) // don't update in-buffer when we still have one
             return 0;
         _zs.next_in= const_cast<uint8_t*>(data);
@@ -51,11 +120,14 @@ public:
 
         int stat= inflate(&_zs, Z_SYNC_FLUSH);
         if (stat==Z_STREAM_END) {
-            inflateEnd(&_zs);
             _eof= true;
         }
+        else if (stat==Z_BUF_ERROR) {
+            // no progress possible: not fatal while more input can arrive
+            if (_inputdone && _zs.avail_in==0 && size)
+                throw zliberror(stat, "inflate: truncated stream");
+        }
         else if (stat!=Z_OK) {
-            inflateEnd(&_zs);
             throw zliberror(stat, "inflate");
         }
 
@@ -64,20 +136,35 @@ public:
     virtual bool eof() { return _eof; }
     size_t left() const { return _zs.avail_in; }
 };
-class ZlibCompress : public decompressor {
+class ZlibCompress : public compressor {
     ZlibAllocator _a;
     z_stream _zs;
     bool _eof;
 public:
-    ZlibCompress()
-        : _eof(false)
+    // windowbits: 15 for zlib, 15+16 for gzip
+    ZlibCompress(int level= Z_BEST_COMPRESSION, int memlevel= 9, ZlibAllocator::policy_t policy= ZlibAllocator::POOLED, int windowbits= 15)
+        : _a(policy), _eof(false)
     {
         memset(&_zs, 0, sizeof(_zs));
         _a.initstream(_zs);
-        int stat= deflateInit2(&_zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15, 9, Z_DEFAULT_STRATEGY );
+        int stat= deflateInit2(&_zs, level, Z_DEFLATED, windowbits, memlevel, Z_DEFAULT_STRATEGY );
         if (stat!=Z_OK)
             throw zliberror(stat, "deflateInit2");
     }
+    virtual ~ZlibCompress()
+    {
+        deflateEnd(&_zs);
+    }
+    // prepare for compressing a new stream, keeping the allocated state
+    void reset()
+    {
+        _zs.next_in= NULL;
+        _zs.avail_in= 0;
+        int stat= deflateReset(&_zs);
+        if (stat!=Z_OK)
+            throw zliberror(stat, "deflateReset");
+        _eof= false;
+    }
     // returns amount of compressed data actually used
     virtual size_t add(const uint8_t *data, size_t size)
     {
@@ -99,11 +186,15 @@ public:
         int stat= deflate(&_zs, _zs.next_in==NULL ? Z_FINISH : 0);
         //printf("[%p/%d]>[%p/%d]  %d\n", _zs.next_in, _zs.avail_in, _zs.next_out, _zs.avail_out, stat);
         if (stat==Z_STREAM_END) {
-            deflateEnd(&_zs);
             _eof= true;
         }
+        else if (stat==Z_BUF_ERROR) {
+            // no progress possible: not fatal while more input can arrive, but
+            // Z_FINISH with room for output always makes progress
+            if (_zs.next_in==NULL && size)
+                throw zliberror(stat, "deflate");
+        }
         else if (stat!=Z_OK) {
-            deflateEnd(&_zs);
             throw zliberror(stat, "deflate");
         }
 
@@ -112,5 +203,14 @@ public:
     virtual bool eof() { return _eof; }
     size_t left() const { return _zs.avail_in; }
 };
+
+// zlib: deflate method, and the header is a multiple of 31
+inline const bool zlib_registered= compressorregistry::add("zlib",
+        [](const uint8_t *p, size_t n) { return n>=2 && (p[0]&0x0f)==8 && (p[0]>>4)<=7 && ((p[0]<<8)|p[1])%31==0; },
+        []() { return std::make_shared<ZlibDecompress>(); },
+        []() { return std::make_shared<ZlibCompress>(Z_DEFAULT_COMPRESSION, 8); });
+inline const bool gzip_registered= compressorregistry::add("gzip", compressorregistry::magic(std::string("\x1f\x8b", 2)),
+        []() { return std::make_shared<ZlibDecompress>(ZlibAllocator::POOLED, 15+16); },
+        []() { return std::make_shared<ZlibCompress>(Z_DEFAULT_COMPRESSION, 8, ZlibAllocator::POOLED, 15+16); });
 #endif
 
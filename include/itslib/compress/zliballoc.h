@@ -3,12 +3,81 @@
 
 #include <zlib.h>
 #include <string.h>
+#include <vector>
+
+// ZlibAllocator provides the zalloc/zfree functions for a z_stream.
+//
+// by default freed blocks are kept in a per thread pool, and reused by the next
+// stream on that thread needing a block of the same size. zlib allocates the
+// same few sizes for each stream, so creating many short lived streams
+// does not keep allocating and freeing the same hundreds of kilobytes.
+//
+// with the SECUREWIPE policy blocks are not pooled, but erased before being freed,
+// to avoid sensitive data leaking in memory.
 class ZlibAllocator {
 public:
+    enum policy_t { POOLED, SECUREWIPE };
+
     struct memblock {
         size_t size;
         uint8_t  data[1];
     };
+private:
+    // per thread cache of freed blocks
+    struct blockpool {
+        enum { MAXBYTES= 4*1024*1024 };
+        std::vector<memblock*> _free;
+        size_t _bytes;
+
+        blockpool() : _bytes(0) { }
+        ~blockpool()
+        {
+            closed()= true;
+            for (auto i= _free.begin() ; i!=_free.end() ; ++i)
+                delete[] reinterpret_cast<uint8_t*>(*i);
+        }
+        memblock *get(size_t size)
+        {
+            for (size_t i= _free.size() ; i-->0 ; ) {
+                memblock *ptr= _free[i];
+                if (ptr->size==size) {
+                    _free[i]= _free.back();
+                    _free.pop_back();
+                    _bytes -= size;
+                    return ptr;
+                }
+            }
+            return NULL;
+        }
+        bool put(memblock *ptr)
+        {
+            if (_bytes+ptr->size > MAXBYTES)
+                return false;
+            _free.push_back(ptr);
+            _bytes += ptr->size;
+            return true;
+        }
+    };
+    static blockpool& pool()
+    {
+        thread_local blockpool p;
+        return p;
+    }
+    // set when the pool was destroyed at thread exit, while other thread_local
+    // objects may still own streams.
+    static bool& closed()
+    {
+        thread_local bool flag= false;
+        return flag;
+    }
+    bool usepool() const { return _policy==POOLED && !closed(); }
+
+    policy_t _policy;
+public:
+    ZlibAllocator(policy_t policy= POOLED)
+        : _policy(policy)
+    {
+    }
     void initstream(z_stream& zs)
     {
         zs.opaque= this;
@@ -26,6 +95,11 @@ public:
     }
     voidpf alloc(uInt items, uInt size)
     {
+        if (usepool()) {
+            memblock *ptr= pool().get(items*size);
+            if (ptr)
+                return ptr->data;
+        }
         memblock *ptr= reinterpret_cast<memblock*>(new uint8_t[items*size+sizeof(size_t)]);
         ptr->size = items*size;
         //printf("NEW %p[%d] -> %p\n", ptr, ptr->size, ptr->data);
@@ -34,10 +108,12 @@ public:
     void   free(voidpf address)
     {
         memblock *ptr= reinterpret_cast<memblock*>(static_cast<uint8_t*>(address)-sizeof(size_t));
-        // erase to avoid sensitive data leaking in memory
         //printf("DEL %p[%d] -> %p == %p\n", ptr, ptr->size, ptr->data, address);
-        memset(ptr->data, 0, ptr->size);
-        delete reinterpret_cast<uint8_t*>(ptr);
+        if (_policy==SECUREWIPE)
+            memset(ptr->data, 0, ptr->size);
+        else if (usepool() && pool().put(ptr))
+            return;
+        delete[] reinterpret_cast<uint8_t*>(ptr);
     }
 };
 #endif
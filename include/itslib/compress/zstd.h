@@ -0,0 +1,148 @@
+#ifndef __COMPRESS_ZSTD_H__
+#define __COMPRESS_ZSTD_H__
+
+#include <zstd.h>
+#include <string>
+#include "compress/compressor.h"
+#include "compress/registry.h"
+
+// zstd streaming (de)compression, with the same add/get interface as ZlibCompress.
+// link with -lzstd.
+struct zstderror {
+    size_t code;
+    std::string msg;
+    zstderror(size_t code, const char*msg)
+        : code(code), msg(msg)
+    {
+    }
+    ~zstderror()
+    {
+        printf("ZSTD[%s]: %s\n", ZSTD_getErrorName(code), msg.c_str());
+    }
+};
+
+class ZstdDecompress : public decompressor {
+    ZSTD_DCtx *_ctx;
+    ZSTD_inBuffer _in;
+    bool _eof;
+public:
+    ZstdDecompress()
+        : _ctx(ZSTD_createDCtx()), _eof(false)
+    {
+        if (_ctx==NULL)
+            throw "ZSTD_createDCtx failed";
+        _in.src= NULL;
+        _in.size= _in.pos= 0;
+    }
+    virtual ~ZstdDecompress()
+    {
+        ZSTD_freeDCtx(_ctx);
+    }
+    // prepare for decompressing a new frame, keeping the allocated state
+    void reset()
+    {
+        ZSTD_DCtx_reset(_ctx, ZSTD_reset_session_only);
+        _in.src= NULL;
+        _in.size= _in.pos= 0;
+        _eof= false;
+    }
+    // returns amount of compressed data actually used
+    virtual size_t add(const uint8_t *data, size_t size)
+    {
+        if (left()) // don't update in-buffer when we still have one
+            return 0;
+        _in.src= data;
+        _in.size= size;
+        _in.pos= 0;
+
+        return size;
+    }
+
+    // returns amount of decompressed data
+    virtual size_t get(uint8_t *data, size_t size)
+    {
+        if (_eof)
+            return 0;
+        ZSTD_outBuffer out= { data, size, 0 };
+        size_t ret= ZSTD_decompressStream(_ctx, &out, &_in);
+        if (ZSTD_isError(ret))
+            throw zstderror(ret, "ZSTD_decompressStream");
+        if (ret==0)
+            _eof= true;
+
+        return out.pos;
+    }
+    virtual bool eof() { return _eof; }
+    size_t left() const { return _in.size-_in.pos; }
+};
+class ZstdCompress : public compressor {
+    ZSTD_CCtx *_ctx;
+    ZSTD_inBuffer _in;
+    bool _finishing;
+    bool _eof;
+public:
+    ZstdCompress(int level= ZSTD_CLEVEL_DEFAULT, int nthreads= 0)
+        : _ctx(ZSTD_createCCtx()), _finishing(false), _eof(false)
+    {
+        if (_ctx==NULL)
+            throw "ZSTD_createCCtx failed";
+        size_t ret= ZSTD_CCtx_setParameter(_ctx, ZSTD_c_compressionLevel, level);
+        if (ZSTD_isError(ret))
+            throw zstderror(ret, "ZSTD_c_compressionLevel");
+        // fails when libzstd was built without multithreading, then just compress on this thread.
+        if (nthreads)
+            ZSTD_CCtx_setParameter(_ctx, ZSTD_c_nbWorkers, nthreads);
+        _in.src= NULL;
+        _in.size= _in.pos= 0;
+    }
+    virtual ~ZstdCompress()
+    {
+        ZSTD_freeCCtx(_ctx);
+    }
+    // prepare for compressing a new frame, keeping the allocated state and parameters
+    void reset()
+    {
+        ZSTD_CCtx_reset(_ctx, ZSTD_reset_session_only);
+        _in.src= NULL;
+        _in.size= _in.pos= 0;
+        _finishing= false;
+        _eof= false;
+    }
+    // returns amount of data actually used, add(NULL,0) ends the input.
+    virtual size_t add(const uint8_t *data, size_t size)
+    {
+        if (data==NULL) {
+            _finishing= true;
+            return 0;
+        }
+        if (left() || _finishing)
+            return 0;
+        _in.src= data;
+        _in.size= size;
+        _in.pos= 0;
+
+        return size;
+    }
+
+    // returns amount of compressed data
+    virtual size_t get(uint8_t *data, size_t size)
+    {
+        if (_eof)
+            return 0;
+        ZSTD_outBuffer out= { data, size, 0 };
+        size_t ret= ZSTD_compressStream2(_ctx, &out, &_in, _finishing ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(ret))
+            throw zstderror(ret, "ZSTD_compressStream2");
+        if (_finishing && ret==0)
+            _eof= true;
+
+        return out.pos;
+    }
+    virtual bool eof() { return _eof; }
+    size_t left() const { return _in.size-_in.pos; }
+};
+
+inline const bool zstd_registered= compressorregistry::add("zstd", compressorregistry::magic(std::string("\x28\xb5\x2f\xfd", 4)),
+        []() { return std::make_shared<ZstdDecompress>(); },
+        []() { return std::make_shared<ZstdCompress>(); });
+#endif
@@ -0,0 +1,233 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#ifdef _WIN32
+#define _CRT_RAND_S
+#include <stdlib.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+// the chacha20 block function, with a 64 bit block counter and no nonce, as in djb's original.
+struct chacha20 {
+    static uint32_t rotl(uint32_t x, int n) { return (x<<n) | (x>>(32-n)); }
+    static void quarterround(uint32_t *x, int a, int b, int c, int d)
+    {
+        x[a] += x[b]; x[d]= rotl(x[d]^x[a], 16);
+        x[c] += x[d]; x[b]= rotl(x[b]^x[c], 12);
+        x[a] += x[b]; x[d]= rotl(x[d]^x[a], 8);
+        x[c] += x[d]; x[b]= rotl(x[b]^x[c], 7);
+    }
+    static uint32_t load32le(const uint8_t *p)
+    {
+        return p[0] | (p[1]<<8) | (p[2]<<16) | (uint32_t(p[3])<<24);
+    }
+    // write 'nblocks' x 64 bytes of keystream to 'out'
+    static void blocks(const uint8_t *key, uint64_t counter, uint8_t *out, size_t nblocks)
+    {
+        uint32_t in[16];
+        in[0]= 0x61707865; in[1]= 0x3320646e; in[2]= 0x79622d32; in[3]= 0x6b206574;
+        for (int i=0 ; i<8 ; i++)
+            in[4+i]= load32le(key+4*i);
+        in[14]= in[15]= 0;
+
+        for (size_t b=0 ; b<nblocks ; b++, counter++) {
+            in[12]= uint32_t(counter);
+            in[13]= uint32_t(counter>>32);
+            uint32_t x[16];
+            memcpy(x, in, sizeof(x));
+            for (int r=0 ; r<10 ; r++) {
+                quarterround(x, 0, 4, 8, 12);
+                quarterround(x, 1, 5, 9, 13);
+                quarterround(x, 2, 6, 10, 14);
+                quarterround(x, 3, 7, 11, 15);
+                quarterround(x, 0, 5, 10, 15);
+                quarterround(x, 1, 6, 11, 12);
+                quarterround(x, 2, 7, 8, 13);
+                quarterround(x, 3, 4, 9, 14);
+            }
+            for (int i=0 ; i<16 ; i++) {
+                uint32_t v= x[i]+in[i];
+                out[4*i+0]= v;
+                out[4*i+1]= v>>8;
+                out[4*i+2]= v>>16;
+                out[4*i+3]= v>>24;
+            }
+            out += 64;
+        }
+        memset(in, 0, sizeof(in));
+    }
+};
+
+// chacha20drbg is a userspace random generator, like openbsd's arc4random:
+// the output of chacha20, keyed with entropy from the os.
+//
+// the keystream is generated 1k at a time, after which the first 32 bytes
+// immediately replace the key ( 'fast key erasure' ), and served bytes are wiped,
+// so a later memory disclosure does not reveal earlier output.
+//
+// new os entropy is mixed in every RESEEDBYTES bytes, and after fork, so
+// parent and child never return the same bytes.
+//
+// use the per thread instance from local(), it is not threadsafe.
+class chacha20drbg {
+    enum { KEYSIZE= 32, BUFSIZE= 1024, RESEEDBYTES= 1600000 };
+    uint8_t _key[KEYSIZE];
+    uint8_t _buf[BUFSIZE];
+    size_t _avail;          // unused bytes at the end of _buf
+    size_t _untilreseed;
+    unsigned _forkgen;
+    bool _seeded;
+
+    // incremented in the child after every fork
+    static std::atomic<unsigned>& forkgeneration()
+    {
+        static std::atomic<unsigned> gen(0);
+        return gen;
+    }
+    static unsigned currentgeneration()
+    {
+#ifndef _WIN32
+        static bool registered= pthread_atfork(NULL, NULL, [](){ forkgeneration()++; })==0;
+        (void)registered;
+#endif
+        return forkgeneration().load(std::memory_order_relaxed);
+    }
+public:
+    // fill 'p' with entropy from the os, this is a syscall.
+    static void osentropy(uint8_t *p, size_t n)
+    {
+#if defined(_WIN32)
+        while (n) {
+            unsigned int v;
+            if (rand_s(&v))
+                throw "rng error";
+            size_t want= n<sizeof(v) ? n : sizeof(v);
+            memcpy(p, &v, want);
+            p += want;
+            n -= want;
+        }
+#elif defined(__linux__)
+        while (n) {
+            ssize_t r= getrandom(p, n, 0);
+            if (r<0 && errno==EINTR)
+                continue;
+            if (r<0 && errno==ENOSYS) {
+                // kernels before 3.17
+                int fh= open("/dev/urandom", O_RDONLY);
+                if (fh==-1)
+                    throw "open devrandom";
+                r= read(fh, p, n);
+                close(fh);
+            }
+            if (r<=0)
+                throw "rng error";
+            p += r;
+            n -= r;
+        }
+#else
+        while (n) {
+            size_t want= n<256 ? n : 256;
+            if (getentropy(p, want))
+                throw "rng error";
+            p += want;
+            n -= want;
+        }
+#endif
+    }
+private:
+    void refill()
+    {
+        chacha20::blocks(_key, 0, _buf, BUFSIZE/64);
+        memcpy(_key, _buf, KEYSIZE);
+        memset(_buf, 0, KEYSIZE);
+        _avail= BUFSIZE-KEYSIZE;
+    }
+    void reseed()
+    {
+        uint8_t seed[KEYSIZE];
+        osentropy(seed, KEYSIZE);
+        for (int i=0 ; i<KEYSIZE ; i++)
+            _key[i] ^= seed[i];
+        memset(seed, 0, KEYSIZE);
+        memset(_buf, 0, BUFSIZE);
+        _untilreseed= RESEEDBYTES;
+        _forkgen= currentgeneration();
+        _seeded= true;
+        refill();
+    }
+public:
+    chacha20drbg()
+        : _avail(0), _untilreseed(0), _forkgen(0), _seeded(false)
+    {
+        memset(_key, 0, KEYSIZE);
+        memset(_buf, 0, BUFSIZE);
+    }
+    ~chacha20drbg()
+    {
+        memset(_key, 0, KEYSIZE);
+        memset(_buf, 0, BUFSIZE);
+    }
+    void get(uint8_t *p, size_t n)
+    {
+        if (!_seeded || _forkgen!=currentgeneration())
+            reseed();
+        while (n) {
+            if (_avail==0) {
+                if (_untilreseed==0)
+                    reseed();
+                else
+                    refill();
+            }
+            size_t want= n<_avail ? n : _avail;
+            uint8_t *src= _buf+BUFSIZE-_avail;
+            memcpy(p, src, want);
+            memset(src, 0, want);
+            _avail -= want;
+            _untilreseed -= want<_untilreseed ? want : _untilreseed;
+            p += want;
+            n -= want;
+        }
+    }
+    uint32_t get32()
+    {
+        uint32_t v;
+        get((uint8_t*)&v, sizeof(v));
+        return v;
+    }
+    uint64_t get64()
+    {
+        uint64_t v;
+        get((uint8_t*)&v, sizeof(v));
+        return v;
+    }
+    // uniform in [0, m), without modulo bias ( lemire's method ).
+    uint32_t uniform(uint32_t m)
+    {
+        if (m==0)
+            throw "rng: empty range";
+        uint64_t x= uint64_t(get32())*m;
+        uint32_t low= uint32_t(x);
+        if (low<m) {
+            uint32_t threshold= uint32_t(-m) % m;
+            while (low<threshold) {
+                x= uint64_t(get32())*m;
+                low= uint32_t(x);
+            }
+        }
+        return uint32_t(x>>32);
+    }
+
+    static chacha20drbg& local()
+    {
+        thread_local chacha20drbg rng;
+        return rng;
+    }
+};
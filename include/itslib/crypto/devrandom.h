@@ -1,38 +1,32 @@
 #pragma once
-#ifndef _WIN32
-#include <unistd.h>
-#endif
-#include <fcntl.h>
+#include <stdint.h>
+#include "crypto/chacha20.h"
+
+// random numbers from a per thread chacha20drbg, which is seeded from
+// getrandom(), so no syscall is needed for every number.
+//
+// 'strong' and 'quick' are the same generator now: getrandom only blocks until the
+// kernel's pool has been initialized once, which is all /dev/random still meant.
 struct devrandom {
-    int fh;
-    devrandom(bool strong= true)
-    {
-        fh= open(strong ? "/dev/random" : "/dev/urandom", O_RDONLY);
-        if (fh==-1)
-            throw "open devrandom";
-    }
-    ~devrandom()
+    // the argument is ignored, the drbg is always used. it is kept for
+    // compatibility with code which chose between /dev/random and /dev/urandom.
+    devrandom(bool /*strong*/= true)
     {
-        close(fh);
     }
     uint8_t get()
     {
         uint8_t byte;
-        if (1!=read(fh, &byte, 1))
-            throw "rng error";
+        chacha20drbg::local().get(&byte, 1);
         return byte;
     }
+    // uniform in [0, m)
     uint32_t get(uint32_t m)
     {
-        uint32_t val= 0;
-        if (sizeof(val)!=read(fh, &val, sizeof(val)))
-            throw "rng error";
-        return val % m;
+        return chacha20drbg::local().uniform(m);
     }
     void get(uint8_t *bytes, size_t n)
     {
-        if (n!=read(fh, bytes,n))
-            throw "rng error";
+        chacha20drbg::local().get(bytes, n);
     }
     static devrandom& strong()
     {
@@ -48,15 +42,10 @@ struct devrandom {
 };
 inline uint64_t quickrandomnum()
 {
-    uint64_t num;
-    devrandom::quick().get((uint8_t*)&num, sizeof(num));
-    return num;
+    return chacha20drbg::local().get64();
 }
 
 inline uint64_t strongrandomnum()
 {
-    uint64_t num;
-    devrandom::strong().get((uint8_t*)&num, sizeof(num));
-    return num;
+    return chacha20drbg::local().get64();
 }
-
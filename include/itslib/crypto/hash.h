@@ -7,6 +7,13 @@
 #include <string.h>
 #include <vector>
 
+// one message for the hash_many batch functions
+struct hashinput {
+    const uint8_t *data;
+    size_t size;
+};
+#include "crypto/sha256mb.h"
+
 class hash {
 public:
     virtual ~hash() { }
@@ -55,6 +62,24 @@ public:  \
         FINAL(&h[0], &ctx); \
         return h; \
     } \
+    /* hash 'n' messages, writing n*DigestSize bytes to 'out' */ \
+    static void hash_many(const hashinput *in, size_t n, uint8_t *out); \
+    static void hash_many_serial(const hashinput *in, size_t n, uint8_t *out) \
+    { \
+        CTX c; \
+        for (size_t i=0 ; i<n ; i++) { \
+            INIT(&c); \
+            ADD(&c, in[i].data, in[i].size); \
+            FINAL(out+i*DigestSize, &c); \
+        } \
+        memset(&c, 0, sizeof(c)); \
+    } \
+    static void hash_many(const std::vector<hashinput>& in, std::vector<uint8_t>& out) \
+    { \
+        out.resize(in.size()*DigestSize); \
+        if (!in.empty()) \
+            hash_many(&in[0], in.size(), &out[0]); \
+    } \
 };
 
 declarehash(Sha1, SHA_CTX, SHA_DIGEST_LENGTH, 64, SHA1_Init, SHA1_Update, SHA1_Final)
@@ -63,4 +88,18 @@ declarehash(Sha512, SHA512_CTX, SHA512_DIGEST_LENGTH, 128, SHA512_Init, SHA512_U
 declarehash(Md5, MD5_CTX, MD5_DIGEST_LENGTH, 64, MD5_Init, MD5_Update, MD5_Final)
 declarehash(Ripemd160, RIPEMD160_CTX, RIPEMD160_DIGEST_LENGTH, 64, RIPEMD160_Init, RIPEMD160_Update, RIPEMD160_Final)
 
+inline void Sha1::hash_many(const hashinput *in, size_t n, uint8_t *out) { hash_many_serial(in, n, out); }
+inline void Sha512::hash_many(const hashinput *in, size_t n, uint8_t *out) { hash_many_serial(in, n, out); }
+inline void Md5::hash_many(const hashinput *in, size_t n, uint8_t *out) { hash_many_serial(in, n, out); }
+inline void Ripemd160::hash_many(const hashinput *in, size_t n, uint8_t *out) { hash_many_serial(in, n, out); }
+
+// with only a few messages, most simd lanes would be idle.
+inline void Sha256::hash_many(const hashinput *in, size_t n, uint8_t *out)
+{
+    if (sha256multibuffer::lanes() && n>=4)
+        sha256multibuffer::hash(in, n, out);
+    else
+        hash_many_serial(in, n, out);
+}
+
 #endif
@@ -0,0 +1,80 @@
+// the multi-buffer sha256 compression function, for one instruction set.
+// no include guard: sha256mb.h includes this once per instruction set, with SHA256MB_V
+// defined as the traits, and SHA256MB_TARGET as its target attribute.
+//
+// all functions which pass vectors by value have that target attribute, so the code is
+// correct without inlining, compress itself only takes pointers, and can be called from anywhere.
+
+template<>
+struct sha256compress<SHA256MB_V> {
+    typedef SHA256MB_V V;
+    typedef V::vec vec;
+    enum { LANES= V::LANES };
+
+    SHA256MB_TARGET SHA256MB_INLINE
+    static void round(const vec& a, const vec& b, const vec& c, vec& d, const vec& e, const vec& f, const vec& g, vec& h, uint32_t k, const vec& w)
+    {
+        vec t1= V::add(V::add(h, V::xor3(V::ror<6>(e), V::ror<11>(e), V::ror<25>(e))),
+                       V::add(V::ch(e, f, g), V::add(V::set1(k), w)));
+        vec t2= V::add(V::xor3(V::ror<2>(a), V::ror<13>(a), V::ror<22>(a)), V::maj(a, b, c));
+        d= V::add(d, t1);
+        h= V::add(t1, t2);
+    }
+    SHA256MB_TARGET SHA256MB_INLINE
+    static const vec& schedule(vec *W, int i)
+    {
+        vec w15= W[(i+1)&15], w2= W[(i+14)&15];
+        vec s0= V::xor3(V::ror<7>(w15), V::ror<18>(w15), V::shr<3>(w15));
+        vec s1= V::xor3(V::ror<17>(w2), V::ror<19>(w2), V::shr<10>(w2));
+        W[i&15]= V::add(V::add(W[i&15], s0), V::add(W[(i+9)&15], s1));
+        return W[i&15];
+    }
+    // st[word*LANES+lane]
+    SHA256MB_TARGET
+    static void compress(uint32_t *st, const uint8_t *const *blk)
+    {
+        static const uint32_t K[64]= {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        vec W[16];
+        V::loadblocks(blk, W);
+
+        vec a= V::load(st+0*LANES), b= V::load(st+1*LANES), c= V::load(st+2*LANES), d= V::load(st+3*LANES);
+        vec e= V::load(st+4*LANES), f= V::load(st+5*LANES), g= V::load(st+6*LANES), h= V::load(st+7*LANES);
+        for (int i=0 ; i<16 ; i+=8) {
+            round(a, b, c, d, e, f, g, h, K[i+0], W[i+0]);
+            round(h, a, b, c, d, e, f, g, K[i+1], W[i+1]);
+            round(g, h, a, b, c, d, e, f, K[i+2], W[i+2]);
+            round(f, g, h, a, b, c, d, e, K[i+3], W[i+3]);
+            round(e, f, g, h, a, b, c, d, K[i+4], W[i+4]);
+            round(d, e, f, g, h, a, b, c, K[i+5], W[i+5]);
+            round(c, d, e, f, g, h, a, b, K[i+6], W[i+6]);
+            round(b, c, d, e, f, g, h, a, K[i+7], W[i+7]);
+        }
+        for (int i=16 ; i<64 ; i+=8) {
+            round(a, b, c, d, e, f, g, h, K[i+0], schedule(W, i+0));
+            round(h, a, b, c, d, e, f, g, K[i+1], schedule(W, i+1));
+            round(g, h, a, b, c, d, e, f, K[i+2], schedule(W, i+2));
+            round(f, g, h, a, b, c, d, e, K[i+3], schedule(W, i+3));
+            round(e, f, g, h, a, b, c, d, K[i+4], schedule(W, i+4));
+            round(d, e, f, g, h, a, b, c, K[i+5], schedule(W, i+5));
+            round(c, d, e, f, g, h, a, b, K[i+6], schedule(W, i+6));
+            round(b, c, d, e, f, g, h, a, K[i+7], schedule(W, i+7));
+        }
+        V::store(st+0*LANES, V::add(a, V::load(st+0*LANES)));
+        V::store(st+1*LANES, V::add(b, V::load(st+1*LANES)));
+        V::store(st+2*LANES, V::add(c, V::load(st+2*LANES)));
+        V::store(st+3*LANES, V::add(d, V::load(st+3*LANES)));
+        V::store(st+4*LANES, V::add(e, V::load(st+4*LANES)));
+        V::store(st+5*LANES, V::add(f, V::load(st+5*LANES)));
+        V::store(st+6*LANES, V::add(g, V::load(st+6*LANES)));
+        V::store(st+7*LANES, V::add(h, V::load(st+7*LANES)));
+    }
+};
@@ -0,0 +1,259 @@
+#ifndef __CRYPTO_SHA256MB_H__
+#define __CRYPTO_SHA256MB_H__
+// multi-buffer sha256: hashes 8 ( avx2 ) or 16 ( avx512 ) independent messages at once,
+// one message per 32 bit vector lane.
+// used by Sha256::hash_many in crypto/hash.h.
+//
+// the simd code is compiled with target attributes, so no special compiler flags
+// are needed, sha256multibuffer::lanes() tells what the cpu supports at runtime.
+// define _NO_SHA256MB to leave out the simd code.
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(_NO_SHA256MB) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define _HAVE_SHA256MB
+#include <immintrin.h>
+#include <cpuid.h>
+
+// gcc warns about the _mm512_undefined_epi32() in its own intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+#define SHA256MB_INLINE __attribute__((always_inline))
+#define SHA256MB_AVX2 __attribute__((target("avx2"))) SHA256MB_INLINE
+#define SHA256MB_AVX512 __attribute__((target("avx2,avx512f"))) SHA256MB_INLINE
+
+struct sha256avx2 {
+    typedef __m256i vec;
+    enum { LANES= 8 };
+    SHA256MB_AVX2 static vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    SHA256MB_AVX2 static vec xor3(vec a, vec b, vec c) { return _mm256_xor_si256(_mm256_xor_si256(a, b), c); }
+    template<int N>
+    SHA256MB_AVX2 static vec ror(vec x) { return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32-N)); }
+    template<int N>
+    SHA256MB_AVX2 static vec shr(vec x) { return _mm256_srli_epi32(x, N); }
+    SHA256MB_AVX2 static vec ch(vec e, vec f, vec g) { return _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g))); }
+    SHA256MB_AVX2 static vec maj(vec a, vec b, vec c) { return _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))); }
+    SHA256MB_AVX2 static vec set1(uint32_t x) { return _mm256_set1_epi32(x); }
+    SHA256MB_AVX2 static vec load(const uint32_t *p) { return _mm256_load_si256((const vec*)p); }
+    SHA256MB_AVX2 static void store(uint32_t *p, vec x) { _mm256_store_si256((vec*)p, x); }
+
+    // W[i]= big endian word i of the block of each lane, for 8 lanes
+    SHA256MB_AVX2 static void loadblocks(const uint8_t *const *blk, vec *W)
+    {
+        const vec bswap= _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                          3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+        for (int h=0 ; h<2 ; h++) {
+            vec r[8];
+            for (int i=0 ; i<8 ; i++)
+                r[i]= _mm256_shuffle_epi8(_mm256_loadu_si256((const vec*)(blk[i]+32*h)), bswap);
+
+            // transpose 8x8 words
+            vec t0= _mm256_unpacklo_epi32(r[0], r[1]), t1= _mm256_unpackhi_epi32(r[0], r[1]);
+            vec t2= _mm256_unpacklo_epi32(r[2], r[3]), t3= _mm256_unpackhi_epi32(r[2], r[3]);
+            vec t4= _mm256_unpacklo_epi32(r[4], r[5]), t5= _mm256_unpackhi_epi32(r[4], r[5]);
+            vec t6= _mm256_unpacklo_epi32(r[6], r[7]), t7= _mm256_unpackhi_epi32(r[6], r[7]);
+
+            vec u0= _mm256_unpacklo_epi64(t0, t2), u1= _mm256_unpackhi_epi64(t0, t2);
+            vec u2= _mm256_unpacklo_epi64(t1, t3), u3= _mm256_unpackhi_epi64(t1, t3);
+            vec u4= _mm256_unpacklo_epi64(t4, t6), u5= _mm256_unpackhi_epi64(t4, t6);
+            vec u6= _mm256_unpacklo_epi64(t5, t7), u7= _mm256_unpackhi_epi64(t5, t7);
+
+            W[8*h+0]= _mm256_permute2x128_si256(u0, u4, 0x20);
+            W[8*h+1]= _mm256_permute2x128_si256(u1, u5, 0x20);
+            W[8*h+2]= _mm256_permute2x128_si256(u2, u6, 0x20);
+            W[8*h+3]= _mm256_permute2x128_si256(u3, u7, 0x20);
+            W[8*h+4]= _mm256_permute2x128_si256(u0, u4, 0x31);
+            W[8*h+5]= _mm256_permute2x128_si256(u1, u5, 0x31);
+            W[8*h+6]= _mm256_permute2x128_si256(u2, u6, 0x31);
+            W[8*h+7]= _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+    }
+};
+struct sha256avx512 {
+    typedef __m512i vec;
+    enum { LANES= 16 };
+    SHA256MB_AVX512 static vec add(vec a, vec b) { return _mm512_add_epi32(a, b); }
+    SHA256MB_AVX512 static vec xor3(vec a, vec b, vec c) { return _mm512_ternarylogic_epi32(a, b, c, 0x96); }
+    template<int N>
+    SHA256MB_AVX512 static vec ror(vec x) { return _mm512_ror_epi32(x, N); }
+    template<int N>
+    SHA256MB_AVX512 static vec shr(vec x) { return _mm512_srli_epi32(x, N); }
+    SHA256MB_AVX512 static vec ch(vec e, vec f, vec g) { return _mm512_ternarylogic_epi32(e, f, g, 0xca); }
+    SHA256MB_AVX512 static vec maj(vec a, vec b, vec c) { return _mm512_ternarylogic_epi32(a, b, c, 0xe8); }
+    SHA256MB_AVX512 static vec set1(uint32_t x) { return _mm512_set1_epi32(x); }
+    SHA256MB_AVX512 static vec load(const uint32_t *p) { return _mm512_load_si512((const vec*)p); }
+    SHA256MB_AVX512 static void store(uint32_t *p, vec x) { _mm512_store_si512((vec*)p, x); }
+
+    // two avx2 transposes, for lanes 0-7 and 8-15
+    SHA256MB_AVX512 static void loadblocks(const uint8_t *const *blk, vec *W)
+    {
+        __m256i lo[16], hi[16];
+        sha256avx2::loadblocks(blk, lo);
+        sha256avx2::loadblocks(blk+8, hi);
+        for (int i=0 ; i<16 ; i++)
+            W[i]= _mm512_inserti64x4(_mm512_zextsi256_si512(lo[i]), hi[i], 1);
+    }
+};
+
+// the sha256 compression function, for one of the vector types above.
+template<typename V>
+struct sha256compress;
+
+#define SHA256MB_V sha256avx2
+#define SHA256MB_TARGET __attribute__((target("avx2")))
+#include "crypto/sha256compress.h"
+#undef SHA256MB_V
+#undef SHA256MB_TARGET
+
+#define SHA256MB_V sha256avx512
+#define SHA256MB_TARGET __attribute__((target("avx2,avx512f")))
+#include "crypto/sha256compress.h"
+#undef SHA256MB_V
+#undef SHA256MB_TARGET
+
+// lane scheduling, no vectors here, so this needs no target attribute.
+template<typename V>
+struct sha256lanes {
+    enum { LANES= V::LANES };
+
+    struct lane {
+        const uint8_t *data;    // next full block of the message
+        size_t fullblocks;      // nr of full message blocks left
+        size_t tailblocks;      // 1 or 2: the last partial block, padding and length
+        size_t tailused;
+        uint8_t *out;           // NULL when the lane is idle
+        uint8_t tail[128];
+
+        void start(const uint8_t *p, size_t n, uint8_t *digest)
+        {
+            data= p;
+            fullblocks= n/64;
+            size_t rest= n%64;
+            tailblocks= rest+9<=64 ? 1 : 2;
+            tailused= 0;
+            out= digest;
+
+            memset(tail, 0, sizeof(tail));
+            if (rest)
+                memcpy(tail, p+64*fullblocks, rest);
+            tail[rest]= 0x80;
+            uint64_t bits= uint64_t(n)*8;
+            for (int i=0 ; i<8 ; i++)
+                tail[64*tailblocks-1-i]= bits>>(8*i);
+        }
+        const uint8_t *nextblock()
+        {
+            if (fullblocks) {
+                fullblocks--;
+                data += 64;
+                return data-64;
+            }
+            return tail+64*tailused++;
+        }
+        bool done() const { return fullblocks==0 && tailused==tailblocks; }
+    };
+
+    // hash 'n' messages, each digest is 32 bytes.
+    // when a message is finished, its lane is refilled with the next message,
+    // so messages of different lengths keep all lanes busy.
+    template<typename INPUT>
+    static void hash(const INPUT *in, size_t n, uint8_t *out)
+    {
+        static const uint32_t IV[8]= { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+        static const uint8_t idle[64]= { 0 };
+
+        alignas(64) uint32_t st[8*LANES];
+        lane lanes[LANES];
+        const uint8_t *blk[LANES];
+        size_t next= 0, active= 0;
+
+        auto startlane= [&](int l) {
+            if (next<n) {
+                lanes[l].start(in[next].data, in[next].size, out+32*next);
+                for (int w=0 ; w<8 ; w++)
+                    st[w*LANES+l]= IV[w];
+                next++;
+                active++;
+            }
+            else {
+                lanes[l].out= NULL;
+            }
+        };
+        for (int l=0 ; l<LANES ; l++)
+            startlane(l);
+        while (active) {
+            for (int l=0 ; l<LANES ; l++)
+                blk[l]= lanes[l].out ? lanes[l].nextblock() : idle;
+            sha256compress<V>::compress(st, blk);
+            for (int l=0 ; l<LANES ; l++) {
+                if (lanes[l].out==NULL || !lanes[l].done())
+                    continue;
+                for (int w=0 ; w<8 ; w++) {
+                    uint32_t x= st[w*LANES+l];
+                    lanes[l].out[4*w+0]= x>>24;
+                    lanes[l].out[4*w+1]= x>>16;
+                    lanes[l].out[4*w+2]= x>>8;
+                    lanes[l].out[4*w+3]= x;
+                }
+                active--;
+                startlane(l);
+            }
+        }
+    }
+};
+
+class sha256multibuffer {
+    static bool hasshaext()
+    {
+        unsigned a, b, c, d;
+        return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1<<29));
+    }
+    static int detect()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return 16;
+        // openssl uses the sha extensions, which hash one message faster than 8 avx2 lanes
+        if (__builtin_cpu_supports("avx2") && !hasshaext())
+            return 8;
+        return 0;
+    }
+public:
+    // nr of messages hashed in parallel, 0 when the serial openssl code is faster on this cpu
+    static int lanes()
+    {
+        static const int n= detect();
+        return n;
+    }
+    // INPUT has 'data' and 'size' members, like hashinput.
+    template<typename INPUT>
+    static void hash(const INPUT *in, size_t n, uint8_t *out)
+    {
+        if (lanes()==16)
+            sha256lanes<sha256avx512>::hash(in, n, out);
+        else if (lanes()==8)
+            sha256lanes<sha256avx2>::hash(in, n, out);
+        else
+            throw "sha256multibuffer: no simd support";
+    }
+};
+#undef SHA256MB_INLINE
+#undef SHA256MB_AVX2
+#undef SHA256MB_AVX512
+#pragma GCC diagnostic pop
+
+#else
+class sha256multibuffer {
+public:
+    static int lanes() { return 0; }
+    template<typename INPUT>
+    static void hash(const INPUT *in, size_t n, uint8_t *out)
+    {
+        throw "sha256multibuffer: no simd support";
+    }
+};
+#endif
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef __CRYPTO_TREEHASH_H__
+#define __CRYPTO_TREEHASH_H__
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include "util/ReadWriter.h"
+#include "util/rw/MemoryReader.h"
+#include "util/HiresTimer.h"
+
+// hashing the whole contents of a ReadWriter, like a FileReader, BlockDevice or MmapReader.
+// HASH is one of the declarehash classes from crypto/hash.h
+//
+//   hashresult r= hash_readwriter<Sha256>(file);        // the normal sha256 of the file
+//   hashresult t= treehash_readwriter<Sha256>(file, 8); // a merkle tree hash, on 8 threads
+//   printf("%.1f MB/s\n", t.mbps());
+//
+// for MemoryReaders, including MmapReader, the data is hashed in place,
+// other ReadWriters are read sequentially from a single thread, as
+// they are not threadsafe, and work best with sequential access.
+
+struct hashresult {
+    std::vector<uint8_t> digest;
+    uint64_t bytes;
+    double seconds;
+
+    double mbps() const { return seconds>0 ? bytes/seconds/1e6 : 0; }
+};
+
+// a queue of filled buffers, from the reader to the hashing threads.
+// 'nbuffers' limits the memory in use.
+class hashbufferqueue {
+public:
+    struct item {
+        uint64_t index;
+        std::vector<uint8_t> data;
+    };
+private:
+    std::mutex _mtx;
+    std::condition_variable _cond;
+    std::deque<item> _full;
+    std::vector<std::vector<uint8_t> > _free;
+    size_t _nbuffers;
+    bool _done;
+public:
+    hashbufferqueue(size_t nbuffers)
+        : _nbuffers(nbuffers), _done(false)
+    {
+    }
+    // returns an empty buffer, waits when all are in use
+    std::vector<uint8_t> getfree()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (_free.empty() && _nbuffers==0)
+            _cond.wait(lock);
+        if (!_free.empty()) {
+            std::vector<uint8_t> v;
+            v.swap(_free.back());
+            _free.pop_back();
+            return v;
+        }
+        _nbuffers--;
+        return std::vector<uint8_t>();
+    }
+    void putfree(std::vector<uint8_t>& v)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _free.emplace_back();
+        _free.back().swap(v);
+        _cond.notify_all();
+    }
+    void putfull(uint64_t index, std::vector<uint8_t>& v)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _full.emplace_back();
+        _full.back().index= index;
+        _full.back().data.swap(v);
+        _cond.notify_all();
+    }
+    // after this getfull returns false when the queue is empty
+    void finish()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _done= true;
+        _cond.notify_all();
+    }
+    bool getfull(item& it)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (_full.empty() && !_done)
+            _cond.wait(lock);
+        if (_full.empty())
+            return false;
+        it.index= _full.front().index;
+        it.data.swap(_full.front().data);
+        _full.pop_front();
+        return true;
+    }
+};
+
+// read 'r' from the start, in blocks of 'blocksize', into the queue
+inline void hash_readblocks(ReadWriter& r, hashbufferqueue& q, size_t blocksize)
+{
+    uint64_t total= r.size();
+    r.setpos(0);
+    uint64_t index= 0;
+    for (uint64_t ofs= 0 ; ofs<total ; ofs += blocksize, index++) {
+        std::vector<uint8_t> buf= q.getfree();
+        buf.resize(std::min(uint64_t(blocksize), total-ofs));
+        size_t n= r.read(&buf[0], buf.size());
+        if (n!=buf.size())
+            throw "hash_readwriter: short read";
+        q.putfull(index, buf);
+    }
+}
+
+// the standard digest of the whole of 'r'.
+// reading is done on a separate thread, so io and hashing overlap.
+template<typename HASH>
+hashresult hash_readwriter(ReadWriter& r, size_t blocksize= 1024*1024)
+{
+    HiresTimer t;
+    hashresult res;
+    res.bytes= r.size();
+    res.digest.resize(HASH::DigestSize);
+
+    HASH h;
+    MemoryReader *m= dynamic_cast<MemoryReader*>(&r);
+    if (m) {
+        h.add(m->memory(), m->size());
+    }
+    else {
+        hashbufferqueue q(4);
+        const char *error= NULL;
+        std::thread reader([&]() {
+            try {
+                hash_readblocks(r, q, blocksize);
+            }
+            catch(const char *msg) {
+                error= msg;
+            }
+            catch(...) {
+                error= "hash_readwriter: read error";
+            }
+            q.finish();
+        });
+        hashbufferqueue::item it;
+        while (q.getfull(it)) {
+            h.add(&it.data[0], it.data.size());
+            q.putfree(it.data);
+        }
+        reader.join();
+        if (error)
+            throw error;
+    }
+    h.final(&res.digest[0]);
+    res.seconds= t.elapsed()/1e6;
+    return res;
+}
+
+// a merkle tree hash of 'r', like rfc6962 uses for certificate transparency:
+//   leaf= H(0x00 || chunk), node= H(0x01 || left || right)
+// the leafs are 'chunksize' bytes, a leftover node is moved up a level unchanged.
+// the result does not depend on the nr of threads, but does depend on the chunksize.
+template<typename HASH>
+hashresult treehash_readwriter(ReadWriter& r, unsigned nthreads= 0, size_t chunksize= 1024*1024)
+{
+    enum { DS= HASH::DigestSize };
+    HiresTimer t;
+    hashresult res;
+    res.bytes= r.size();
+    res.digest.resize(DS);
+
+    if (nthreads==0)
+        nthreads= std::max(1u, std::thread::hardware_concurrency());
+    uint64_t nchunks= (res.bytes+chunksize-1)/chunksize;
+    if (nchunks==0) {
+        HASH h;
+        h.final(&res.digest[0]);
+        res.seconds= t.elapsed()/1e6;
+        return res;
+    }
+    std::vector<uint8_t> level(nchunks*DS);
+
+    auto hashleaf= [&level](uint64_t index, const uint8_t *p, size_t n) {
+        const uint8_t prefix= 0;
+        HASH h;
+        h.add(&prefix, 1);
+        h.add(p, n);
+        h.final(&level[index*DS]);
+    };
+
+    std::vector<std::thread> workers;
+    MemoryReader *m= dynamic_cast<MemoryReader*>(&r);
+    if (m) {
+        std::atomic<uint64_t> next(0);
+        for (unsigned i=0 ; i<nthreads ; i++)
+            workers.emplace_back([&]() {
+                uint64_t index;
+                while ((index= next++) < nchunks) {
+                    uint64_t ofs= index*chunksize;
+                    hashleaf(index, m->memory()+ofs, std::min(uint64_t(chunksize), res.bytes-ofs));
+                }
+            });
+        for (auto i= workers.begin() ; i!=workers.end() ; ++i)
+            i->join();
+    }
+    else {
+        hashbufferqueue q(2*nthreads);
+        for (unsigned i=0 ; i<nthreads ; i++)
+            workers.emplace_back([&]() {
+                hashbufferqueue::item it;
+                while (q.getfull(it)) {
+                    hashleaf(it.index, &it.data[0], it.data.size());
+                    q.putfree(it.data);
+                }
+            });
+        const char *error= NULL;
+        try {
+            hash_readblocks(r, q, chunksize);
+        }
+        catch(const char *msg) {
+            error= msg;
+        }
+        catch(...) {
+            error= "treehash_readwriter: read error";
+        }
+        q.finish();
+        for (auto i= workers.begin() ; i!=workers.end() ; ++i)
+            i->join();
+        if (error)
+            throw error;
+    }
+
+    // combine the levels, in place
+    const uint8_t prefix= 1;
+    for (uint64_t n= nchunks ; n>1 ; n= (n+1)/2) {
+        for (uint64_t i=0 ; i<n/2 ; i++) {
+            HASH h;
+            h.add(&prefix, 1);
+            h.add(&level[2*i*DS], 2*DS);
+            h.final(&level[i*DS]);
+        }
+        if (n&1)
+            memmove(&level[(n/2)*DS], &level[(n-1)*DS], DS);
+    }
+    std::copy(level.begin(), level.begin()+DS, res.digest.begin());
+    res.seconds= t.elapsed()/1e6;
+    return res;
+}
+#endif
@@ -6,6 +6,7 @@
 
 #include <util/wintypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
 #include <vector>
 //#include "vectorutils.h"
@@ -105,6 +106,17 @@ inline unsigned unitsperline_from_flags(uint32_t flags) { return static_cast<uns
 void writedumpline(int64_t llOffset, const std::string& line);
 void bighexdump(int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)|HEXDUMP_WITH_OFFSET|HEXDUMP_SUMMARIZE);
 
+// bighexdump renders into a large buffer, which is passed to a hexdumpsink in big chunks.
+// the plain bighexdump writes to the debug() outputs.
+class hexdumpsink {
+public:
+    virtual ~hexdumpsink() { }
+    virtual void write(const char *p, size_t n)=0;
+};
+void bighexdump(hexdumpsink& out, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)|HEXDUMP_WITH_OFFSET|HEXDUMP_SUMMARIZE);
+void bighexdump(FILE *f, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)|HEXDUMP_WITH_OFFSET|HEXDUMP_SUMMARIZE);
+void bighexdumpfd(int fd, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)|HEXDUMP_WITH_OFFSET|HEXDUMP_SUMMARIZE);
+
 template<typename T, typename A>
 inline void bighexdump(int64_t llOffset, const std::vector<T, A>& data, uint32_t flags=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)|HEXDUMP_WITH_OFFSET|HEXDUMP_SUMMARIZE)
 {
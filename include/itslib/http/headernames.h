@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include "stringutils.h"
+
+// the well known http header names, interned as an enum.
+// HttpHeaders tags each entry with its id, so lookups by id need no string compares.
+enum httpheader {
+    HDR_OTHER,          // not one of the names below
+    HDR_ACCEPT, HDR_ACCEPT_CHARSET, HDR_ACCEPT_ENCODING, HDR_ACCEPT_LANGUAGE, HDR_ACCEPT_RANGES,
+    HDR_AGE, HDR_ALLOW, HDR_AUTHORIZATION, HDR_CACHE_CONTROL, HDR_CONNECTION,
+    HDR_CONTENT_DISPOSITION, HDR_CONTENT_ENCODING, HDR_CONTENT_LANGUAGE, HDR_CONTENT_LENGTH,
+    HDR_CONTENT_LOCATION, HDR_CONTENT_RANGE, HDR_CONTENT_TYPE, HDR_COOKIE, HDR_DATE, HDR_ETAG,
+    HDR_EXPECT, HDR_EXPIRES, HDR_FORWARDED, HDR_FROM, HDR_HOST, HDR_IF_MATCH, HDR_IF_MODIFIED_SINCE,
+    HDR_IF_NONE_MATCH, HDR_IF_RANGE, HDR_IF_UNMODIFIED_SINCE, HDR_KEEP_ALIVE, HDR_LAST_MODIFIED,
+    HDR_LOCATION, HDR_ORIGIN, HDR_PRAGMA, HDR_PROXY_AUTHENTICATE, HDR_PROXY_AUTHORIZATION,
+    HDR_PROXY_CONNECTION, HDR_RANGE, HDR_REFERER, HDR_RETRY_AFTER, HDR_SERVER, HDR_SET_COOKIE,
+    HDR_TE, HDR_TRAILER, HDR_TRANSFER_ENCODING, HDR_UPGRADE, HDR_USER_AGENT, HDR_VARY, HDR_VIA,
+    HDR_WWW_AUTHENTICATE, HDR_X_FORWARDED_FOR, HDR_X_FORWARDED_HOST, HDR_X_FORWARDED_PROTO,
+    HDR_X_REAL_IP,
+    HDR_COUNT
+};
+
+struct httpheadernames {
+    struct table {
+        const char *name[HDR_COUNT];
+        uint32_t hash[HDR_COUNT];
+        uint8_t slots[256];     // open addressing on the hash, 0 is empty
+
+        table()
+            : name{ "",
+                "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Accept-Ranges",
+                "Age", "Allow", "Authorization", "Cache-Control", "Connection",
+                "Content-Disposition", "Content-Encoding", "Content-Language", "Content-Length",
+                "Content-Location", "Content-Range", "Content-Type", "Cookie", "Date", "ETag",
+                "Expect", "Expires", "Forwarded", "From", "Host", "If-Match", "If-Modified-Since",
+                "If-None-Match", "If-Range", "If-Unmodified-Since", "Keep-Alive", "Last-Modified",
+                "Location", "Origin", "Pragma", "Proxy-Authenticate", "Proxy-Authorization",
+                "Proxy-Connection", "Range", "Referer", "Retry-After", "Server", "Set-Cookie",
+                "TE", "Trailer", "Transfer-Encoding", "Upgrade", "User-Agent", "Vary", "Via",
+                "WWW-Authenticate", "X-Forwarded-For", "X-Forwarded-Host", "X-Forwarded-Proto",
+                "X-Real-IP" }
+        {
+            memset(slots, 0, sizeof(slots));
+            hash[HDR_OTHER]= 0;
+            for (int id=1 ; id<HDR_COUNT ; id++) {
+                hash[id]= stringihash(name[id], strlen(name[id]));
+                size_t i= hash[id] & 255;
+                while (slots[i])
+                    i= (i+1) & 255;
+                slots[i]= id;
+            }
+        }
+    };
+    static const table& names()
+    {
+        static const table t;
+        return t;
+    }
+
+    // the canonical spelling
+    static const char *name(httpheader id) { return names().name[id]; }
+    // the stringihash of the name
+    static uint32_t hash(httpheader id) { return names().hash[id]; }
+
+    // the id for a name with stringihash 'hash', or HDR_OTHER
+    static httpheader lookup(std::string_view key, uint32_t hash)
+    {
+        const table& t= names();
+        for (size_t i= hash & 255 ; t.slots[i] ; i= (i+1) & 255) {
+            int id= t.slots[i];
+            if (t.hash[id]==hash && stringiequal(t.name[id], strlen(t.name[id]), key.data(), key.size()))
+                return httpheader(id);
+        }
+        return HDR_OTHER;
+    }
+    static httpheader lookup(std::string_view key)
+    {
+        return lookup(key, stringihash(key.data(), key.size()));
+    }
+};
@@ -1,8 +1,12 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include "stringutils.h"
+#include "http/keyindex.h"
+#include "http/headernames.h"
 
 class HttpHeaders {
     // behaves similar to HttpQuery, except the parsing/encoding is different.
@@ -33,7 +37,7 @@ public:
             i++;
         while (i!=dirty.end())
         {
-            char c= *i;
+            char c= *i++;
             if (is_lws(c)) {
                 if (!wrotespace) {
                     clean += ' ';
@@ -54,6 +58,11 @@ public:
     static std::string lineencode(const std::string& str)
     {
         std::string enc; enc.reserve(str.size()*4/3);
+        appendlineencoded(enc, str);
+        return enc;
+    }
+    static void appendlineencoded(std::string& enc, std::string_view str)
+    {
         bool seencr= false;
         for (auto i= str.begin() ; i!=str.end() ; ++i)
         {
@@ -74,91 +83,250 @@ public:
                 seencr= false;
             }
         }
-        return enc;
     }
+
+    // a key for lookups: a name, a stringikey, or a well known header id
+    struct headerkey {
+        std::string_view name;
+        uint32_t hash;
+        httpheader id;      // HDR_OTHER when looking up by name
+
+        headerkey(const std::string& key)
+            : name(key), hash(stringihash(key)), id(HDR_OTHER)
+        {
+        }
+        headerkey(const char *key)
+            : name(key), hash(stringihash(name.data(), name.size())), id(HDR_OTHER)
+        {
+        }
+        headerkey(const stringikey& key)
+            : name(key.key), hash(key.hash), id(HDR_OTHER)
+        {
+        }
+        headerkey(httpheader id)
+            : name(httpheadernames::name(id)), hash(httpheadernames::hash(id)), id(id)
+        {
+        }
+    };
 private:
-    sslist _l;
+    // keys and values are stored in _arena. removed entries are only unlinked from
+    // the index, they are dropped together with their arena space when more than
+    // half of the entries were removed.
+    struct entry {
+        uint32_t key, keylen;
+        uint32_t val, vallen;
+        httpheader id;
+        bool removed;
+    };
+    std::vector<entry> _entries;
+    size_t _removed;
+    std::string _arena;
+    size_t _garbage;    // arena bytes of removed entries
+    ikeyindex _ix;      // positions in _entries by stringihash of the key
+
+    std::string_view view(uint32_t ofs, uint32_t len) const
+    {
+        return std::string_view(_arena.data()+ofs, len);
+    }
+    bool matches(const entry& e, const headerkey& key) const
+    {
+        if (key.id!=HDR_OTHER)
+            return e.id==key.id;
+        return e.keylen==key.name.size() && stringiequal(_arena.data()+e.key, e.keylen, key.name.data(), key.name.size());
+    }
+    // calls f(const entry&) for each value of key, stops when f returns false
+    template<typename F>
+    void foreach(const headerkey& key, F f) const
+    {
+        for (size_t i= _ix.find(key.hash) ; i!=ikeyindex::npos ; i= _ix.next(i))
+            if (matches(_entries[i], key) && !f(_entries[i]))
+                return;
+    }
+    uint32_t store(std::string_view str)
+    {
+        uint32_t ofs= uint32_t(_arena.size());
+        _arena.append(str.data(), str.size());
+        return ofs;
+    }
+    void append(std::string_view key, uint32_t hash, httpheader id, std::string_view val)
+    {
+        if (_arena.capacity()<_arena.size()+key.size()+val.size())
+            _arena.reserve(std::max(2*_arena.capacity(), _arena.size()+key.size()+val.size()+256));
+        entry e;
+        e.key= store(key);  e.keylen= uint32_t(key.size());
+        e.val= store(val);  e.vallen= uint32_t(val.size());
+        e.id= id;
+        e.removed= false;
+        _entries.push_back(e);
+        _ix.add(hash);
+    }
+    void append(const headerkey& key, std::string_view val)
+    {
+        append(key.name, key.hash, key.id!=HDR_OTHER ? key.id : httpheadernames::lookup(key.name, key.hash), val);
+    }
+    bool inarena(std::string_view str) const
+    {
+        std::less<const char*> lt;
+        return !str.empty() && !lt(str.data(), _arena.data()) && lt(str.data(), _arena.data()+_arena.size());
+    }
+    // remove and append can move the arena, so when key or val is a view of these
+    // headers, as in set("X", getview("Y")), they are copied first.
+    void update(const headerkey& key, std::string_view val, bool replace)
+    {
+        if (inarena(key.name) || inarena(val)) {
+            std::string keycopy(key.name), valcopy(val);
+            headerkey k(key);
+            k.name= keycopy;
+            update(k, valcopy, replace);
+            return;
+        }
+        if (replace)
+            remove(key);
+        append(key, val);
+    }
+    // removes all values of key
+    void remove(const headerkey& key)
+    {
+        _ix.unlink(key.hash, [this, &key](size_t i) {
+            entry& e= _entries[i];
+            if (!matches(e, key))
+                return false;
+            e.removed= true;
+            _removed++;
+            _garbage += e.keylen+e.vallen;
+            return true;
+        });
+        if (_removed>8 && 2*_removed>_entries.size())
+            compact();
+    }
+    // drops the removed entries, and their space in the arena
+    void compact()
+    {
+        _ix.removeif([this](size_t i, uint32_t) { return _entries[i].removed; });
+
+        std::string arena;
+        arena.reserve(2*(_arena.size()-_garbage));
+        size_t n= 0;
+        for (size_t i=0 ; i<_entries.size() ; i++) {
+            entry e= _entries[i];
+            if (e.removed)
+                continue;
+            uint32_t key= uint32_t(arena.size());
+            arena.append(_arena, e.key, e.keylen);
+            uint32_t val= uint32_t(arena.size());
+            arena.append(_arena, e.val, e.vallen);
+            e.key= key;
+            e.val= val;
+            _entries[n++]= e;
+        }
+        _entries.resize(n);
+        _arena.swap(arena);
+        _removed= 0;
+        _garbage= 0;
+    }
 public:
     HttpHeaders()
+        : _removed(0), _garbage(0)
     {
     }
     // initialize from a list of kv pairs
-    HttpHeaders(sslist &&L)
-        : _l(std::move(L))
-    {
-    }
     HttpHeaders(const sslist &L)
-        : _l(L)
+        : _removed(0), _garbage(0)
     {
+        _entries.reserve(L.size());
+        for (auto i= L.begin() ; i!=L.end() ; ++i)
+            add(i->key, i->val);
     }
 
+    // lookups take a std::string, a stringikey, which saves hashing the key each time,
+    // or a httpheader id, which also saves the string compares.
+
     // get combined comma separated value
     // note: does not work with Set-Cookie
-    std::string get(const std::string& key)
+    std::string get(const headerkey& key) const
     {
         std::string val;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-            if (stringicompare(i->key,key)==0) {
-                if (!val.empty())
-                    val += ',';
-                val += i->val;
-            }
-        }
+        foreach(key, [this, &val](const entry& e) {
+            if (!val.empty())
+                val += ',';
+            val.append(_arena, e.val, e.vallen);
+            return true;
+        });
         return val;
     }
 
     // return nr of values for key
-    size_t multiplicity(const std::string& key)
+    size_t multiplicity(const headerkey& key) const
     {
         size_t n=0;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-             if (stringicompare(i->key,key)==0)
-                 n++;
-        }
+        foreach(key, [&n](const entry&) { n++; return true; });
         return n;
     }
     // get single value
-    std::string get(const std::string& key, size_t n)
+    std::string get(const headerkey& key, size_t n) const
     {
-        std::string val;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-             if (stringicompare(i->key,key)==0) {
-                 if (n==0)
-                     return i->val;
-                 n--;
-             }
-        }
-        return std::string();
+        return std::string(getview(key, n));
+    }
+    // get single value, without copying.
+    // the view is valid until the headers are modified.
+    std::string_view getview(const headerkey& key, size_t n= 0) const
+    {
+        std::string_view val;
+        foreach(key, [this, &val, &n](const entry& e) {
+            if (n==0) {
+                val= view(e.val, e.vallen);
+                return false;
+            }
+            n--;
+            return true;
+        });
+        return val;
     }
     // adds value ( if key already exists, adds, does not replace )
-    void add(const std::string& key, const std::string& val)
+    void add(const headerkey& key, std::string_view val)
     {
-        _l.push_back(keyval(key, val));
+        update(key, val, false);
     }
 
     // sets value ( if key already exists, replaces )
-    void set(const std::string& key, const std::string& val)
+    void set(const headerkey& key, std::string_view val)
     {
-        auto newend= std::remove_if(_l.begin(), _l.end(), [&key](const keyval& kv) {
-            return stringicompare(kv.key, key)==0;
-        });
-        _l.erase(newend, _l.end());
-        _l.push_back(keyval(key, val));
+        update(key, val, true);
+    }
+    // removes all values of key
+    void erase(const headerkey& key)
+    {
+        remove(key);
+    }
+
+    // the nr of header lines
+    size_t size() const { return _entries.size()-_removed; }
+
+    // calls f(httpheader id, std::string_view key, std::string_view val) for each
+    // header line, in the order they were added.
+    template<typename F>
+    void forall(F f) const
+    {
+        for (auto& e : _entries)
+            if (!e.removed)
+                f(e.id, view(e.key, e.keylen), view(e.val, e.vallen));
     }
 
     // todo: implement an 'header streamer' which 
     std::string asstring() const
     {
         std::string s;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i)
+        s.reserve(_arena.size()-_garbage+_entries.size()*4);
+        for (auto& e : _entries)
         {
-            s += i->key;
+            if (e.removed)
+                continue;
+            s.append(_arena, e.key, e.keylen);
             s += ": ";
-            s += lineencode(i->val);
+            appendlineencoded(s, view(e.val, e.vallen));
             s += "\r\n";
         }
         return s;
     }
 };
 
-
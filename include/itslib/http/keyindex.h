@@ -0,0 +1,153 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+// an index from key hashes to positions in a list, used by HttpHeaders and HttpQuery.
+//
+// positions with the same hash are chained in the order they were added, so
+// duplicate keys are found in list order. different keys can have the same hash,
+// so the caller still compares the keys:
+//
+//   for (size_t i= ix.find(hash) ; i!=ix.npos ; i= ix.next(i))
+//       if (stringiequal(list[i].key, key)) ...
+//
+// positions are appended with add, and removed with removeif, which moves the
+// remaining positions down in the same way as std::remove_if does with the list,
+// or with unlink, which leaves the other positions alone.
+class ikeyindex {
+    struct slot {
+        uint32_t hash;
+        uint32_t first;     // position+1 of the first entry, 0 when all were unlinked
+        uint32_t last;      // position+1 of the last entry, 0 for an empty slot
+    };
+    std::vector<slot> _slots;       // open addressing, the size is a power of 2
+    size_t _mask;                   // _slots.size()-1
+    size_t _used;
+    // per position
+    std::vector<uint32_t> _hashes;
+    std::vector<uint32_t> _next;    // position+1 of the next entry with the same hash, or 0
+
+    size_t probe(uint32_t hash) const
+    {
+        size_t i= hash & _mask;
+        while (_slots[i].last && _slots[i].hash!=hash)
+            i= (i+1) & _mask;
+        return i;
+    }
+    void grow()
+    {
+        std::vector<slot> old;
+        old.swap(_slots);
+        _slots.resize(old.empty() ? 16 : 2*old.size(), slot{0,0,0});
+        _mask= _slots.size()-1;
+        for (auto& s : old)
+            if (s.last)
+                _slots[probe(s.hash)]= s;
+    }
+    // adds position 'pos' to the chain for its hash
+    void link(size_t pos)
+    {
+        if (2*(_used+1) > _slots.size())
+            grow();
+        uint32_t hash= _hashes[pos];
+        uint32_t pos1= uint32_t(pos+1);
+        _next[pos]= 0;
+
+        slot& s= _slots[probe(hash)];
+        if (s.first) {
+            _next[s.last-1]= pos1;
+            s.last= pos1;
+        }
+        else {
+            if (!s.last)
+                _used++;
+            s.hash= hash;
+            s.first= s.last= pos1;
+        }
+    }
+    void emptyslots()
+    {
+        std::fill(_slots.begin(), _slots.end(), slot{0,0,0});
+        _used= 0;
+    }
+public:
+    static const size_t npos= ~size_t(0);
+
+    ikeyindex()
+        : _mask(0), _used(0)
+    {
+    }
+    // the nr of positions in the index
+    size_t size() const { return _hashes.size(); }
+
+    // removes all positions, keeps the allocated table
+    void clear()
+    {
+        _hashes.clear();
+        _next.clear();
+        emptyslots();
+    }
+    // adds position size() with 'hash'
+    void add(uint32_t hash)
+    {
+        _hashes.push_back(hash);
+        _next.push_back(0);
+        link(_hashes.size()-1);
+    }
+    // removes the positions for which f(pos, hash) returns true
+    template<typename F>
+    void removeif(F f)
+    {
+        emptyslots();
+        size_t n= 0;
+        for (size_t i=0 ; i<_hashes.size() ; i++)
+            if (!f(i, _hashes[i])) {
+                _hashes[n]= _hashes[i];
+                link(n++);
+            }
+        _hashes.resize(n);
+        _next.resize(n);
+    }
+    // removes the positions with 'hash' for which f(pos) returns true, without
+    // renumbering the other positions. size() does not change.
+    template<typename F>
+    void unlink(uint32_t hash, F f)
+    {
+        if (_slots.empty())
+            return;
+        slot& s= _slots[probe(hash)];
+        if (!s.last)
+            return;
+        uint32_t prev= 0;
+        for (uint32_t pos1= s.first ; pos1 ; pos1= _next[pos1-1]) {
+            if (!f(size_t(pos1-1))) {
+                prev= pos1;
+                continue;
+            }
+            if (prev)
+                _next[prev-1]= _next[pos1-1];
+            else
+                s.first= _next[pos1-1];
+            if (s.last==pos1)
+                s.last= prev;
+        }
+        // the slot stays in use, so the probe sequences of other hashes are not broken
+        if (!s.first && s.last==0)
+            s.last= ~0U;
+    }
+    // the first position with 'hash', or npos
+    size_t find(uint32_t hash) const
+    {
+        if (_slots.empty())
+            return npos;
+        const slot& s= _slots[probe(hash)];
+        return s.first ? s.first-1 : npos;
+    }
+    // the next position with the same hash as 'pos', or npos
+    size_t next(size_t pos) const
+    {
+        return _next[pos] ? _next[pos]-1 : npos;
+    }
+};
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include "http/utils.h"
 #include "stringutils.h"
+#include "http/keyindex.h"
 class HttpQuery {
 public:
     struct keyval {
@@ -27,11 +28,80 @@ private:
 
     enum { USE_L, USE_Q } _authority;
 
+    // positions in _l by stringihash of the key, built on demand.
+    // _l is only appended to, or cleared together with the index.
+    ikeyindex _ix;
+
     void need_l()
     {
         if (_authority==USE_Q && _l.empty())
             parse_query();
     }
+    void need_ix()
+    {
+        need_l();
+        for (size_t i= _ix.size() ; i<_l.size() ; i++)
+            _ix.add(stringihash(_l[i].key));
+    }
+    // calls f(const keyval&) for each value of key, stops when f returns false
+    template<typename F>
+    void foreach(const std::string& key, uint32_t hash, F f)
+    {
+        need_ix();
+        for (size_t i= _ix.find(hash) ; i!=ikeyindex::npos ; i= _ix.next(i))
+            if (stringiequal(_l[i].key, key) && !f(_l[i]))
+                return;
+    }
+    std::string getjoined(const std::string& key, uint32_t hash)
+    {
+        std::string val;
+        foreach(key, hash, [&val](const keyval& kv) {
+            if (!val.empty())
+                val += ',';
+            val += kv.val;
+            return true;
+        });
+        return val;
+    }
+    size_t count(const std::string& key, uint32_t hash)
+    {
+        size_t n=0;
+        foreach(key, hash, [&n](const keyval&) { n++; return true; });
+        return n;
+    }
+    std::string getnth(const std::string& key, uint32_t hash, size_t n)
+    {
+        std::string val;
+        foreach(key, hash, [&val, &n](const keyval& kv) {
+            if (n==0) {
+                val= kv.val;
+                return false;
+            }
+            n--;
+            return true;
+        });
+        return val;
+    }
+    void replace(const std::string& key, uint32_t hash, const std::string& val)
+    {
+        need_ix();
+        _authority=USE_L;
+        if (_ix.find(hash)!=ikeyindex::npos) {
+            // removes from _l and the index in one pass
+            size_t n= 0;
+            _ix.removeif([this, hash, &key, &n](size_t i, uint32_t h) {
+                if (h==hash && stringiequal(_l[i].key, key))
+                    return true;
+                if (n!=i)
+                    _l[n]= std::move(_l[i]);
+                n++;
+                return false;
+            });
+            _l.erase(_l.begin()+n, _l.end());
+        }
+        _l.push_back(keyval(key, val));
+        _q.clear();
+    }
     void need_q() const
     {
         if (_authority==USE_L && _q.empty())
@@ -104,46 +174,20 @@ public:
     {
     }
 
+    // the lookups below also take a stringikey, which saves hashing the key each time.
+
     // get combined comma separated value
-    std::string get(const std::string& key)
-    {
-        need_l();
-        std::string val;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-            if (stringicompare(i->key,key)==0) {
-                if (!val.empty())
-                    val += ',';
-                val += i->val;
-            }
-        }
-        return val;
-    }
+    std::string get(const std::string& key) { return getjoined(key, stringihash(key)); }
+    std::string get(const stringikey& key) { return getjoined(key.key, key.hash); }
 
     // return nr of values for key
-    size_t multiplicity(const std::string& key)
-    {
-        need_l();
-        size_t n=0;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-             if (stringicompare(i->key,key)==0)
-                 n++;
-        }
-        return n;
-    }
+    size_t multiplicity(const std::string& key) { return count(key, stringihash(key)); }
+    size_t multiplicity(const stringikey& key) { return count(key.key, key.hash); }
+
     // get single value
-    std::string get(const std::string& key, size_t n)
-    {
-        need_l();
-        std::string val;
-        for (auto i= _l.begin() ; i!=_l.end() ; ++i) {
-             if (stringicompare(i->key,key)==0) {
-                 if (n==0)
-                     return i->val;
-                 n--;
-             }
-        }
-        return std::string();
-    }
+    std::string get(const std::string& key, size_t n) { return getnth(key, stringihash(key), n); }
+    std::string get(const stringikey& key, size_t n) { return getnth(key.key, key.hash, n); }
+
     // adds value ( if key already exists, adds, does not replace )
     void add(const std::string& key, const std::string& val)
     {
@@ -155,6 +199,7 @@ public:
             _q += httpparser::pctencode(val);
 
             _l.clear();
+            _ix.clear();
         }
         else {  // USE_L
             _l.push_back(keyval(key, val));
@@ -170,6 +215,7 @@ public:
             _q += httpparser::pctencode(val);
 
             _l.clear();
+            _ix.clear();
         }
         else {  // USE_L
             _l.push_back(keyval(val));
@@ -178,17 +224,8 @@ public:
     }
 
     // sets value ( if key already exists, replaces )
-    void set(const std::string& key, const std::string& val)
-    {
-        need_l();
-        _authority=USE_L;
-        auto newend= std::remove_if(_l.begin(), _l.end(), [&key](const keyval& kv)->bool {
-            return stringicompare(kv.key, key)==0;
-        });
-        _l.erase(newend, _l.end());
-        _l.push_back(keyval(key, val));
-        _q.clear();
-    }
+    void set(const std::string& key, const std::string& val) { replace(key, stringihash(key), val); }
+    void set(const stringikey& key, const std::string& val) { replace(key.key, key.hash, val); }
 
     // return encoded as querystring 
     std::string querystring() const
@@ -201,6 +238,7 @@ public:
         _q= str;
         _authority= USE_Q;
         _l.clear();
+        _ix.clear();
     }
 };
 
@@ -0,0 +1,370 @@
+#ifndef _SOCK_EPOLLLOOP_H_
+#define _SOCK_EPOLLLOOP_H_
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "util/logmsg.h"
+#include "util/process.h"
+#include "util/timerwheel.h"
+#include "sockets/socketstate.h"
+#include "sockets/signalstate.h"
+
+// epollloop is a linux only replacement for selectloop, with the same interface.
+//
+// instead of rebuilding fd_sets from all sockets on every pass, each socket is
+// registered edge-triggered with epoll once, and only re-evaluated when:
+//   - it got an event,
+//   - it reported a change via socketstate::changed(), like a write from another thread.
+// there is no limit on the fd value, and no polling sleep.
+//
+// timeouts are kept in a timerwheel: each socket has one timer, set to the earliest of
+// its connect, session and idle deadlines. when it fires the socket is checked with
+// candelete(), and either removed or the timer is moved to the new deadline.
+// epoll_wait sleeps until the next deadline, but no longer than pollinterval, so
+// changes of the wallclock are picked up.
+//
+// after servicing a socket its registration is always re-armed with EPOLL_CTL_MOD,
+// this makes the kernel post a new event when the socket is still readable or writable,
+// so socketstates which do not drain the socket in one call keep working.
+class epollloop : public process {
+    struct entry {
+        socket_ptr s;
+        int fd;             // fd currently registered with epoll, or -1
+        uint32_t events;    // currently registered event mask
+        timerwheel::timer deadline;
+    };
+    typedef std::unordered_map<socketstate*, entry> entrymap;
+
+    std::mutex _listmtx;        // protects _entries, _fdowner, _fdwaiting, _timers, _expired
+    entrymap _entries;
+    timerwheel _timers;
+    std::vector<socketstate*> _expired;     // collected during _timers.advance
+    std::unordered_map<int, socketstate*> _fdowner;
+    std::vector<socketstate*> _fdwaiting;   // waiting for another socketstate to release the fd
+
+    std::mutex _pendmtx;        // protects _added, _dirty, _notified
+    std::vector<socket_ptr> _added;
+    std::vector<socket_ptr> _dirty;
+    bool _notified;
+
+    std::shared_ptr<signalstate> _signal;
+    std::thread::id _loopthread;
+    std::atomic<int> _count;
+
+    int _epfd;
+    int _pollinterval;
+    int _verbose;
+    bool _error;
+public:
+    epollloop()
+        : _timers(nowms()), _notified(false), _signal(new signalstate()), _count(0), _epfd(-1), _pollinterval(1), _verbose(0), _error(false)
+    {
+        _epfd= epoll_create1(EPOLL_CLOEXEC);
+        if (_epfd==-1)
+            throw socketerror("epoll_create");
+        add(_signal);
+        start();
+    }
+    virtual ~epollloop()
+    {
+        stop();
+
+        std::unique_lock<std::mutex> lock(_listmtx);
+        for (auto i= _entries.begin() ; i!=_entries.end() ; ++i)
+            i->second.s->onchange(nullptr);
+        ::close(_epfd);
+    }
+    virtual void processstop()
+    {
+        _signal->notify();
+    }
+    virtual void handle_error()
+    {
+        logerror("%s EXCEPTION in epollloop\n", logstamp().c_str());
+        _error= true;
+    }
+    bool haveerror() const { return _error; }
+    virtual const char*name() { return "epollloop"; }
+    virtual void at_service_start()
+    {
+        _loopthread= std::this_thread::get_id();
+    }
+    virtual void service()
+    {
+        applypending();
+
+        epoll_event ev[256];
+        int n= epoll_wait(_epfd, ev, 256, waittime());
+        if (n<0) {
+            if (errno==EINTR)
+                return;
+            _error= true;
+            throw socketerror("epoll_wait");
+        }
+        if (_verbose > 1)
+            loginfo("epoll_wait->%d\n", n);
+
+        if (isterminating())
+            return;
+
+        std::unique_lock<std::mutex> lock(_listmtx);
+        for (int i=0 ; i<n ; i++) {
+            auto e= _entries.find(static_cast<socketstate*>(ev[i].data.ptr));
+            // removed earlier in this batch
+            if (e==_entries.end())
+                continue;
+            dispatch(e->second, ev[i].events);
+        }
+
+        expiretimers();
+    }
+    static uint64_t nowms() { return HiresTimer::stamp()/1000; }
+
+    // msec until the next deadline, capped at pollinterval
+    int waittime()
+    {
+        int64_t maxwait= int64_t(_pollinterval)*1000;
+        std::unique_lock<std::mutex> lock(_listmtx);
+        uint64_t next= _timers.nextexpiry();
+        if (next==timerwheel::NEVER)
+            return maxwait;
+        uint64_t now= nowms();
+        if (next<=now)
+            return 0;
+        return std::min(int64_t(next-now), maxwait);
+    }
+    // set the socket's timer to the earliest of its deadlines
+    void armtimer(entry& e)
+    {
+        uint64_t deadline= 0;
+        uint64_t d[3]= { e.s->connectdeadline(), e.s->sessiondeadline(), e.s->idledeadline() };
+        for (int i=0 ; i<3 ; i++)
+            if (d[i] && (deadline==0 || d[i]<deadline))
+                deadline= d[i];
+        if (deadline==0)
+            e.deadline.cancel();
+        else if (!e.deadline.pending() || e.deadline.expiry()!=deadline)
+            _timers.schedule(e.deadline, deadline);
+    }
+    // called from _timers.advance. the socket is handled after advance returns, since
+    // removing it destroys the timer whose callback is running.
+    void expired(socketstate *s)
+    {
+        _expired.push_back(s);
+    }
+    void expiretimers()
+    {
+        _timers.advance(nowms());
+
+        std::vector<socketstate*> expired;
+        expired.swap(_expired);
+        for (auto i= expired.begin() ; i!=expired.end() ; ++i) {
+            // may have been removed by an earlier one in this batch
+            auto e= _entries.find(*i);
+            if (e==_entries.end())
+                continue;
+            socket_ptr s= e->second.s;
+            if (s->candelete())
+                remove(s.get());
+            else
+                update(s.get(), false);
+        }
+    }
+    void dispatch(entry& e, uint32_t events)
+    {
+        socket_ptr s= e.s;
+        try {
+            if ((events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR)) && s->needs(NEED_RD))
+                s->mayread();
+            if ((events & (EPOLLOUT|EPOLLHUP|EPOLLERR)) && s->needs(NEED_WR))
+                s->maywrite();
+        }
+        catch(...)
+        {
+            s->fail();
+        }
+
+        if (s->candelete())
+            remove(s.get());
+        else
+            update(s.get(), true);
+    }
+
+    // compute the epoll mask from the socket's current needs
+    static uint32_t eventmask(socketstate *s)
+    {
+        uint32_t events= EPOLLET;
+        if (s->needs(NEED_RD))
+            events |= EPOLLIN|EPOLLRDHUP;
+        if (s->needs(NEED_WR))
+            events |= EPOLLOUT;
+        return events;
+    }
+
+    // (re)register the socket with epoll, 'rearm' forces a EPOLL_CTL_MOD
+    // even when the mask did not change.
+    void update(socketstate *s, bool rearm)
+    {
+        auto i= _entries.find(s);
+        if (i==_entries.end())
+            return;
+        entry& e= i->second;
+        armtimer(e);
+
+        int fd= s->fd();
+        if (e.fd!=-1 && e.fd!=fd)
+            unregister(e);
+        if (fd<0)
+            return;
+        if (e.fd==-1) {
+            // another socketstate may still be using this fd, like a tcpstate handing over to its 'next'
+            if (_fdowner.find(fd)!=_fdowner.end()) {
+                if (std::find(_fdwaiting.begin(), _fdwaiting.end(), s)==_fdwaiting.end())
+                    _fdwaiting.push_back(s);
+                return;
+            }
+            epoll_event ev;
+            ev.events= e.events= eventmask(s);
+            ev.data.ptr= s;
+            if (-1==epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev)) {
+                s->fail();
+                return;
+            }
+            e.fd= fd;
+            _fdowner[fd]= s;
+            return;
+        }
+        uint32_t events= eventmask(s);
+        if (!rearm && events==e.events)
+            return;
+        epoll_event ev;
+        ev.events= e.events= events;
+        ev.data.ptr= s;
+        if (-1==epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev))
+            s->fail();
+    }
+    void unregister(entry& e)
+    {
+        // note: the fd may already be closed, so errors are ignored
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, e.fd, NULL);
+        _fdowner.erase(e.fd);
+        e.fd= -1;
+    }
+    void remove(socketstate *s)
+    {
+        auto i= _entries.find(s);
+        if (i==_entries.end())
+            return;
+        int fd= i->second.fd;
+        if (fd!=-1)
+            unregister(i->second);
+        s->onchange(nullptr);
+        _entries.erase(i);
+        _fdwaiting.erase(std::remove(_fdwaiting.begin(), _fdwaiting.end(), s), _fdwaiting.end());
+        _count--;
+
+        // a socketstate sharing this fd can now take over
+        if (fd!=-1 && !_fdwaiting.empty()) {
+            std::vector<socketstate*> waiting;
+            waiting.swap(_fdwaiting);
+            for (auto j= waiting.begin() ; j!=waiting.end() ; ++j)
+                update(*j, false);
+        }
+    }
+
+    // process sockets added or changed from outside the loop
+    void applypending()
+    {
+        std::vector<socket_ptr> added;
+        std::vector<socket_ptr> dirty;
+        {
+            std::unique_lock<std::mutex> lock(_pendmtx);
+            added.swap(_added);
+            dirty.swap(_dirty);
+            _notified= false;
+        }
+
+        std::unique_lock<std::mutex> lock(_listmtx);
+        for (auto i= added.begin() ; i!=added.end() ; ++i) {
+            socketstate *s= i->get();
+            entry& e= _entries[s];
+            e.s= *i;
+            e.fd= -1;
+            e.events= 0;
+            e.deadline.callback([this, s]() { expired(s); });
+            s->onchange([this](socketstate *s) { changed(s); });
+            update(s, false);
+        }
+        for (auto i= dirty.begin() ; i!=dirty.end() ; ++i) {
+            socketstate *s= i->get();
+            if (s->candelete())
+                remove(s);
+            else
+                update(s, false);
+        }
+    }
+
+    // called via socketstate::changed(), from any thread
+    void changed(socketstate *s)
+    {
+        socket_ptr p= s->weak_from_this().lock();
+        if (!p)
+            return;
+        std::unique_lock<std::mutex> lock(_pendmtx);
+        _dirty.push_back(p);
+        wakeup(lock);
+    }
+    // must be called with _pendmtx held
+    void wakeup(std::unique_lock<std::mutex>& lock)
+    {
+        // the loop thread picks up _dirty before its next epoll_wait by itself
+        if (std::this_thread::get_id()==_loopthread)
+            return;
+        if (_notified)
+            return;
+        _notified= true;
+        lock.unlock();
+        _signal->notify();
+    }
+
+    void add(socket_ptr s)
+    {
+        std::unique_lock<std::mutex> lock(_pendmtx);
+        _added.push_back(s);
+        _count++;
+        wakeup(lock);
+    }
+    void bump()
+    {
+        _signal->notify();
+    }
+    size_t count() { return _count-1; }
+
+    void verbose(int n) { _verbose= n; }
+    void pollinterval(int n) { _pollinterval= n; bump(); }
+
+    void expiresessions(int sessiontimeout)
+    {
+        std::unique_lock<std::mutex> lock(_listmtx);
+        for (auto i= _entries.begin() ; i!=_entries.end() ; )
+        {
+            socket_ptr s= (i++)->second.s;
+            if (s==_signal)
+                continue;
+            if (s->isdisconnected() || s->session_time()/1000 > sessiontimeout) {
+                s->close();
+                ByteVector data;
+                s->readbuf(data);
+                if (data.size() || s->session_time())
+                    printf("\n%s %s read %d bytes\n%s\n", logstamp().c_str(), s->desc().c_str(), (int)data.size(), ascdump(data, "", true).c_str());
+
+                remove(s.get());
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef _SOCK_LOOPGROUP_H_
+#define _SOCK_LOOPGROUP_H_
+#include <vector>
+#include <memory>
+#include <thread>
+#include "sockets/epollloop.h"
+
+// loopgroup runs N eventloops, each in its own thread with its own signalstate,
+// and spreads the sockets over them.
+//
+// sockets are assigned either by hashing their fd, or to the loop with the
+// fewest sockets. socketstates which are chained with next() call each other
+// from their loop's thread, so they must be added to the same shard:
+//
+//   size_t ix= group.add(tcp);
+//   group.add(socks, ix);
+//
+template<typename LOOP=epollloop>
+class loopgroup {
+public:
+    enum policy_t { BY_FD, LEAST_LOADED };
+private:
+    std::vector<std::unique_ptr<LOOP> > _loops;
+    policy_t _policy;
+public:
+    // nloops==0 -> one loop per core
+    loopgroup(unsigned nloops=0, policy_t policy=LEAST_LOADED)
+        : _policy(policy)
+    {
+        if (nloops==0)
+            nloops= std::thread::hardware_concurrency();
+        if (nloops==0)
+            nloops= 1;
+        for (unsigned i=0 ; i<nloops ; i++)
+            _loops.emplace_back(new LOOP());
+    }
+
+    // returns the shard the socket was added to.
+    // this may be called from any thread.
+    size_t add(socket_ptr s)
+    {
+        size_t ix= shardfor(s);
+        _loops[ix]->add(s);
+        return ix;
+    }
+    size_t add(socket_ptr s, size_t ix)
+    {
+        _loops.at(ix)->add(s);
+        return ix;
+    }
+    size_t shardfor(socket_ptr s)
+    {
+        // sockets without fd yet ( like ssl or socks4 before start() ) are balanced by load
+        int fd= s->fd();
+        if (_policy==BY_FD && fd>=0)
+            return std::hash<int>()(fd) % _loops.size();
+        return leastloaded();
+    }
+    size_t leastloaded()
+    {
+        size_t best= 0;
+        size_t bestcount= _loops[0]->count();
+        for (size_t i=1 ; i<_loops.size() ; i++) {
+            size_t n= _loops[i]->count();
+            if (n<bestcount) {
+                best= i;
+                bestcount= n;
+            }
+        }
+        return best;
+    }
+
+    size_t size() const { return _loops.size(); }
+    LOOP& loop(size_t ix) { return *_loops.at(ix); }
+
+    size_t count()
+    {
+        size_t n= 0;
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            n += (*i)->count();
+        return n;
+    }
+    bool haveerror() const
+    {
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            if ((*i)->haveerror())
+                return true;
+        return false;
+    }
+    void bump()
+    {
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            (*i)->bump();
+    }
+    void verbose(int n)
+    {
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            (*i)->verbose(n);
+    }
+    void pollinterval(int n)
+    {
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            (*i)->pollinterval(n);
+    }
+    void expiresessions(int sessiontimeout)
+    {
+        for (auto i= _loops.begin() ; i!=_loops.end() ; ++i)
+            (*i)->expiresessions(sessiontimeout);
+    }
+};
+
+#endif
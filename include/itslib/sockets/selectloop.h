@@ -110,7 +110,7 @@ public:
             if (FD_ISSET(i, s)) {
                 if (!str.empty())
                     str+=",";
-                str += stringformat("%d", i);
+                appendformat(str, FMTSTR("%d"), i);
             }
         return str;
     }
@@ -23,16 +23,17 @@ public:
 
         ev_connected();
 
-        _desc += stringformat("signal %d:%s -> %d:%s\n", _a->fd(), _a->getsockname().c_str(), _c->fd(), _c->getsockname().c_str());
+        appendformat(_desc, FMTSTR("signal %d:%s -> %d:%s\n"), _a->fd(), _a->getsockname(), _c->fd(), _c->getsockname());
         logmsg("%s %s\n", logstamp().c_str(), _desc.c_str());
     }
 
+    // drains several pending notifications at once
     void ack()
     {
-        uint8_t c= 0x55;
-        _c->read(&c, 1);
+        uint8_t c[64];
+        _c->read(c, sizeof(c));
         if (_verbose > 1)
-            loginfo("%s acked: %02x\n", logstamp().c_str(), c);
+            loginfo("%s acked\n", logstamp().c_str());
     }
     void notify()
     {
@@ -83,16 +84,17 @@ public:
 
         ev_connected();
 
-        _desc += stringformat(" %d -> %d", _a->fd(), _c->fd());
+        appendformat(_desc, FMTSTR(" %d -> %d"), _a->fd(), _c->fd());
         logmsg("%s %s\n", logstamp().c_str(), _desc.c_str());
     }
 
+    // drains several pending notifications at once
     void ack()
     {
-        uint8_t c= 0x55;
-        _c->read(&c, 1);
+        uint8_t c[64];
+        _c->read(c, sizeof(c));
         if (_verbose > 1)
-            loginfo("%s acked: %02x\n", logstamp().c_str(), c);
+            loginfo("%s acked\n", logstamp().c_str());
     }
     void notify()
     {
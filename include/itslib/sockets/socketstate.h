@@ -3,10 +3,11 @@
 
 #include <list>
 #include <memory>
+#include <functional>
+#include <mutex>
 #include <cassert>
 #include "util/logmsg.h"
 #include "util/queuebuf.h"
-#include "util/ungetqueue.h"
 
 // once an object is 'connected' it deletes itself from the selectlist,
 // and hand control to it's 'next' item
@@ -31,31 +32,33 @@ STFORWARDDECLARE(socks4)
 class socketstate;
 typedef std::shared_ptr<socketstate> socket_ptr;
 
-typedef ungetqueue<uint8_t> UngetByteQueue;
-
-
 class socketstate : public std::enable_shared_from_this<socketstate> {
 protected:
     int _state;
     socket_ptr  _next;
     HiresTimer _tstart;
     HiresTimer _tsession;
+    HiresTimer _tactivity;
     uint64_t _duration_session;
     uint64_t _duration_connect;
     std::string _desc;
 
     ByteQueue _outq;
-    UngetByteQueue _outuq;
     ByteQueue _inq;
 
     int _verbose;
 
+    // in msec, 0 means no session or idle timeout
     int _connecttimeout;
     int _sessiontimeout;
+    int _idletimeout;
+
+    std::mutex _onchangemtx;    // protects _onchange, changed() is called from any thread
+    std::function<void(socketstate*)> _onchange;
 public:
 enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCEPTING };
     socketstate()
-        : _state(NEW), _duration_session(0), _duration_connect(0), _outq(4096, "outq"), _outuq(_outq), _inq(4096, "inq"), _verbose(0), _connecttimeout(5000), _sessiontimeout(5000)
+        : _state(NEW), _duration_session(0), _duration_connect(0), _outq(4096, "outq"), _inq(4096, "inq"), _verbose(0), _connecttimeout(5000), _sessiontimeout(0), _idletimeout(0)
     {
         _desc= "sock";
     }
@@ -92,12 +95,38 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
             logprogress("%s %s candelete -> next\n", logstamp().c_str(), _desc.c_str());
             return true;
         }
-//      if (_state==CONNECTED && session_time() > _sessiontimeout) {
-//          logprogress("%s %s candelete - session timeout\n", logstamp().c_str(), _desc.c_str());
-//          return true;
-//      }
+        if (_state==CONNECTED && _sessiontimeout && _tsession.msecelapsed() >= _sessiontimeout) {
+            logprogress("%s %s candelete - session timeout\n", logstamp().c_str(), _desc.c_str());
+            return true;
+        }
+        if (_state==CONNECTED && _idletimeout && _tactivity.msecelapsed() >= _idletimeout) {
+            logprogress("%s %s candelete - idle timeout\n", logstamp().c_str(), _desc.c_str());
+            return true;
+        }
         return false;
     }
+
+    // the msec stamps at which candelete() will start returning true because of
+    // a timeout, 0 when no timeout applies in the current state.
+    // used by epollloop to schedule its timers.
+    uint64_t connectdeadline() const
+    {
+        if (_state==CONNECTED)
+            return 0;
+        return _tstart.getstamp()/1000 + _connecttimeout;
+    }
+    uint64_t sessiondeadline() const
+    {
+        if (_state!=CONNECTED || _sessiontimeout==0)
+            return 0;
+        return _tsession.getstamp()/1000 + _sessiontimeout;
+    }
+    uint64_t idledeadline() const
+    {
+        if (_state!=CONNECTED || _idletimeout==0)
+            return 0;
+        return _tactivity.getstamp()/1000 + _idletimeout;
+    }
     std::string desc() const { return _desc; }
 
 
@@ -115,12 +144,30 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
     {
         _tstart.reset();
         _state= CONNECTING;
+        changed();
+    }
+
+    // an eventloop which only tracks changes ( like epollloop ) installs a handler here,
+    // so it gets told when needs() or fd() may have changed outside of mayread/maywrite.
+    // the handler is called with the lock held, so once onchange(nullptr) returns,
+    // no other thread is still calling the old handler.
+    void onchange(std::function<void(socketstate*)> cb)
+    {
+        std::unique_lock<std::mutex> lock(_onchangemtx);
+        _onchange.swap(cb);
+    }
+    void changed()
+    {
+        std::unique_lock<std::mutex> lock(_onchangemtx);
+        if (_onchange)
+            _onchange(this);
     }
 
 
     void fail()
     {
         _state= FAILED;
+        changed();
         if (_next)
             _next->fail();
     }
@@ -130,6 +177,7 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
         _state= CONNECTED;
         _duration_connect= _tstart.elapsed();
         _tsession.reset();
+        _tactivity.reset();
 
         if (_next)
             _next->start(shared_from_this());
@@ -144,14 +192,17 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
             throw "read:disconnected";
         size_t want= std::min(nreq, _inq.usedsize());
         _inq.read(p, want);
+        if (want)
+            changed();
         return want;
     }
     size_t write(const uint8_t *p, size_t nreq)
     {
         size_t want= std::min(nreq, _outq.freesize());
         _outq.write(p, want);
-        // todo: bump selectloop signal so we get added to the 'want-to-write list again
-        //printf("%s %s todo: bump for write\n", logstamp().c_str(), _desc.c_str());
+        // bump the eventloop so we get added to the 'want-to-write' list again
+        if (want)
+            changed();
         return want;
     }
 
@@ -164,6 +215,7 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
 
 
     // called to move data to/from socket <-> queue
+    // the data is read and written directly from/to the queue's buffer.
     void ev_sockread()
     {
         if (eof() || _inq.freesize()==0) {
@@ -173,15 +225,16 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
             return;
         }
 
-        ByteVector data(_inq.freesize());
-        size_t n= sockread(&data[0], data.size());
-        assert(n<=data.size());
+        ByteQueue::span v[2];
+        int nv= _inq.writespans(v);
+        size_t n= sockreadv(v, nv);
+        if (n)
+            _tactivity.reset();
 
-        data.resize(n);
         if (_verbose && n)
-            printf("%s %s read %d bytes:\n%s\n", logstamp().c_str(), _desc.c_str(), (int)n, ascdump(data, "", true).c_str());
+            printf("%s %s read %d bytes:\n%s\n", logstamp().c_str(), _desc.c_str(), (int)n, ascdump(spanbytes(v, nv, n), "", true).c_str());
 
-        _inq.write(&data[0], n);
+        _inq.commitwrite(n);
     }
     void ev_sockwrite()
     {
@@ -192,15 +245,15 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
             return;
         }
 
-        ByteVector data(_outuq.usedsize());
-        if (!data.empty()) {
-            _outuq.readbytes(&data[0], data.size());
-            size_t n= sockwrite(&data[0], data.size());
-            assert(n<=data.size());
+        ByteQueue::span v[2];
+        int nv= _outq.readspans(v);
+        if (nv) {
+            size_t n= sockwritev(v, nv);
+            if (n)
+                _tactivity.reset();
 
-            if (n<data.size())
-                _outuq.ungetbytes(&data[n], data.size()-n);
-            loginfo("%s %s wrote %d of %d bytes: %s\n", logstamp().c_str(), _desc.c_str(), (int)n, (int)data.size(), hexdump(&data[0], n).c_str());
+            loginfo("%s %s wrote %d of %d bytes: %s\n", logstamp().c_str(), _desc.c_str(), (int)n, (int)_outq.usedsize(), hexdump(spanbytes(v, nv, n)).c_str());
+            _outq.commitread(n);
         }
         else {
             //logmsg("%s %s nothing to write\n", logstamp().c_str(), _desc.c_str());
@@ -210,9 +263,48 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
     virtual size_t sockread(uint8_t *p, size_t nreq)= 0;
     virtual size_t sockwrite(const uint8_t *p, size_t nreq)= 0;
 
+    // scatter/gather versions, by default these call sockread/sockwrite for
+    // each span, tcpstate overrides them with readv/writev.
+    // returns the total nr of bytes transferred.
+    virtual size_t sockreadv(const ByteQueue::span *v, int nv)
+    {
+        size_t total= 0;
+        for (int i=0 ; i<nv ; i++) {
+            size_t n= sockread(v[i].ptr, v[i].size);
+            assert(n<=v[i].size);
+            total += n;
+            if (n<v[i].size)
+                break;
+        }
+        return total;
+    }
+    virtual size_t sockwritev(const ByteQueue::span *v, int nv)
+    {
+        size_t total= 0;
+        for (int i=0 ; i<nv ; i++) {
+            size_t n= sockwrite(v[i].ptr, v[i].size);
+            assert(n<=v[i].size);
+            total += n;
+            if (n<v[i].size)
+                break;
+        }
+        return total;
+    }
+    // copy the first 'n' bytes of the spans, for logging
+    static ByteVector spanbytes(const ByteQueue::span *v, int nv, size_t n)
+    {
+        ByteVector data;
+        for (int i=0 ; i<nv && data.size()<n ; i++) {
+            size_t want= std::min(v[i].size, n-data.size());
+            data.insert(data.end(), v[i].ptr, v[i].ptr+want);
+        }
+        return data;
+    }
+
     void verbose(int n) { _verbose= n; }
-    void connecttimeout(unsigned n) { _connecttimeout= n; }
-    void sessiontimeout(unsigned n) { _sessiontimeout= n; }
+    void connecttimeout(unsigned n) { _connecttimeout= n; changed(); }
+    void sessiontimeout(unsigned n) { _sessiontimeout= n; changed(); }
+    void idletimeout(unsigned n) { _idletimeout= n; changed(); }
 
     virtual void close()
     { 
@@ -220,6 +312,7 @@ enum state_t { NEW, CONNECTED, DISCONNECTED, FAILED, LISTENING, CONNECTING, ACCE
         _duration_session = _tsession.elapsed();
         _inq.stop();
         _outq.stop();
+        changed();
 //      if (_next)
 //          _next->close();
     }
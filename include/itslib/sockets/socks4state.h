@@ -72,7 +72,7 @@ public:
         set16be(&_req[2], port);
         _req[8]= 0;  // userid
 
-        _desc += stringformat(" %s", addr.c_str());
+        appendformat(_desc, FMTSTR(" %s"), addr);
         logprogress("%s %s pkt: %s\n", logstamp().c_str(), _desc.c_str(), vhexdump(_req).c_str());
     }
     virtual void mayread()
@@ -122,6 +122,8 @@ public:
     }
     virtual size_t sockread(uint8_t *p, size_t nreq) { return _s->sockread(p,nreq); }
     virtual size_t sockwrite(const uint8_t *p, size_t nreq) { return _s->sockwrite(p,nreq); }
+    virtual size_t sockreadv(const ByteQueue::span *v, int nv) { return _s->sockreadv(v,nv); }
+    virtual size_t sockwritev(const ByteQueue::span *v, int nv) { return _s->sockwritev(v,nv); }
 
     // needs is overridden in ssl, where it always returns true
     virtual bool needs(int need)
@@ -134,7 +136,7 @@ public:
                    if (need==NEED_RD)
                        return !_s->eof();
                    else
-                       return !_s->eof() && _outuq.usedsize()>0;
+                       return !_s->eof() && _outq.usedsize()>0;
         }
     }
     virtual int fd() { return _s ? _s->fd() : -1; }
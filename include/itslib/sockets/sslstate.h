@@ -13,13 +13,13 @@ public:
     sslstate(sslcontext_ptr ctx)
         : _ctx(ctx)
     {
-        _desc= stringformat("sslout");
+        _desc= "sslout";
         logprogress("%s %s ssl created\n", logstamp().c_str(), _desc.c_str());
     }
     sslstate(sslcontext_ptr ctx, socket_ptr s)
         : _s(s), _ctx(ctx), _ssl(_ctx->newsocket(s->fd()))
     {
-        _desc= stringformat("sslin");
+        _desc= "sslin";
         logprogress("%s %s ssl accepting\n", logstamp().c_str(), _desc.c_str());
         _ssl->setnonblocking();
         _state= ACCEPTING;
@@ -111,7 +111,7 @@ public:
                    if (need==NEED_RD)
                        return !_s->eof();
                    else
-                       return !_s->eof() && _outuq.usedsize()>0;
+                       return !_s->eof() && _outq.usedsize()>0;
 
         }
         // todo: ssl api returns specific want read/write status codes
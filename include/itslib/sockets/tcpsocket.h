@@ -130,6 +130,7 @@ typedef int socklen_t;
 #include <netinet/tcp.h>        // for TCP_NODELAY
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/uio.h>    // readv, writev
 
 // todo: replace errno+constants with platform dependent functions
 //   the current way of redefining constants easily breaks.
@@ -147,6 +148,8 @@ static int read(int fd, char *buf, size_t size) { return ::read(fd,buf,size); }
 static int readoob(int fd, char *buf, size_t size) { return ::recv(fd,buf,size,MSG_OOB); }
 static int write(int fd, const char *buf, size_t size) { return ::write(fd,buf,size); }
 static int writeoob(int fd, const char *buf, size_t size) { return ::send(fd,buf,size,MSG_OOB); }
+static int readv(int fd, const struct iovec *iov, int iovcnt) { return ::readv(fd,iov,iovcnt); }
+static int writev(int fd, const struct iovec *iov, int iovcnt) { return ::writev(fd,iov,iovcnt); }
 static int ioctl(int fd, int cmd, unsigned long *argp) { return ::ioctl(fd, cmd, argp); }
 static int recvfrom(int fd, char*buf, size_t size, int flags, struct sockaddr*from, socklen_t *slen)
 {
@@ -457,7 +460,7 @@ public:
         hint.ai_protocol = IPPROTO_TCP;
 
         struct addrinfo *ai;
-        int rc= getaddrinfo(addr.c_str(), stringformat("%d", port).c_str(), &hint, &ai);
+        int rc= getaddrinfo(addr.c_str(), formatstring(FMTSTR("%d"), port).c_str(), &hint, &ai);
         if (rc==0) {
 
             for (struct addrinfo *p= ai ; p ; p=p->ai_next)
@@ -489,9 +492,8 @@ public:
             throw socketerror("inet_ntop");
         ipaddress.resize(strlen(ipaddress.c_str()));
         if (port())
-            return stringformat("%s:%d", ipaddress.c_str(), port());
-        else
-            return stringformat("%s", ipaddress.c_str());
+            appendformat(ipaddress, FMTSTR(":%d"), port());
+        return ipaddress;
     }
     explicit tcpaddress(int port)
     {
@@ -814,6 +816,36 @@ public:
         }
         return nr;
     }
+#ifndef _WIN32
+    // scatter/gather versions of read and write.
+    // unlike write, writev returns 0 when the socket buffer is full.
+    size_t readv(const struct iovec *iov, int iovcnt)
+    {
+        if (_remoteshutdown)
+            throw socketerror("remoteshutdown");
+        int nr=posixwrapper::readv(_fd, iov, iovcnt);
+        if (nr==-1) {
+            if (errno!=TRYAGAIN)
+                throw socketerror("readv");
+            nr= 0;
+        }
+        else if (nr==0) {
+            logsocketprogress("remoteshutdown");
+            _remoteshutdown= true;
+        }
+        return nr;
+    }
+    size_t writev(const struct iovec *iov, int iovcnt)
+    {
+        int n=posixwrapper::writev(_fd, iov, iovcnt);
+        if (n==-1) {
+            if (errno!=TRYAGAIN)
+                throw socketerror("writev");
+            n= 0;
+        }
+        return n;
+    }
+#endif
     size_t readoob(unsigned char* data, size_t len) 
     {
         if (_remoteshutdown)
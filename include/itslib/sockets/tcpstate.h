@@ -17,7 +17,7 @@ public:
         : _s(new tcpsocket()), _target(target)
     {
         _s->setnonblocking();
-        _desc= stringformat("sock %d", _s->fd());
+        _desc= formatstring(FMTSTR("sock %d"), _s->fd());
         if (_verbose>1)
             logprogress("%s created %s\n", logstamp().c_str(), _desc.c_str());
     }
@@ -25,7 +25,7 @@ public:
         : _s(s)
     {
         ev_connected();
-        _desc= stringformat("asock %d %s<-%s", _s->fd(), s->getsockname().c_str(), s->getpeername().c_str());
+        _desc= formatstring(FMTSTR("asock %d %s<-%s"), _s->fd(), s->getsockname(), s->getpeername());
         logprogress("%s accepted %s\n", logstamp().c_str(), _desc.c_str());
     }
     ~tcpstate()
@@ -43,7 +43,7 @@ public:
     void listen(const tcpaddress& addr)
     {
         _state= LISTENING;
-        _desc= stringformat("isock %d %s", _s->fd(), addr.asstring().c_str());
+        _desc= formatstring(FMTSTR("isock %d %s"), _s->fd(), addr.asstring());
         logprogress("%s tcplistening %s\n", logstamp().c_str(), _desc.c_str());
         _s->listen(addr);
     }
@@ -110,6 +110,28 @@ public:
     {
         return _s->write(p, nreq);
     }
+#ifndef _WIN32
+    // a plain tcp socket can read/write both queue spans with a single syscall
+    virtual size_t sockreadv(const ByteQueue::span *v, int nv)
+    {
+        struct iovec iov[2];
+        return _s->readv(iov, toiovec(v, nv, iov));
+    }
+    virtual size_t sockwritev(const ByteQueue::span *v, int nv)
+    {
+        struct iovec iov[2];
+        return _s->writev(iov, toiovec(v, nv, iov));
+    }
+    static int toiovec(const ByteQueue::span *v, int nv, struct iovec *iov)
+    {
+        assert(nv<=2);
+        for (int i=0 ; i<nv ; i++) {
+            iov[i].iov_base= v[i].ptr;
+            iov[i].iov_len= v[i].size;
+        }
+        return nv;
+    }
+#endif
 
     // needs is overridden in ssl, where it always returns true
     virtual bool needs(int need)
@@ -124,7 +146,7 @@ public:
                    if (need==NEED_RD)
                        return !_s->eof();
                    else
-                       return !_s->eof() && _outuq.usedsize()>0;
+                       return !_s->eof() && _outq.usedsize()>0;
         }
     }
 };
@@ -12,8 +12,10 @@
 //    with it compiles to templates with threading support.
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iterator>   // std::size, std::empty
+#include <type_traits>
 #include "vectorutils.h"
 
 #include "util/wintypes.h"
@@ -245,6 +247,7 @@ void chomp(T *str)
 }
 
 
+// see util/splitstringview.h for a version returning std::string_views
 bool SplitString(const std::string& str, StringList& strlist, bool bWithEscape= true, const std::string& separator=" \t");
 bool SplitString(const std::Wstring& str, WStringList& strlist, bool bWithEscape= true, const std::Wstring& separator=(const WCHAR*)L" \t");
 
@@ -275,7 +278,33 @@ std::string stringformat(const char *fmt, ...);
 std::string stringvformat(const char *fmt, va_list ap);
 #endif
 
-//int stringicompare(const std::string& a, const std::string& b);
+// ascii case folding: only 'A'-'Z' are changed, like tolower in the "C" locale.
+// these work on 16 bytes at a time with sse2.
+void stringtolower(char *dst, const char *src, size_t n);
+// compares like the stringicompare template: by the first differing folded char.
+int stringicompare(const char *a, size_t na, const char *b, size_t nb);
+bool stringiequal(const char *a, size_t na, const char *b, size_t nb);
+inline bool stringiequal(const std::string& a, const std::string& b)
+{
+    return a.size()==b.size() && stringiequal(a.data(), a.size(), b.data(), b.size());
+}
+// a case insensitive hash: keys which are stringiequal have the same hash.
+uint32_t stringihash(const char *p, size_t n);
+inline uint32_t stringihash(const std::string& str)
+{
+    return stringihash(str.data(), str.size());
+}
+// a key with a precalculated stringihash, for repeated lookups of the same key.
+struct stringikey {
+    std::string key;
+    uint32_t hash;
+
+    explicit stringikey(const std::string& key)
+        : key(key), hash(stringihash(key))
+    {
+    }
+};
+
 template<typename T>
 int charicompare(T a,T b)
 {
@@ -289,6 +318,9 @@ int charicompare(T a,T b)
 template<class T>
 int stringicompare(const T& a, const T& b)
 {
+    if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+        return stringicompare(a.data(), a.size(), b.data(), b.size());
+
     typename T::const_iterator pa= a.begin();
     typename T::const_iterator pa_end= a.end();
     typename T::const_iterator pb= b.begin();
@@ -318,6 +350,8 @@ void byte2hexchars(uint8_t b, char *p);
 void word2hexchars(uint16_t w, char *p);
 void dword2hexchars(uint32_t d, char *p);
 void qword2hexchars(uint64_t d, char *p);
+// writes 2*n lowercase hex chars
+void bytes2hexchars(const uint8_t *buf, size_t n, char *p);
 
 
 template<typename I>
@@ -328,6 +362,12 @@ std::string hexstring(I buf, int nLength, char sep=0)
     std::string str;
     str.resize(nLength*2+(sep ? (nLength-1):0));
     char *p= &str[0];
+    if constexpr (std::is_pointer<I>::value && sizeof(*buf)==1) {
+        if (!sep) {
+            bytes2hexchars((const uint8_t*)buf, nLength, p);
+            return str;
+        }
+    }
     while(nLength--)
     {
         byte2hexchars(*buf++, p); p+=2;
@@ -476,6 +516,8 @@ std::string rhexdump(R range)
 // produce exact representation of data, representing nonprintable characters
 //  escaped or as hex dumps
 std::string ascdump(const uint8_t *first, size_t size, const std::string& escaped= "", bool bBreakOnEol= false);
+// appends to 'result'
+void ascdump(std::string& result, const uint8_t *first, size_t size, const std::string& escaped= "", bool bBreakOnEol= false);
 
 template<typename V>
 inline std::string ascdump(const V& buf, const std::string& escaped= "", bool bBreakOnEol= false)
@@ -547,6 +589,8 @@ std::string base64_encode(P data, size_t n)
     }
     return b64;
 }
+// the simd version from util/base64.h
+std::string base64_encode(const uint8_t *data, size_t n);
 template<typename R>
 std::string base64_encode(const R& data)
 {
@@ -558,16 +602,86 @@ std::string base64_encode(const R& data)
 ByteVector base64_decode(const std::string& str);
 
 
+// the digit values of '0'-'9', 'A'-'Z' and 'a'-'z', -1 for other chars
+struct char2nybletable {
+    int8_t v[128];
+    constexpr char2nybletable()
+        : v()
+    {
+        for (int c=0 ; c<128 ; c++)
+            v[c]= c>='0' && c<='9' ? c-'0'
+                : c>='A' && c<='Z' ? 10+c-'A'
+                : c>='a' && c<='z' ? 10+c-'a'
+                : -1;
+    }
+};
 template<typename T>
 int char2nyble(T c)
 {
-    if (c<'0') return -1;
-    if (c<='9') return c-'0';
-    if (c<'A') return -1;
-    if (c<='Z') return 10+c-'A';
-    if (c<'a') return -1;
-    if (c<='z') return 10+c-'a';
-    return -1;
+    static constexpr char2nybletable table;
+    // negative chars become large values here
+    if (uint64_t(c)>=128) return -1;
+    return table.v[uint64_t(c)];
+}
+
+// swar helpers for the parse functions below: these check and convert 8 chars at once.
+// the high bit is set in each byte with lo < b < hi, for bytes < 0x80.
+inline uint64_t swarbytesbetween(uint64_t x, unsigned lo, unsigned hi)
+{
+    const uint64_t ones= 0x0101010101010101ULL;
+    uint64_t t= x & ones*0x7f;
+    return (ones*(127+hi) - t) & ~x & (t + ones*(127-lo)) & ones*0x80;
+}
+inline bool parse8decimal(const char *p, uint32_t& val)
+{
+    const uint64_t ones= 0x0101010101010101ULL;
+    uint64_t x= get64le(p);
+    if (swarbytesbetween(x, '0'-1, '9'+1) != ones*0x80)
+        return false;
+    x -= ones*'0';
+    // pairs, then groups of 4, then all 8 digits
+    x= x*10 + (x>>8);
+    x= (((x & 0x000000ff000000ffULL) * (100 + (1000000ULL<<32)))
+      + (((x>>16) & 0x000000ff000000ffULL) * (1 + (10000ULL<<32)))) >> 32;
+    val= uint32_t(x);
+    return true;
+}
+inline bool parse8hex(const char *p, uint32_t& val)
+{
+    const uint64_t ones= 0x0101010101010101ULL;
+    uint64_t x= get64le(p);
+    uint64_t digits= swarbytesbetween(x, '0'-1, '9'+1);
+    uint64_t letters= swarbytesbetween(x | ones*0x20, 'a'-1, 'f'+1);
+    if ((digits|letters) != ones*0x80)
+        return false;
+    x= (x & ones*0x0f) + (letters>>7)*9;
+    // the first char is in the lowest byte
+    x= ((x<<4) | (x>>8)) & 0x00ff00ff00ff00ffULL;
+    x= ((x<<8) | (x>>16)) & 0x0000ffff0000ffffULL;
+    x= ((x<<16) | (x>>32)) & 0xffffffffULL;
+    val= uint32_t(x);
+    return true;
+}
+// skips over blocks of 8 decimal or hex digits, when parsing from a char pointer.
+// the value is the same as when adding one digit at a time, including overflow.
+template<typename I, typename V>
+void parsedigits8(I& i, I last, int base, V& val)
+{
+    if constexpr (std::is_pointer<I>::value && sizeof(*i)==1 && std::is_integral<V>::value && sizeof(V)>1) {
+        uint32_t x;
+        if (base==10) {
+            while (last-i>=8 && parse8decimal((const char*)i, x)) {
+                val= V(uint64_t(val)*100000000 + x);
+                i += 8;
+            }
+        }
+        else if (base==16) {
+            while (last-i>=8 && parse8hex((const char*)i, x)) {
+                val= V((uint64_t(val)<<32) + x);
+                i += 8;
+            }
+        }
+    }
 }
 
 // parse unsigned int of specified base
@@ -579,6 +693,7 @@ uint64_t parseuint(I first, I last, int base)
     while (i!=last && isspace(*i))
         i++;
     uint64_t val= 0;
+    parsedigits8(i, last, base, val);
     while (i!=last)
     {
         int x= char2nyble(*i);
@@ -606,6 +721,7 @@ I parseint(I first, I last, int base, V& val)
         i++;
     }
     val= 0;
+    parsedigits8(i, last, base, val);
     while (i!=last)
     {
         int x= char2nyble(*i);
@@ -627,6 +743,8 @@ std::pair<uint64_t, P> parseunsigned(P first, P last, int base)
     int state = 0;
     uint64_t num = 0;
     auto p = first;
+    if (base)
+        parsedigits8(p, last, base, num);
     while (p<last)
     {
         int n = char2nyble(*p);
@@ -635,6 +753,9 @@ std::pair<uint64_t, P> parseunsigned(P first, P last, int base)
                 if (1<=n && n<=9) {
                     base = 10;
                     num = n;  // is first real digit
+                    ++p;
+                    parsedigits8(p, last, base, num);
+                    continue;
                 }
                 else if (n==0) {
                     // expect 0<octal>, 0b<binary>, 0x<hex>
@@ -649,6 +770,9 @@ std::pair<uint64_t, P> parseunsigned(P first, P last, int base)
             else if (state==1) {
                 if (*p == 'x') {
                     base = 16;
+                    ++p;
+                    parsedigits8(p, last, base, num);
+                    continue;
                 }
                 else if (*p == 'b') {
                     base = 2;
@@ -759,12 +883,18 @@ size_t hex2binary(P1 strfirst, P1 strlast, P2 first, P2 last)
     }
     return o-first;
 }
+// the same for bytes, converting large blocks with simd instructions
+size_t hex2binary(const char *strfirst, const char *strlast, uint8_t *first, uint8_t *last);
 
 template<typename C,typename T>
 void hex2binary(const std::basic_string<C>& hex, std::vector<T>& v)
 {
     v.resize(hex.size()/2/sizeof(T));
-    size_t n= hex2binary(hex.begin(), hex.end(), v.begin(), v.end());
+    size_t n;
+    if constexpr (sizeof(C)==1 && sizeof(T)==1 && !std::is_same<T,bool>::value)
+        n= hex2binary((const char*)hex.data(), (const char*)hex.data()+hex.size(), (uint8_t*)v.data(), (uint8_t*)v.data()+v.size());
+    else
+        n= hex2binary(hex.begin(), hex.end(), v.begin(), v.end());
     v.resize(n);
 }
 
@@ -772,7 +902,11 @@ template<typename P,typename T>
 void hex2binary(P first, P last, std::vector<T>& v)
 {
     v.resize((last-first)/2/sizeof(T));
-    size_t n= hex2binary(first, last, v.begin(), v.end());
+    size_t n;
+    if constexpr (std::is_pointer<P>::value && sizeof(*first)==1 && sizeof(T)==1 && !std::is_same<T,bool>::value)
+        n= hex2binary((const char*)first, (const char*)last, (uint8_t*)v.data(), (uint8_t*)v.data()+v.size());
+    else
+        n= hex2binary(first, last, v.begin(), v.end());
     v.resize(n);
 }
 
@@ -788,86 +922,96 @@ void hex2binary(const C*hex, std::vector<T>& v)
 std::string utf8forchar(WCHAR c);
 
 
+// appends the escaped chars to 'ostr', copying runs of plain chars in bulk.
+void cstrescape(std::string& ostr, const char *p, size_t n);
+
 #ifndef _NO_OLD_STRINGFORMAT
+// appends the unescaped 'str' to 'result'
 template<typename S>
-S cstrunescape(const S& str)
+void cstrunescape(S& result, const S& str)
 {
-    S result;
+    // the result is never longer than the input
+    result.reserve(result.size()+str.size());
     size_t pos= 0;
-    bool bEscaped= false;
     uint64_t val;
     while (pos<str.size())
     {
-        if (bEscaped)
+        // copy everything up to the next escape in one go
+        size_t esc= str.find('\\', pos);
+        if (esc==S::npos)
+            esc= str.size();
+        result.append(str, pos, esc-pos);
+        pos= esc+1;
+        if (pos>=str.size())
+            break;
+
+        switch(str[pos])
         {
-            switch(str[pos])
-            {
-                case 'a': result+='\a'; break;  // 0x07 alert
-                case 'b': result+='\b'; break;  // 0x08 backspace
-                case 't': result+='\t'; break;  // 0x09 horizontal tab
-                case 'n': result+='\n'; break;  // 0x0a linefeed
-                case 'v': result+='\v'; break;  // 0x0b vertical tab
-                case 'f': result+='\f'; break;  // 0x0c formfeed
-                case 'r': result+='\r'; break;  // 0x0d carriage return
-                case 'x': 
-                          val= 0;
-                          ++pos;
-                          while (pos<str.size())
-                          {
-                              int x= char2nyble(str[pos]);
-                              if (x==-1 || x>=16) {
-                                  pos--;
-                                  break;
-                              }
-                              val <<= 4;
-                              val |= x;
-                              pos++;
+            case 'a': result+='\a'; break;  // 0x07 alert
+            case 'b': result+='\b'; break;  // 0x08 backspace
+            case 't': result+='\t'; break;  // 0x09 horizontal tab
+            case 'n': result+='\n'; break;  // 0x0a linefeed
+            case 'v': result+='\v'; break;  // 0x0b vertical tab
+            case 'f': result+='\f'; break;  // 0x0c formfeed
+            case 'r': result+='\r'; break;  // 0x0d carriage return
+            case 'x': 
+                      val= 0;
+                      ++pos;
+                      while (pos<str.size())
+                      {
+                          int x= char2nyble(str[pos]);
+                          if (x==-1 || x>=16) {
+                              pos--;
+                              break;
                           }
-                          result += (typename S::value_type)val; 
-                          break;
-                case '0':
-                case '1':
-                case '2':
-                          {
-                          val= char2nyble(str[pos]);
-                          ++pos;
-                          int ndigits=1;
-                          while (pos<str.size() && ndigits<3)
-                          {
-                              int x= char2nyble(str[pos]);
-                              if (x==-1 || x>=8) {
-                                  pos--;
-                                  break;
-                              }
-                              val <<= 3;
-                              val |= x;
-                              pos++;
-                              ndigits++;
-                          }
-                          result += (typename S::value_type)val;  
-                          break;
-                          }
-                default:
-                          result+=str[pos];
-            }
-            bEscaped= false;
-        }
-        else if (str[pos]=='\\')
-        {
-            bEscaped= true;
-        }
-        else {
-            result += str[pos];
+                          val <<= 4;
+                          val |= x;
+                          pos++;
+                      }
+                      result += (typename S::value_type)val; 
+                      break;
+            case '0':
+            case '1':
+            case '2':
+                      {
+                      // up to 3 octal digits, 'pos' stays on the last one
+                      val= char2nyble(str[pos]);
+                      int ndigits=1;
+                      while (pos+1<str.size() && ndigits<3)
+                      {
+                          int x= char2nyble(str[pos+1]);
+                          if (x==-1 || x>=8)
+                              break;
+                          val <<= 3;
+                          val |= x;
+                          pos++;
+                          ndigits++;
+                      }
+                      result += (typename S::value_type)val;  
+                      break;
+                      }
+            default:
+                      result+=str[pos];
         }
         ++pos;
     }
-
+}
+template<typename S>
+S cstrunescape(const S& str)
+{
+    S result;
+    cstrunescape(result, str);
     return result;
 }
+// appends the escaped 'str' to 'ostr'
 template<typename S>
-S cstrescape(const S& str)
+void cstrescape(S& ostr, const S& str)
 {
-    S ostr; ostr.reserve(str.size()+(str.size()>>6));
+    if constexpr (std::is_same<S, std::string>::value) {
+        cstrescape(ostr, str.data(), str.size());
+        return;
+    }
+    ostr.reserve(ostr.size()+str.size()+(str.size()>>6));
     for (typename S::const_iterator i= str.begin() ; i!=str.end() ; ++i)
     {
         typename S::value_type c= *i;
@@ -877,12 +1021,23 @@ S cstrescape(const S& str)
             case '\t': ostr += "\\t"; break;
             case '\\': ostr += "\\\\"; break;
             case '"': ostr += "\\\""; break;
-            default: ostr += stringformat("\\x%02x", unsigned(c)&0xff);
+            default:
+                char hex[2];
+                byte2hexchars(unsigned(c)&0xff, hex);
+                ostr += "\\x";
+                ostr += hex[0];
+                ostr += hex[1];
         }
         else {
             ostr += c;
         }
     }
+}
+template<typename S>
+S cstrescape(const S& str)
+{
+    S ostr;
+    cstrescape(ostr, str);
     return ostr;
 }
 #endif
@@ -0,0 +1,399 @@
+#ifndef __UTIL_BASE64_H__
+#define __UTIL_BASE64_H__
+// base64 encoding and decoding into caller provided buffers, with streaming versions.
+//
+//   std::string b64; b64.resize(base64::encodedsize(n));
+//   base64::encode(data, n, &b64[0]);
+//
+//   ByteVector data(base64::decodedsize(b64.size()));
+//   data.resize(base64::decode(b64.c_str(), b64.size(), &data[0]));
+//
+// decoding works like base64_decode from stringutils: chars which are not part
+// of the base64 alphabet, like whitespace, are skipped, and decoding stops at the first '='.
+//
+// on x86 the bulk of the data is converted 24 or 32 ( avx2 ) or 12 or 16 ( ssse3 ) bytes at a time,
+// using Wojciech Muła's pshufb based algorithms.
+// the simd code is compiled with target attributes, so no special compiler flags
+// are needed. define _NO_BASE64SIMD to leave out the simd code.
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(_NO_BASE64SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define _HAVE_BASE64SIMD
+#include <immintrin.h>
+
+#define BASE64_SSE __attribute__((target("ssse3")))
+#define BASE64_AVX2 __attribute__((target("avx2")))
+
+struct base64ssse3 {
+    enum { ENCIN= 12, ENCOUT= 16, DECIN= 16, DECOUT= 12 };
+
+    // 6 bit values to chars
+    BASE64_SSE static __m128i tochars(const __m128i& v)
+    {
+        __m128i r= _mm_subs_epu8(v, _mm_set1_epi8(51));
+        __m128i less= _mm_cmpgt_epi8(_mm_set1_epi8(26), v);
+        r= _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+        const __m128i shift= _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+        return _mm_add_epi8(_mm_shuffle_epi8(shift, r), v);
+    }
+    // reads 16 bytes from 'p', encodes the first 12 to 16 chars
+    BASE64_SSE static void encode(const uint8_t *p, char *out)
+    {
+        __m128i in= _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p),
+                _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m128i t0= _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i t1= _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128((__m128i*)out, tochars(_mm_or_si128(t0, t1)));
+    }
+    // decodes 16 chars, and writes 16 bytes, of which the first 12 are the result.
+    // returns false, without writing, when not all chars are in the base64 alphabet.
+    BASE64_SSE static bool decode(const char *p, uint8_t *out)
+    {
+        __m128i in= _mm_loadu_si128((const __m128i*)p);
+        __m128i hi= _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+        __m128i lo= _mm_and_si128(in, _mm_set1_epi8(0x0f));
+
+        // each char class has a bit in 'bitpos', and 'mask' tells which classes are valid for the low nibble
+        const __m128i masklut= _mm_setr_epi8(char(0xa8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8),
+                char(0xf8), char(0xf8), char(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54);
+        const __m128i bitposlut= _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, char(0x80), 0, 0, 0, 0, 0, 0, 0, 0);
+        __m128i bad= _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(masklut, lo), _mm_shuffle_epi8(bitposlut, hi)), _mm_setzero_si128());
+        if (_mm_movemask_epi8(bad))
+            return false;
+
+        // '/' is the only char in its group with a different offset
+        const __m128i shiftlut= _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        __m128i slash= _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        __m128i shift= _mm_or_si128(_mm_andnot_si128(slash, _mm_shuffle_epi8(shiftlut, hi)), _mm_and_si128(slash, _mm_set1_epi8(16)));
+        __m128i v= _mm_add_epi8(in, shift);
+
+        // pack 4 x 6 bits into 3 bytes
+        __m128i ab_bc= _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        __m128i abc= _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+        abc= _mm_shuffle_epi8(abc, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128((__m128i*)out, abc);
+        return true;
+    }
+};
+
+struct base64avx2 {
+    enum { ENCIN= 24, ENCOUT= 32, DECIN= 32, DECOUT= 24 };
+
+    BASE64_AVX2 static __m256i tochars(const __m256i& v)
+    {
+        __m256i r= _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        __m256i less= _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        r= _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        const __m256i shift= _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0,
+                'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+        return _mm256_add_epi8(_mm256_shuffle_epi8(shift, r), v);
+    }
+    // reads 28 bytes from 'p', encodes the first 24 to 32 chars
+    BASE64_AVX2 static void encode(const uint8_t *p, char *out)
+    {
+        // 12 bytes in each 128 bit lane
+        __m256i in= _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+                _mm_loadu_si128((const __m128i*)(p+12)), 1);
+        in= _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                    10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m256i t0= _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i t1= _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        _mm256_storeu_si256((__m256i*)out, tochars(_mm256_or_si256(t0, t1)));
+    }
+    // decodes 32 chars, and writes 32 bytes, of which the first 24 are the result.
+    BASE64_AVX2 static bool decode(const char *p, uint8_t *out)
+    {
+        __m256i in= _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi= _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+        __m256i lo= _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+
+        const __m256i masklut= _mm256_broadcastsi128_si256(_mm_setr_epi8(char(0xa8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8), char(0xf8),
+                char(0xf8), char(0xf8), char(0xf0), 0x54, 0x50, 0x50, 0x50, 0x54));
+        const __m256i bitposlut= _mm256_broadcastsi128_si256(_mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, char(0x80), 0, 0, 0, 0, 0, 0, 0, 0));
+        __m256i bad= _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(masklut, lo), _mm256_shuffle_epi8(bitposlut, hi)), _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(bad))
+            return false;
+
+        const __m256i shiftlut= _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+        __m256i slash= _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i v= _mm256_add_epi8(in, _mm256_blendv_epi8(_mm256_shuffle_epi8(shiftlut, hi), _mm256_set1_epi8(16), slash));
+
+        __m256i ab_bc= _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        __m256i abc= _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+        abc= _mm256_shuffle_epi8(abc, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                       2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // move the 12 bytes of the high lane next to those of the low lane
+        abc= _mm256_permutevar8x32_epi32(abc, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)out, abc);
+        return true;
+    }
+};
+
+// V is one of the traits above, its functions only take pointers, so this is correct
+// without inlining. the wrappers below flatten it into a function with the right target attribute.
+template<typename V>
+struct base64blocks {
+    // encodes whole blocks, while the input can be over-read, returns the nr of bytes used
+    static size_t encode(const uint8_t *p, size_t n, char *out)
+    {
+        size_t i= 0;
+        for ( ; i+V::ENCIN+4<=n ; i += V::ENCIN, out += V::ENCOUT)
+            V::encode(p+i, out);
+        return i;
+    }
+    // decodes whole blocks of valid chars, stops at the first block with any other char.
+    // the blocks write past their output, so stop while the output buffer, of at least
+    // (n/4)*3 bytes, still has room for that.
+    // returns the nr of chars used, 'o' is incremented with the nr of bytes written.
+    static size_t decode(const char *p, size_t n, uint8_t *out, size_t& o)
+    {
+        size_t i= 0;
+        for ( ; i+2*V::DECIN<=n ; i += V::DECIN, o += V::DECOUT)
+            if (!V::decode(p+i, out+o))
+                break;
+        return i;
+    }
+};
+struct base64simd {
+    BASE64_SSE __attribute__((flatten))
+    static size_t encodessse3(const uint8_t *p, size_t n, char *out)
+    {
+        return base64blocks<base64ssse3>::encode(p, n, out);
+    }
+    BASE64_AVX2 __attribute__((flatten))
+    static size_t encodeavx2(const uint8_t *p, size_t n, char *out)
+    {
+        return base64blocks<base64avx2>::encode(p, n, out);
+    }
+    BASE64_SSE __attribute__((flatten))
+    static size_t decodessse3(const char *p, size_t n, uint8_t *out, size_t& o)
+    {
+        return base64blocks<base64ssse3>::decode(p, n, out, o);
+    }
+    BASE64_AVX2 __attribute__((flatten))
+    static size_t decodeavx2(const char *p, size_t n, uint8_t *out, size_t& o)
+    {
+        return base64blocks<base64avx2>::decode(p, n, out, o);
+    }
+    static int detect()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return 32;
+        if (__builtin_cpu_supports("ssse3"))
+            return 16;
+        return 0;
+    }
+    // the vector size in bytes, 0 when the cpu has no usable simd support
+    static int level()
+    {
+        static const int n= detect();
+        return n;
+    }
+    static size_t encode(const uint8_t *p, size_t n, char *out)
+    {
+        if (level()==32)
+            return encodeavx2(p, n, out);
+        if (level()==16)
+            return encodessse3(p, n, out);
+        return 0;
+    }
+    static size_t decode(const char *p, size_t n, uint8_t *out, size_t& o)
+    {
+        if (level()==32)
+            return decodeavx2(p, n, out, o);
+        if (level()==16)
+            return decodessse3(p, n, out, o);
+        return 0;
+    }
+};
+#undef BASE64_SSE
+#undef BASE64_AVX2
+#endif
+
+struct base64 {
+    // note: facebook, youtube use a modified version with  tr "+/"  "-_"
+    static const char *alphabet() { return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"; }
+
+    // 0-63 for valid chars, -1: invalid, -2: end
+    static const int8_t *charvalues()
+    {
+        static const int8_t t[256]= {
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+            52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,
+            -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
+            15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+            -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+            41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        };
+        return t;
+    }
+
+    static size_t encodedsize(size_t n) { return (n+2)/3*4; }
+    // the maximum nr of bytes decoded from 'n' chars
+    static size_t decodedsize(size_t n) { return (n+3)/4*3; }
+
+    // encodes the whole blocks of 3 bytes, returns the nr of bytes used.
+    static size_t encodeblocks(const uint8_t *p, size_t n, char *out)
+    {
+        const char *b64= alphabet();
+        size_t i= 0;
+#ifdef _HAVE_BASE64SIMD
+        i= base64simd::encode(p, n, out);
+        out += i/3*4;
+#endif
+        for ( ; i+3<=n ; i += 3, out += 4) {
+            uint32_t v= (p[i]<<16) | (p[i+1]<<8) | p[i+2];
+            out[0]= b64[v>>18];
+            out[1]= b64[(v>>12)&63];
+            out[2]= b64[(v>>6)&63];
+            out[3]= b64[v&63];
+        }
+        return i;
+    }
+    // encodes the last 1 or 2 bytes, with '=' padding
+    static size_t encodetail(const uint8_t *p, size_t n, char *out)
+    {
+        const char *b64= alphabet();
+        if (n==0)
+            return 0;
+        uint32_t v= (p[0]<<16) | (n>1 ? p[1]<<8 : 0);
+        out[0]= b64[v>>18];
+        out[1]= b64[(v>>12)&63];
+        out[2]= n>1 ? b64[(v>>6)&63] : '=';
+        out[3]= '=';
+        return 4;
+    }
+    // 'out' must have room for encodedsize(n) chars, returns the nr of chars written.
+    static size_t encode(const uint8_t *p, size_t n, char *out)
+    {
+        size_t i= encodeblocks(p, n, out);
+        return i/3*4 + encodetail(p+i, n-i, out+i/3*4);
+    }
+    // 'out' must have room for decodedsize(n) bytes, returns the nr of bytes written.
+    static size_t decode(const char *p, size_t n, uint8_t *out);
+};
+
+// base64 encoding of data which arrives in pieces
+class base64encoder {
+    uint8_t _pending[3];
+    size_t _npending;
+public:
+    base64encoder() : _npending(0) { }
+
+    // the max nr of chars add() writes for 'n' bytes
+    size_t addsize(size_t n) const { return (_npending+n)/3*4; }
+
+    // returns the nr of chars written to 'out'
+    size_t add(const uint8_t *p, size_t n, char *out)
+    {
+        size_t o= 0;
+        if (_npending) {
+            while (n && _npending<3) {
+                _pending[_npending++]= *p++;
+                n--;
+            }
+            if (_npending<3)
+                return 0;
+            o += base64::encode(_pending, 3, out);
+            _npending= 0;
+        }
+        size_t i= base64::encodeblocks(p, n, out+o);
+        o += i/3*4;
+        while (i<n)
+            _pending[_npending++]= p[i++];
+        return o;
+    }
+    // writes the last, padded, chars, at most 4.
+    size_t final(char *out)
+    {
+        size_t o= base64::encodetail(_pending, _npending, out);
+        _npending= 0;
+        return o;
+    }
+};
+
+// base64 decoding of text which arrives in pieces.
+class base64decoder {
+    uint32_t _value;
+    int _nchars;        // nr of chars in _value
+    bool _done;         // after '='
+public:
+    base64decoder() : _value(0), _nchars(0), _done(false) { }
+
+    // the max nr of bytes add() writes for 'n' chars
+    size_t addsize(size_t n) const { return (_nchars+n)/4*3; }
+
+    // returns the nr of bytes written to 'out'
+    size_t add(const char *p, size_t n, uint8_t *out)
+    {
+        const int8_t *values= base64::charvalues();
+        size_t o= 0;
+        size_t i= 0;
+        while (i<n && !_done) {
+#ifdef _HAVE_BASE64SIMD
+            if (_nchars==0)
+                i += base64simd::decode(p+i, n-i, out, o);
+#endif
+            // continue with the scalar code until the next group boundary,
+            // or to the end of a block with invalid chars.
+            size_t blockend= i+32<n ? i+32 : n;
+            while (i<blockend) {
+                int b= values[uint8_t(p[i++])];
+                if (b>=0) {
+                    _value= (_value<<6) | b;
+                    if (++_nchars==4) {
+                        out[o++]= _value>>16;
+                        out[o++]= _value>>8;
+                        out[o++]= _value;
+                        _value= 0;
+                        _nchars= 0;
+                    }
+                }
+                else if (b==-2) {
+                    _done= true;
+                    break;
+                }
+            }
+        }
+        return o;
+    }
+    // writes the bytes of an incomplete last group, at most 2.
+    size_t final(uint8_t *out)
+    {
+        size_t o= 0;
+        if (_nchars>=2) {
+            uint32_t v= _value << (6*(4-_nchars));
+            out[o++]= v>>16;
+            if (_nchars==3)
+                out[o++]= v>>8;
+        }
+        // note: 1 base64 char should not happen
+        _value= 0;
+        _nchars= 0;
+        _done= false;
+        return o;
+    }
+};
+
+inline size_t base64::decode(const char *p, size_t n, uint8_t *out)
+{
+    base64decoder dec;
+    size_t o= dec.add(p, n, out);
+    return o + dec.final(out+o);
+}
+#endif
@@ -0,0 +1,273 @@
+#ifndef _UTIL_BLOCKCACHE_H__
+#define _UTIL_BLOCKCACHE_H__
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// blockcache is an LRU cache of fixed size, aligned blocks of some underlying storage.
+//
+// the data is obtained through a 'loader' function, which is always called with
+// a block aligned offset, a multiple of blocksize bytes ( except at the end of the storage ),
+// and a buffer aligned to 'alignment'. so the loader can do O_DIRECT reads.
+//
+// readahead is adaptive: a miss directly after the previously accessed block doubles
+// the nr of blocks read in one go, up to 'maxreadahead'. a random miss resets it.
+//
+// blockcache is not threadsafe.
+class blockcache {
+public:
+    // returns the nr of bytes read, less than 'n' only at the end of the storage
+    typedef std::function<size_t(uint64_t ofs, uint8_t *p, size_t n)> loader_t;
+
+    struct options {
+        size_t blocksize;       // must be a multiple of 'alignment'
+        size_t maxblocks;       // cache size, in blocks
+        size_t maxreadahead;    // max nr of blocks read beyond the requested one
+        size_t alignment;       // of the buffers passed to the loader
+        bool direct;            // used by BlockDevice to open with O_DIRECT
+        options() : blocksize(65536), maxblocks(1024), maxreadahead(127), alignment(4096), direct(false) { }
+    };
+    struct statistics {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t readahead;     // blocks loaded before they were asked for
+        uint64_t readaheadhits; // of those, the ones which were used
+        uint64_t loads;         // nr of loader calls
+        statistics() : hits(0), misses(0), readahead(0), readaheadhits(0), loads(0) { }
+    };
+private:
+    struct freeer {
+        void operator()(uint8_t *p) const
+        {
+#ifdef _WIN32
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+    };
+    typedef std::unique_ptr<uint8_t, freeer> buffer_ptr;
+
+    struct block {
+        uint64_t nr;
+        buffer_ptr data;
+        size_t valid;       // nr of bytes loaded, less than blocksize at the end
+        bool prefetched;    // loaded by readahead, and not yet used
+    };
+    typedef std::list<block> blocklist;
+
+    loader_t _load;
+    uint64_t _size;
+    options _opt;
+    statistics _stats;
+
+    blocklist _lru;         // most recently used first
+    std::unordered_map<uint64_t, blocklist::iterator> _index;
+
+    buffer_ptr _staging;    // for multi block loads
+    uint64_t _lastblock;
+    size_t _readahead;
+
+    buffer_ptr allocate(size_t n)
+    {
+#ifdef _WIN32
+        uint8_t *p= (uint8_t*)_aligned_malloc(n, _opt.alignment);
+        if (p==NULL)
+            throw "blockcache: out of memory";
+#else
+        void *p;
+        if (posix_memalign(&p, _opt.alignment, n))
+            throw "blockcache: out of memory";
+#endif
+        return buffer_ptr((uint8_t*)p);
+    }
+    uint64_t nblocks() const { return (_size+_opt.blocksize-1)/_opt.blocksize; }
+
+    // returns a new block at the front of the lru, reusing the least recently used buffer when full
+    block& newblock(uint64_t nr)
+    {
+        if (_lru.size()>=_opt.maxblocks) {
+            auto last= std::prev(_lru.end());
+            _index.erase(last->nr);
+            _lru.splice(_lru.begin(), _lru, last);
+        }
+        else {
+            _lru.emplace_front();
+            _lru.front().data= allocate(_opt.blocksize);
+        }
+        block& b= _lru.front();
+        b.nr= nr;
+        b.valid= 0;
+        b.prefetched= false;
+        _index[nr]= _lru.begin();
+        return b;
+    }
+    bool iscached(uint64_t nr) const { return _index.find(nr)!=_index.end(); }
+
+    // load 'nr' plus readahead, returns the requested block
+    block& load(uint64_t nr)
+    {
+        if (nr==_lastblock+1)
+            _readahead= std::min(_opt.maxreadahead, std::max(size_t(1), _readahead*2));
+        else
+            _readahead= 0;
+
+        // don't read over blocks which are already cached, and don't evict what we are loading
+        size_t count= 1;
+        while (count<=_readahead && count<_opt.maxblocks && nr+count<nblocks() && !iscached(nr+count))
+            count++;
+
+        uint64_t ofs= nr*_opt.blocksize;
+        size_t want= std::min(uint64_t(count*_opt.blocksize), _size-ofs);
+        if (count==1) {
+            block& b= newblock(nr);
+            try {
+                b.valid= _load(ofs, b.data.get(), want);
+            }
+            catch(...) {
+                // don't leave a block without data in the cache, its buffer is reused first
+                _index.erase(nr);
+                b.nr= ~uint64_t(0);
+                _lru.splice(_lru.end(), _lru, _lru.begin());
+                throw;
+            }
+            _stats.loads++;
+            return b;
+        }
+
+        if (!_staging)
+            _staging= allocate((_opt.maxreadahead+1)*_opt.blocksize);
+        uint8_t *buf= _staging.get();
+        size_t got= _load(ofs, buf, want);
+        _stats.loads++;
+
+        // insert in reverse, so the requested block ends up most recently used
+        for (size_t i=count ; i-->0 ; ) {
+            size_t bofs= i*_opt.blocksize;
+            if (bofs>=got && i>0)
+                continue;
+            block& b= newblock(nr+i);
+            b.valid= std::min(_opt.blocksize, got-std::min(size_t(got), bofs));
+            memcpy(b.data.get(), buf+bofs, b.valid);
+            if (i>0) {
+                b.prefetched= true;
+                _stats.readahead++;
+            }
+        }
+        return _lru.front();
+    }
+    block& get(uint64_t nr)
+    {
+        auto i= _index.find(nr);
+        if (i==_index.end()) {
+            _stats.misses++;
+            block& b= load(nr);
+            _lastblock= nr;
+            return b;
+        }
+        _stats.hits++;
+        _lru.splice(_lru.begin(), _lru, i->second);
+        block& b= _lru.front();
+        if (b.prefetched) {
+            _stats.readaheadhits++;
+            b.prefetched= false;
+        }
+        _lastblock= nr;
+        return b;
+    }
+public:
+    blockcache(loader_t load, uint64_t size, const options& opt= options())
+        : _load(load), _size(size), _opt(opt), _lastblock(~uint64_t(0)-1), _readahead(0)
+    {
+        if (_opt.blocksize==0 || _opt.blocksize%_opt.alignment)
+            throw "blockcache: blocksize must be a multiple of the alignment";
+        if (_opt.maxblocks==0)
+            _opt.maxblocks= 1;
+        _opt.maxreadahead= std::min(_opt.maxreadahead, _opt.maxblocks-1);
+    }
+
+    // read from the storage, through the cache
+    size_t read(uint64_t ofs, uint8_t *p, size_t n)
+    {
+        size_t total= 0;
+        while (n && ofs<_size) {
+            block& b= get(ofs/_opt.blocksize);
+            size_t bofs= ofs%_opt.blocksize;
+            if (bofs>=b.valid)
+                break;
+            size_t want= std::min(n, b.valid-bofs);
+            memcpy(p, b.data.get()+bofs, want);
+            p += want;
+            n -= want;
+            ofs += want;
+            total += want;
+        }
+        return total;
+    }
+    // update cached blocks after the caller wrote to the storage
+    void update(uint64_t ofs, const uint8_t *p, size_t n)
+    {
+        if (ofs+n>_size)
+            setsize(ofs+n);
+        while (n) {
+            uint64_t nr= ofs/_opt.blocksize;
+            size_t bofs= ofs%_opt.blocksize;
+            size_t want= std::min(n, _opt.blocksize-bofs);
+            auto i= _index.find(nr);
+            if (i!=_index.end()) {
+                block& b= *i->second;
+                if (bofs<=b.valid) {
+                    memcpy(b.data.get()+bofs, p, want);
+                    b.valid= std::max(b.valid, bofs+want);
+                }
+                else {
+                    // would leave a hole
+                    invalidate(nr);
+                }
+            }
+            p += want;
+            n -= want;
+            ofs += want;
+        }
+    }
+    void invalidate(uint64_t nr)
+    {
+        auto i= _index.find(nr);
+        if (i==_index.end())
+            return;
+        _lru.erase(i->second);
+        _index.erase(i);
+    }
+    void setsize(uint64_t size)
+    {
+        // drop the partial last block, and everything beyond the new size
+        uint64_t first= std::min(size, _size)/_opt.blocksize;
+        for (auto i= _lru.begin() ; i!=_lru.end() ; ) {
+            auto cur= i++;
+            if (cur->nr>=first) {
+                _index.erase(cur->nr);
+                _lru.erase(cur);
+            }
+        }
+        _size= size;
+    }
+    void clear()
+    {
+        _index.clear();
+        _lru.clear();
+        _lastblock= ~uint64_t(0)-1;
+        _readahead= 0;
+    }
+    uint64_t size() const { return _size; }
+    const options& getoptions() const { return _opt; }
+    const statistics& stats() const { return _stats; }
+};
+#endif
@@ -34,8 +34,12 @@
 //       [current algorithms all handle NUL terminated strings]
 
 // todo: utf8iterator cannot be used with std::sort, since it expects the iterator to be both assignable and dereferencable
+// note: utf8iterator's operator+ and operator- step over every char, util/utf8index.h has
+//       an index with iterators which do this in constant time.
 
 // does not check if chars fall in valid ranges
+// for buffers with a known length use utf8validate from util/utf8validate.h,
+// which is strict, much faster, and returns the offset of the first error.
 template<typename P>
 bool utf8validator(P p)
 {
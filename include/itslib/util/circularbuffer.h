@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <vector>
+#include <string.h>
 #include "util/hexdump.h"
 #include "util/logmsg.h"
 
@@ -81,6 +82,50 @@ public:
             copied+=wanted;
         }
     }
+
+    // zero-copy interface: the used or free part of the buffer is described
+    // as at most 2 contiguous spans. after filling or draining ( part of ) these,
+    // commitwrite/commitread tell the buffer how much was actually used.
+    struct span {
+        T* ptr;
+        size_t size;
+    };
+    // returns the number of spans filled in 's', which must have room for 2
+    int readspans(span *s)
+    {
+        size_t first= std::min(_size, _buf.size()-_rdptr);
+        return makespans(s, _rdptr, first, _size-first);
+    }
+    int writespans(span *s)
+    {
+        size_t first= std::min(freesize(), _buf.size()-_wrptr);
+        return makespans(s, _wrptr, first, freesize()-first);
+    }
+    void commitread(size_t size)
+    {
+        if (size>usedsize())
+            throw buffererror("buffer underflow");
+        if (size==0)
+            return;
+#ifdef DUMP_CB_DATA
+        logspans(_name, "read", _rdptr, size);
+#endif
+        _rdptr= (_rdptr+size)%_buf.size();
+        _size-=size;
+    }
+    void commitwrite(size_t size)
+    {
+        if (size>freesize())
+            throw buffererror("buffer overflow");
+        if (size==0)
+            return;
+#ifdef DUMP_CB_DATA
+        logspans(_name, "writ", _wrptr, size);
+#endif
+        _wrptr= (_wrptr+size)%_buf.size();
+        _size+=size;
+    }
+
     size_t usedsize() const
     {
         return _size;
@@ -102,6 +147,22 @@ private:
     size_t _wrptr;
     std::vector<T> _buf;
 
+    int makespans(span *s, size_t ofs, size_t first, size_t second)
+    {
+        int n=0;
+        if (first) {
+            s[n].ptr= &_buf[ofs];
+            s[n].size= first;
+            n++;
+        }
+        if (second) {
+            s[n].ptr= &_buf[0];
+            s[n].size= second;
+            n++;
+        }
+        return n;
+    }
+
 #ifdef DUMP_CB_DATA
 void logdata(const char*name, const char*msg, const T* data, size_t size)
 {
@@ -112,6 +173,13 @@ void logdata(const char*name, const char*msg, const T* data, size_t size)
     hexdump(std::cout, data, size);
     std::cout << std::endl;
 }
+void logspans(const char*name, const char*msg, size_t ofs, size_t size)
+{
+    size_t first= std::min(size, _buf.size()-ofs);
+    logdata(name, msg, &_buf[ofs], first);
+    if (size>first)
+        logdata(name, msg, &_buf[0], size-first);
+}
 #endif
 
 };
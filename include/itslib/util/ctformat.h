@@ -0,0 +1,428 @@
+#ifndef __UTIL_CTFORMAT_H__
+#define __UTIL_CTFORMAT_H__
+// printf style formatting, with the format string parsed at compile time.
+//
+//   std::string s= formatstring(FMTSTR("%s:%d"), host, port);
+//   appendformat(line, FMTSTR(" %08llx"), ofs);          // appends to 'line'
+//   size_t n= formatbuffer(buf, sizeof(buf), FMTSTR("%02x"), b);  // like snprintf
+//
+// FMTSTR wraps the string literal in a type, so the format is parsed once while
+// compiling. a mismatch between the format and the arguments is a compile error,
+// instead of undefined behaviour at runtime.
+//
+// supported: flags '-', '0', '+', ' ', '#', a width, a precision, and the conversions
+//   d i u x X o c  - integers and enums
+//   s              - const char*, std::string, std::string_view
+//   p              - pointers
+//   f F e E g G    - floating point, these are passed on to snprintf
+//   %%
+// '*' widths are not supported. length modifiers are accepted, but the size
+// is taken from the argument type, except for 'h' and 'hh', which truncate like printf.
+// so "%x" of an int64_t prints all 64 bits, where printf would need "%llx".
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+struct formatspec {
+    size_t litofs;      // the literal text before this conversion
+    size_t litlen;
+    int arg;            // the argument index, -1 for the trailing text and '%%'
+    char conv;
+    char length;        // 'H' for hh, 'h', or 0
+    bool left, zero, plus, space, alt;
+    int width;
+    int precision;      // -1 when not specified
+};
+
+// the result of parsing a format string
+template<size_t N>
+struct formatspecs {
+    formatspec item[N];
+    int nargs;
+    const char *error;
+};
+
+// the nr of items: conversions, '%%', and the trailing text
+constexpr size_t formatitemcount(const char *f)
+{
+    size_t n= 1;
+    for (size_t i=0 ; f[i] ; i++) {
+        if (f[i]!='%')
+            continue;
+        n++;
+        if (f[i+1]=='%')
+            i++;
+    }
+    return n;
+}
+
+constexpr bool isformatconv(char c)
+{
+    for (const char *p= "diuxXocspfFeEgG" ; *p ; p++)
+        if (*p==c)
+            return true;
+    return false;
+}
+
+template<size_t N>
+constexpr formatspecs<N> parseformat(const char *f)
+{
+    formatspecs<N> r{};
+    r.nargs= 0;
+    r.error= nullptr;
+    size_t n= 0;
+    size_t i= 0;
+    size_t lit= 0;
+    while (true) {
+        if (f[i]==0) {
+            r.item[n]= formatspec{lit, i-lit, -1, 0, 0, false, false, false, false, false, 0, -1};
+            break;
+        }
+        if (f[i]!='%') {
+            i++;
+            continue;
+        }
+        formatspec s{lit, i-lit, -1, 0, 0, false, false, false, false, false, 0, -1};
+        i++;
+        if (f[i]=='%') {
+            // the second '%' starts the next literal
+            r.item[n++]= s;
+            lit= i++;
+            continue;
+        }
+        for ( ; ; i++) {
+            if (f[i]=='-') s.left= true;
+            else if (f[i]=='0') s.zero= true;
+            else if (f[i]=='+') s.plus= true;
+            else if (f[i]==' ') s.space= true;
+            else if (f[i]=='#') s.alt= true;
+            else break;
+        }
+        while (f[i]>='0' && f[i]<='9')
+            s.width= s.width*10 + f[i++]-'0';
+        if (f[i]=='.') {
+            i++;
+            s.precision= 0;
+            while (f[i]>='0' && f[i]<='9')
+                s.precision= s.precision*10 + f[i++]-'0';
+        }
+        if (f[i]=='h' && f[i+1]=='h') { s.length= 'H'; i+=2; }
+        else if (f[i]=='h') { s.length= 'h'; i++; }
+        else if (f[i]=='l' && f[i+1]=='l') i+=2;
+        else if (f[i]=='l' || f[i]=='L' || f[i]=='z' || f[i]=='j' || f[i]=='t') i++;
+
+        if (!isformatconv(f[i])) {
+            r.error= f[i]=='*' ? "'*' widths are not supported" : "invalid conversion";
+            break;
+        }
+        s.conv= f[i++];
+        s.arg= r.nargs++;
+        r.item[n++]= s;
+        lit= i;
+    }
+    return r;
+}
+
+// S is a type from FMTSTR
+template<typename S>
+struct parsedformat {
+    static constexpr size_t N= formatitemcount(S::str());
+    static constexpr formatspecs<N> specs= parseformat<N>(S::str());
+};
+
+#define FMTSTR(s) ([]{ struct fmtstr_ { static constexpr const char *str() { return s; } }; return fmtstr_(); }())
+
+// the argument types accepted by each conversion
+template<typename A>
+constexpr bool isformatstringarg()
+{
+    typedef typename std::decay<A>::type T;
+    return std::is_same<T, const char*>::value || std::is_same<T, char*>::value
+        || std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value;
+}
+template<typename A>
+constexpr bool formatargmatches(char conv)
+{
+    typedef typename std::decay<A>::type T;
+    switch(conv) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            return std::is_integral<T>::value || std::is_enum<T>::value;
+        case 's':
+            return isformatstringarg<A>();
+        case 'p':
+            return std::is_pointer<T>::value || std::is_null_pointer<T>::value;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            return std::is_arithmetic<T>::value;
+    }
+    return false;
+}
+
+// appends to a std::string
+class formatstringsink {
+    std::string& _s;
+public:
+    formatstringsink(std::string& s) : _s(s) { }
+    void put(const char *p, size_t n) { _s.append(p, n); }
+    void fill(char c, size_t n) { _s.append(n, c); }
+};
+// writes to a fixed size buffer, counting everything that did not fit
+class formatbuffersink {
+    char *_p;
+    size_t _size;
+    size_t _len;
+public:
+    formatbuffersink(char *p, size_t size) : _p(p), _size(size), _len(0) { }
+    void put(const char *p, size_t n)
+    {
+        if (_len<_size)
+            memcpy(_p+_len, p, std::min(n, _size-_len));
+        _len += n;
+    }
+    void fill(char c, size_t n)
+    {
+        if (_len<_size)
+            memset(_p+_len, c, std::min(n, _size-_len));
+        _len += n;
+    }
+    size_t length() const { return _len; }
+};
+
+// pads 'text' to the width from the spec
+template<typename SINK>
+void formatpadded(SINK& out, const formatspec& f, const char *text, size_t n)
+{
+    size_t pad= size_t(f.width)>n ? f.width-n : 0;
+    if (pad && !f.left)
+        out.fill(' ', pad);
+    out.put(text, n);
+    if (pad && f.left)
+        out.fill(' ', pad);
+}
+
+template<typename SINK>
+void formatinteger(SINK& out, const formatspec& f, uint64_t v, bool negative)
+{
+    char buf[24];
+    char *end= buf+sizeof(buf);
+    char *p= end;
+    if (f.conv=='x' || f.conv=='X' || f.conv=='p') {
+        const char *digits= f.conv=='X' ? "0123456789ABCDEF" : "0123456789abcdef";
+        while (v) { *--p= digits[v&15]; v>>=4; }
+    }
+    else if (f.conv=='o') {
+        while (v) { *--p= char('0'+(v&7)); v>>=3; }
+    }
+    else {
+        static const char pairs[]=
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        while (v>=100) {
+            p -= 2;
+            memcpy(p, pairs+2*(v%100), 2);
+            v /= 100;
+        }
+        if (v>=10) {
+            p -= 2;
+            memcpy(p, pairs+2*v, 2);
+        }
+        else if (v)
+            *--p= char('0'+v);
+    }
+    size_t ndigits= end-p;
+    bool iszero= ndigits==0;
+    // printf prints "0" for zero, unless the precision is 0
+    if (iszero && f.precision!=0)
+        *--p= '0', ndigits= 1;
+
+    char prefix[2];
+    size_t nprefix= 0;
+    if (negative) prefix[nprefix++]= '-';
+    else if (f.plus && (f.conv=='d' || f.conv=='i')) prefix[nprefix++]= '+';
+    else if (f.space && (f.conv=='d' || f.conv=='i')) prefix[nprefix++]= ' ';
+    size_t nzeros= f.precision>0 && size_t(f.precision)>ndigits ? f.precision-ndigits : 0;
+    if (f.conv=='p' || (f.alt && !iszero && (f.conv=='x' || f.conv=='X'))) {
+        prefix[nprefix++]= '0';
+        prefix[nprefix++]= f.conv=='X' ? 'X' : 'x';
+    }
+    // '#o' makes sure the first digit is a '0'
+    else if (f.alt && f.conv=='o' && nzeros==0 && (p==end || *p!='0'))
+        prefix[nprefix++]= '0';
+
+    size_t total= nprefix+nzeros+ndigits;
+    size_t pad= size_t(f.width)>total ? f.width-total : 0;
+    // the '0' flag is ignored with '-' or a precision
+    if (f.zero && !f.left && f.precision<0)
+        nzeros += pad, pad= 0;
+
+    if (pad && !f.left)
+        out.fill(' ', pad);
+    out.put(prefix, nprefix);
+    if (nzeros)
+        out.fill('0', nzeros);
+    out.put(p, ndigits);
+    if (pad && f.left)
+        out.fill(' ', pad);
+}
+
+template<typename SINK>
+void formatchars(SINK& out, const formatspec& f, const char *s, size_t n)
+{
+    if (f.precision>=0 && size_t(f.precision)<n)
+        n= f.precision;
+    formatpadded(out, f, s, n);
+}
+
+template<typename SINK>
+void formatdouble(SINK& out, const formatspec& f, double v)
+{
+    // rebuild the spec for snprintf
+    char spec[32];
+    char *q= spec;
+    *q++ = '%';
+    if (f.left) *q++ = '-';
+    if (f.zero) *q++ = '0';
+    if (f.plus) *q++ = '+';
+    if (f.space) *q++ = ' ';
+    if (f.alt) *q++ = '#';
+    *q++ = '*';
+    *q++ = '.';
+    *q++ = '*';
+    *q++ = f.conv;
+    *q= 0;
+    int precision= f.precision<0 ? 6 : f.precision;
+
+    char buf[64];
+    int n= snprintf(buf, sizeof(buf), spec, f.width, precision, v);
+    if (n<0)
+        return;
+    if (size_t(n)<sizeof(buf)) {
+        out.put(buf, n);
+        return;
+    }
+    std::string big(n+1, 0);
+    snprintf(&big[0], big.size(), spec, f.width, precision, v);
+    out.put(big.data(), n);
+}
+
+// like glibc
+template<typename SINK>
+void formatpointer(SINK& out, const formatspec& f, const volatile void *p)
+{
+    if (p)
+        formatinteger(out, f, uint64_t(uintptr_t(p)), false);
+    else
+        formatpadded(out, f, "(nil)", 5);
+}
+
+template<typename SINK>
+void formatcstring(SINK& out, const formatspec& f, const char *s)
+{
+    if (f.conv=='p')
+        formatpointer(out, f, s);
+    else if (s)
+        formatchars(out, f, s, strlen(s));
+    else
+        formatchars(out, f, "(null)", 6);
+}
+template<typename SINK, typename A>
+void formatarg(SINK& out, const formatspec& f, const A& a)
+{
+    typedef typename std::decay<A>::type T;
+    if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+        if (f.conv=='f' || f.conv=='F' || f.conv=='e' || f.conv=='E' || f.conv=='g' || f.conv=='G') {
+            if constexpr (std::is_integral<T>::value)
+                formatdouble(out, f, double(a));
+            return;
+        }
+        typedef typename std::conditional<std::is_enum<T>::value, std::underlying_type<T>, std::common_type<T>>::type::type I;
+        // like the integer promotions for printf's varargs
+        typedef decltype(+I()) P;
+        P v= P(a);
+        if (f.conv=='c') {
+            char c= char(v);
+            formatpadded(out, f, &c, 1);
+        }
+        else if (f.conv=='d' || f.conv=='i') {
+            typedef typename std::make_signed<P>::type SP;
+            int64_t s= f.length=='H' ? int64_t((signed char)v) : f.length=='h' ? int64_t(short(v)) : int64_t(SP(v));
+            formatinteger(out, f, s<0 ? uint64_t(0)-uint64_t(s) : uint64_t(s), s<0);
+        }
+        else {
+            typedef typename std::make_unsigned<P>::type UP;
+            uint64_t u= f.length=='H' ? uint64_t((unsigned char)v) : f.length=='h' ? uint64_t((unsigned short)v) : uint64_t(UP(v));
+            formatinteger(out, f, u, false);
+        }
+    }
+    else if constexpr (std::is_floating_point<T>::value) {
+        formatdouble(out, f, double(a));
+    }
+    else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value) {
+        formatchars(out, f, a.data(), a.size());
+    }
+    else if constexpr (std::is_same<T, const char*>::value || std::is_same<T, char*>::value) {
+        formatcstring(out, f, a);
+    }
+    else if constexpr (std::is_pointer<T>::value || std::is_null_pointer<T>::value) {
+        formatpointer(out, f, a);
+    }
+}
+
+template<typename S, size_t I, typename SINK, typename TUPLE>
+void formatitem(SINK& out, const TUPLE& args)
+{
+    constexpr formatspec f= parsedformat<S>::specs.item[I];
+    out.put(S::str()+f.litofs, f.litlen);
+    if constexpr (f.arg>=0) {
+        typedef typename std::tuple_element<f.arg, TUPLE>::type A;
+        static_assert(formatargmatches<A>(f.conv), "format conversion does not match the argument type");
+        formatarg(out, f, std::get<f.arg>(args));
+    }
+}
+template<typename S, typename SINK, typename TUPLE, size_t...I>
+void formatitems(SINK& out, const TUPLE& args, std::index_sequence<I...>)
+{
+    (formatitem<S, I>(out, args), ...);
+}
+
+template<typename SINK, typename S, typename...A>
+void formatto(SINK& out, S, const A&...args)
+{
+    typedef parsedformat<S> F;
+    static_assert(F::specs.error==nullptr, "invalid format string");
+    static_assert(F::specs.nargs==sizeof...(A), "the nr of arguments does not match the format string");
+    formatitems<S>(out, std::forward_as_tuple(args...), std::make_index_sequence<F::N>());
+}
+
+// appends to 'str'
+template<typename S, typename...A>
+void appendformat(std::string& str, S fmt, const A&...args)
+{
+    formatstringsink out(str);
+    formatto(out, fmt, args...);
+}
+template<typename S, typename...A>
+std::string formatstring(S fmt, const A&...args)
+{
+    std::string str;
+    appendformat(str, fmt, args...);
+    return str;
+}
+// like snprintf: always terminates the string when size>0,
+// and returns the length the result would have without truncation.
+template<typename S, typename...A>
+size_t formatbuffer(char *buf, size_t size, S fmt, const A&...args)
+{
+    formatbuffersink out(buf, size ? size-1 : 0);
+    formatto(out, fmt, args...);
+    if (size)
+        buf[std::min(out.length(), size-1)]= 0;
+    return out.length();
+}
+#endif
@@ -0,0 +1,279 @@
+#ifndef __UTIL_HEXCODEC_H__
+#define __UTIL_HEXCODEC_H__
+// converting between bytes and lowercase hex, in caller provided buffers.
+//
+//   hexcodec::encode(data, n, out);             // writes 2*n chars
+//   size_t n= hexcodec::decode(first, last, out, outlast);
+//   size_t bad= hexcodec::validate(p, n);       // offset of the first non hex char
+//
+// decode works like the hex2binary template from stringutils: chars which are
+// not hex digits are skipped, so "12 34:56" decodes to 3 bytes.
+//
+// on x86 the bulk is converted 32 ( avx2 ) or 16 ( ssse3 ) bytes at a time,
+// the simd code is compiled with target attributes, so no special compiler flags
+// are needed. define _NO_HEXSIMD to leave out the simd code.
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(_NO_HEXSIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define _HAVE_HEXSIMD
+#include <immintrin.h>
+
+#define HEXCODEC_SSE __attribute__((target("ssse3")))
+#define HEXCODEC_AVX2 __attribute__((target("avx2")))
+
+struct hexssse3 {
+    enum { BYTES= 16 };
+    // 16 bytes to 32 chars
+    HEXCODEC_SSE static void encode(const uint8_t *p, char *out)
+    {
+        const __m128i digits= _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+        __m128i v= _mm_loadu_si128((const __m128i*)p);
+        __m128i hi= _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f)));
+        __m128i lo= _mm_shuffle_epi8(digits, _mm_and_si128(v, _mm_set1_epi8(0x0f)));
+        _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(out+16), _mm_unpackhi_epi8(hi, lo));
+    }
+    // 16 chars to their nyble values, 'ok' is cleared when one is not a hex digit
+    HEXCODEC_SSE static __m128i nybles(const char *p, bool& ok)
+    {
+        __m128i c= _mm_loadu_si128((const __m128i*)p);
+        __m128i d= _mm_sub_epi8(c, _mm_set1_epi8('0'));
+        __m128i l= _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i isdigit= _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+        __m128i isletter= _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+        ok= ok && _mm_movemask_epi8(_mm_or_si128(isdigit, isletter))==0xffff;
+        return _mm_or_si128(_mm_and_si128(isdigit, d), _mm_and_si128(isletter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    }
+    // 32 chars to 16 bytes, returns false, without writing, when not all are hex digits.
+    HEXCODEC_SSE static bool decode(const char *p, uint8_t *out)
+    {
+        bool ok= true;
+        __m128i a= nybles(p, ok);
+        __m128i b= nybles(p+16, ok);
+        if (!ok)
+            return false;
+        // hi*16+lo for each pair
+        const __m128i mul= _mm_set1_epi16(0x0110);
+        _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(_mm_maddubs_epi16(a, mul), _mm_maddubs_epi16(b, mul)));
+        return true;
+    }
+};
+struct hexavx2 {
+    enum { BYTES= 32 };
+    HEXCODEC_AVX2 static void encode(const uint8_t *p, char *out)
+    {
+        const __m256i digits= _mm256_setr_epi8('0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f',
+                                               '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+        __m256i v= _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi= _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f)));
+        __m256i lo= _mm256_shuffle_epi8(digits, _mm256_and_si256(v, _mm256_set1_epi8(0x0f)));
+        // unpack works per 128 bit lane
+        __m256i a= _mm256_unpacklo_epi8(hi, lo);
+        __m256i b= _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)out, _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(out+32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    HEXCODEC_AVX2 static __m256i nybles(const char *p, bool& ok)
+    {
+        __m256i c= _mm256_loadu_si256((const __m256i*)p);
+        __m256i d= _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+        __m256i l= _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        __m256i isdigit= _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+        __m256i isletter= _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+        ok= ok && _mm256_movemask_epi8(_mm256_or_si256(isdigit, isletter))==-1;
+        return _mm256_or_si256(_mm256_and_si256(isdigit, d), _mm256_and_si256(isletter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+    }
+    // 64 chars to 32 bytes
+    HEXCODEC_AVX2 static bool decode(const char *p, uint8_t *out)
+    {
+        bool ok= true;
+        __m256i a= nybles(p, ok);
+        __m256i b= nybles(p+32, ok);
+        if (!ok)
+            return false;
+        const __m256i mul= _mm256_set1_epi16(0x0110);
+        // pack works per 128 bit lane, so the 64 bit quarters come out in the order 0,2,1,3
+        __m256i r= _mm256_packus_epi16(_mm256_maddubs_epi16(a, mul), _mm256_maddubs_epi16(b, mul));
+        _mm256_storeu_si256((__m256i*)out, _mm256_permute4x64_epi64(r, 0xd8));
+        return true;
+    }
+};
+
+// V is one of the traits above, its functions only take pointers, so this is correct
+// without inlining. the wrappers below flatten it into a function with the right target attribute.
+template<typename V>
+struct hexblocks {
+    static size_t encode(const uint8_t *p, size_t n, char *out)
+    {
+        size_t i= 0;
+        for ( ; i+V::BYTES<=n ; i += V::BYTES)
+            V::encode(p+i, out+2*i);
+        return i;
+    }
+    // decodes blocks of only hex digits, returns the nr of chars used, or stops at a block with other chars.
+    static size_t decode(const char *p, size_t n, uint8_t *out, size_t outsize)
+    {
+        size_t i= 0;
+        for ( ; i+2*V::BYTES<=n && i/2+V::BYTES<=outsize ; i += 2*V::BYTES)
+            if (!V::decode(p+i, out+i/2))
+                break;
+        return i;
+    }
+};
+struct hexsimd {
+    HEXCODEC_SSE __attribute__((flatten))
+    static size_t encodessse3(const uint8_t *p, size_t n, char *out)
+    {
+        return hexblocks<hexssse3>::encode(p, n, out);
+    }
+    HEXCODEC_AVX2 __attribute__((flatten))
+    static size_t encodeavx2(const uint8_t *p, size_t n, char *out)
+    {
+        return hexblocks<hexavx2>::encode(p, n, out);
+    }
+    HEXCODEC_SSE __attribute__((flatten))
+    static size_t decodessse3(const char *p, size_t n, uint8_t *out, size_t outsize)
+    {
+        return hexblocks<hexssse3>::decode(p, n, out, outsize);
+    }
+    HEXCODEC_AVX2 __attribute__((flatten))
+    static size_t decodeavx2(const char *p, size_t n, uint8_t *out, size_t outsize)
+    {
+        return hexblocks<hexavx2>::decode(p, n, out, outsize);
+    }
+    static int detect()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return 32;
+        if (__builtin_cpu_supports("ssse3"))
+            return 16;
+        return 0;
+    }
+    // the nr of bytes per step, 0 when the cpu has no usable simd support
+    static int level()
+    {
+        static const int n= detect();
+        return n;
+    }
+    static size_t encode(const uint8_t *p, size_t n, char *out)
+    {
+        if (level()==32)
+            return encodeavx2(p, n, out);
+        if (level()==16)
+            return encodessse3(p, n, out);
+        return 0;
+    }
+    static size_t decode(const char *p, size_t n, uint8_t *out, size_t outsize)
+    {
+        if (level()==32)
+            return decodeavx2(p, n, out, outsize);
+        if (level()==16)
+            return decodessse3(p, n, out, outsize);
+        return 0;
+    }
+};
+#undef HEXCODEC_SSE
+#undef HEXCODEC_AVX2
+#endif
+
+struct hexcodec {
+    // "000102...feff"
+    static const char *bytechars()
+    {
+        static const struct table {
+            char c[512];
+            table()
+            {
+                for (int i=0 ; i<256 ; i++) {
+                    c[2*i]= "0123456789abcdef"[i>>4];
+                    c[2*i+1]= "0123456789abcdef"[i&15];
+                }
+            }
+        } t;
+        return t.c;
+    }
+    // 0-15 for hex digits, -1 otherwise
+    static const int8_t *nybles()
+    {
+        static const struct table {
+            int8_t v[256];
+            table()
+            {
+                memset(v, -1, sizeof(v));
+                for (int i=0 ; i<10 ; i++)
+                    v['0'+i]= i;
+                for (int i=0 ; i<6 ; i++)
+                    v['a'+i]= v['A'+i]= 10+i;
+            }
+        } t;
+        return t.v;
+    }
+
+    // writes 2*n chars to 'out'
+    static void encode(const uint8_t *p, size_t n, char *out)
+    {
+        size_t i= 0;
+#ifdef _HAVE_HEXSIMD
+        i= hexsimd::encode(p, n, out);
+#endif
+        const char *t= bytechars();
+        for ( ; i<n ; i++)
+            memcpy(out+2*i, t+2*p[i], 2);
+    }
+    // decodes pairs of hex digits, skipping other chars, until either the input or 'out' is exhausted.
+    // returns the nr of bytes written.
+    static size_t decode(const char *first, const char *last, uint8_t *out, uint8_t *outlast)
+    {
+        const int8_t *values= nybles();
+        const char *p= first;
+        uint8_t *o= out;
+        int pending= -1;    // the high nyble
+        while (p<last && o<outlast) {
+#ifdef _HAVE_HEXSIMD
+            if (pending<0) {
+                size_t i= hexsimd::decode(p, last-p, o, outlast-o);
+                p += i;
+                o += i/2;
+            }
+#endif
+            // continue with the scalar code up to the end of a block with other chars
+            const char *blockend= last-p>64 ? p+64 : last;
+            while (p<blockend && o<outlast) {
+                int n= values[uint8_t(*p++)];
+                if (n<0)
+                    continue;
+                if (pending<0)
+                    pending= n;
+                else {
+                    *o++ = (pending<<4) | n;
+                    pending= -1;
+                }
+            }
+        }
+        return o-out;
+    }
+    // the offset of the first char which is not a hex digit, or 'n'
+    static size_t validate(const char *p, size_t n)
+    {
+        size_t i= 0;
+#ifdef _HAVE_HEXSIMD
+        // decode to a scratch buffer, which is only used for the validation.
+        uint8_t scratch[512];
+        while (n-i>=64) {
+            size_t want= n-i<2*sizeof(scratch) ? n-i : 2*sizeof(scratch);
+            want -= want%64;
+            size_t k= hexsimd::decode(p+i, want, scratch, sizeof(scratch));
+            i += k;
+            if (k<want)
+                break;
+        }
+#endif
+        const int8_t *values= nybles();
+        while (i<n && values[uint8_t(p[i])]>=0)
+            i++;
+        return i;
+    }
+};
+#endif
@@ -1,6 +1,7 @@
 #ifndef __LOGMSG_H__
 #define __LOGMSG_H__
 #include "stringutils.h"
+#include "util/ctformat.h"
 
 #ifdef _UNIX
 #include <sys/time.h>
@@ -22,14 +23,14 @@ inline std::string logstamp()
     GetLocalTime(&now);
     DWORD tNow= GetTickCount();
 
-    return stringformat("[%08lx:%08lx] %02d:%02d:%02d @%08lx", GetCurrentProcessId(), GetCurrentThreadId(),
+    return formatstring(FMTSTR("[%08lx:%08lx] %02d:%02d:%02d @%08lx"), GetCurrentProcessId(), GetCurrentThreadId(),
             now.wHour, now.wMinute, now.wSecond, tNow);
 #endif
 #ifdef _UNIX
     struct timeval tv;
     gettimeofday(&tv, 0);
     struct tm tmlocal= *localtime(&tv.tv_sec);
-    return stringformat("%02d:%02d:%02d.%06d", tmlocal.tm_hour, tmlocal.tm_min, tmlocal.tm_sec, tv.tv_usec);
+    return formatstring(FMTSTR("%02d:%02d:%02d.%06d"), tmlocal.tm_hour, tmlocal.tm_min, tmlocal.tm_sec, tv.tv_usec);
 #endif
     return "?";
 }
@@ -18,6 +18,7 @@ class queuebuf {
 public:
 
     typedef T value_type;
+    typedef typename circularbuffer<T>::span span;
 
     queuebuf(size_t size, const char*name) : _buf(size,name), _stopped(false), _nwrites(0), _nreads(0)
     {
@@ -142,6 +143,48 @@ public:
     {
         write(&vec[0], vec.size());
     }
+
+    // zero-copy interface, see circularbuffer::readspans.
+    // these do not block, and are only safe with a single reader and a single writer:
+    // the spans returned to the reader are not touched by the writer, and the
+    // other way around, until they are committed.
+    int readspans(span *s)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_stopped)
+            throw queueerror("stopped");
+        return _buf.readspans(s);
+    }
+    void commitread(size_t size)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_stopped)
+            throw queueerror("stopped");
+        _buf.commitread(size);
+        _nreads += size;
+
+        lock.unlock();
+        _condwr.notify_one();
+    }
+    int writespans(span *s)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_stopped)
+            throw queueerror("stopped");
+        return _buf.writespans(s);
+    }
+    void commitwrite(size_t size)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_stopped)
+            throw queueerror("stopped");
+        _buf.commitwrite(size);
+        _nwrites += size;
+
+        lock.unlock();
+        _condrd.notify_one();
+    }
+
     void stop()
     {
         if (_stopped)
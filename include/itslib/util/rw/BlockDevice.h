@@ -21,7 +21,10 @@
 #ifdef _WIN32
 #include <io.h>
 #endif
+#include <memory>
+#include "util/blockcache.h"
 
+// reads go through a blockcache, optionally with O_DIRECT, bypassing the os page cache.
 class BlockDevice : public ReadWriter {
     int _f;
     std::string _filename;
@@ -29,8 +32,8 @@ class BlockDevice : public ReadWriter {
     uint32_t _bksize;
     uint64_t _curpos;
 
-    uint64_t _bufferpos;
-    std::vector<uint8_t> _buffer;
+    blockcache::options _cacheopt;
+    std::unique_ptr<blockcache> _cache;
 public:
     struct filemode_t {  };
     struct readonly_t : filemode_t { };
@@ -42,19 +45,19 @@ public:
     enum { O_BINARY=0 };
 #endif
 
-    BlockDevice(const std::string& filename, readwrite_t)
-        : _filename(filename)
+    BlockDevice(const std::string& filename, readwrite_t, const blockcache::options& opt= blockcache::options())
+        : _filename(filename), _cacheopt(opt)
     {
-        _f= open(_filename.c_str(), O_RDWR|O_BINARY);
+        _f= open(_filename.c_str(), O_RDWR|O_BINARY|directflag());
         if (_f==-1)
             throw posixerror(std::string("opening ")+_filename);
         initdev();
     }
-    BlockDevice(const std::string& filename, readonly_t)
-        : _filename(filename)
+    BlockDevice(const std::string& filename, readonly_t, const blockcache::options& opt= blockcache::options())
+        : _filename(filename), _cacheopt(opt)
     {
         setreadonly();
-        _f= open(_filename.c_str(), O_RDONLY|O_BINARY);
+        _f= open(_filename.c_str(), O_RDONLY|O_BINARY|directflag());
         if (_f==-1)
             throw posixerror(std::string("opening ")+_filename);
         initdev();
@@ -77,7 +80,34 @@ public:
 #endif
 
         _curpos= 0;
-        _bufferpos= 0;
+
+        // cache blocks must be whole device blocks, and O_DIRECT needs sector aligned buffers
+        _cacheopt.alignment= std::max(_cacheopt.alignment, size_t(_bksize));
+        _cacheopt.blocksize= (std::max(_cacheopt.blocksize, size_t(1))+_cacheopt.alignment-1)/_cacheopt.alignment*_cacheopt.alignment;
+        _cache.reset(new blockcache([this](uint64_t ofs, uint8_t *p, size_t n) { return loadblocks(ofs, p, n); }, _bkcount*_bksize, _cacheopt));
+    }
+    int directflag() const
+    {
+#ifdef O_DIRECT
+        if (_cacheopt.direct)
+            return O_DIRECT;
+#endif
+        return 0;
+    }
+    size_t loadblocks(uint64_t ofs, uint8_t *p, size_t n)
+    {
+        if (-1==lseek(_f, ofs, SEEK_SET))
+            throw posixerror("fseek");
+        size_t total= 0;
+        while (total<n) {
+            size_t r= ::read(_f, p+total, n-total);
+            if (r==size_t(-1))
+                throw posixerror("read");
+            if (r==0)
+                break;
+            total += r;
+        }
+        return total;
     }
 
     virtual ~BlockDevice()
@@ -87,37 +117,9 @@ public:
     }
     virtual size_t read(uint8_t *p, size_t n)
     {
-        size_t total= 0;
-        while (n) {
-            if (_curpos>=_bufferpos && _curpos<_bufferpos+_buffer.size()) {
-                size_t want= std::min(n, size_t(_buffer.size()-(_curpos-_bufferpos)));
-
-                if (want) {
-                    std::copy(&_buffer[_curpos-_bufferpos], &_buffer[_curpos-_bufferpos+want], p);
-                    n -= want;
-                    p += want;
-                    _curpos += want;
-                    total += want;
-                }
-            }
-            if (n) {
-                _bufferpos= _curpos&~uint64_t(_bksize-1);
-                if (-1==lseek(_f, _bufferpos, SEEK_SET))
-                    throw posixerror("fseek");
-
-                size_t bufwant= std::min(uint64_t(_bksize)*16384, _bkcount*_bksize-_bufferpos);
-                _buffer.resize(bufwant);
-                if (bufwant==0)
-                    return total;
-                size_t r= ::read(_f, &_buffer[0], _buffer.size());
-                if (r==size_t(-1))
-                    throw posixerror("read");
-                _buffer.resize(r);
-                if (r==0)
-                    return total;
-            }
-        }
-        return total;
+        size_t r= _cache->read(_curpos, p, n);
+        _curpos += r;
+        return r;
     }
     virtual void write(const uint8_t *p, size_t n)
     {
@@ -154,6 +156,7 @@ public:
     {
         throw "bloockdev settime not supported";
     }
+    const blockcache::statistics& cachestats() const { return _cache->stats(); }
 };
 
 #ifdef _MSC_VER
@@ -0,0 +1,62 @@
+#ifndef _UTIL_RW_CACHEDREADER_H__
+#define _UTIL_RW_CACHEDREADER_H__
+#include "util/ReadWriter.h"
+#include "util/blockcache.h"
+
+// CachedReader puts a blockcache in front of another ReadWriter, like a FileReader.
+// useful for parsers which keep jumping between a few regions of a large file.
+//
+// writes are passed on directly, and update the cached blocks.
+// the underlying reader should not be used directly while it is wrapped.
+class CachedReader : public ReadWriter {
+    ReadWriter_ptr _r;
+    blockcache _cache;
+    uint64_t _pos;
+public:
+    CachedReader(ReadWriter_ptr r, const blockcache::options& opt= blockcache::options())
+        : _r(r), _cache([this](uint64_t ofs, uint8_t *p, size_t n) { _r->setpos(ofs); return _r->read(p, n); }, r->size(), opt), _pos(0)
+    {
+        if (_r->isreadonly())
+            setreadonly();
+    }
+    virtual ~CachedReader() { }
+
+    virtual size_t read(uint8_t *p, size_t n)
+    {
+        size_t r= _cache.read(_pos, p, n);
+        _pos += r;
+        return r;
+    }
+    virtual void write(const uint8_t *p, size_t n)
+    {
+        _r->setpos(_pos);
+        _r->write(p, n);
+        _cache.update(_pos, p, n);
+        _pos += n;
+    }
+    virtual void setpos(uint64_t off)
+    {
+        _pos= off;
+    }
+    virtual void truncate(uint64_t off)
+    {
+        _r->truncate(off);
+        _cache.setsize(off);
+    }
+    virtual uint64_t size()
+    {
+        return _cache.size();
+    }
+    virtual uint64_t getpos() const
+    {
+        return _pos;
+    }
+    virtual bool eof()
+    {
+        return _pos>=size();
+    }
+
+    const blockcache::statistics& cachestats() const { return _cache.stats(); }
+    void flushcache() { _cache.clear(); }
+};
+#endif
@@ -1,6 +1,8 @@
 #ifndef _UTIL_RW_COMPRESSEDREADER_H__
 #define _UTIL_RW_COMPRESSEDREADER_H__
+#include <string.h>
 #include <map>
+#include <algorithm>
 #include <zlib.h>
 class ZAllocator {
 private:
@@ -40,10 +42,32 @@ public:
 };
 
 
+// CompressedReader inflates a zlib or gzip stream from another ReadWriter.
+//
+// for random access, an index can be built with buildindex(): one pass over the
+// stream which records the inflate state every 'span' bytes of output, like zlib's
+// examples/zran.c: the compressed offset and bit offset of a deflate block
+// boundary, plus the preceding 32k of output, which is the dictionary needed
+// to continue inflating from there.
+// with an index setpos() restarts from the nearest checkpoint, and size() is known.
+// the index can be saved to, and loaded from a sidecar file.
+//
+// without an index, backward seeks restart from the start of the stream,
+// and size() builds the index.
 class CompressedReader : public ReadWriter {
+    enum { WINSIZE= 32768, CHUNK= 65536 };
+    struct checkpoint {
+        uint64_t out;       // uncompressed offset
+        uint64_t in;        // offset of the first compressed byte after the checkpoint
+        int bits;           // nr of bits of the byte before 'in', which are part of the next block
+        std::vector<uint8_t> window;
+    };
+
     ReadWriter_ptr _f;
     ZAllocator _za;
     z_stream _zs;
+    bool _gzipped;
+    uint64_t _startofs;     // of the compressed data in _f
 
     std::vector<uint8_t> _inbuf;
     std::vector<uint8_t> _outbuf;
@@ -51,21 +75,76 @@ class CompressedReader : public ReadWriter {
     uint64_t _curpos;
     bool _eof;
 
+    std::vector<checkpoint> _index;
+    uint64_t _span;
+    uint64_t _size;         // valid when the index was built
+
+    // (re)start inflating, either from the start of the stream or from a checkpoint
+    void initstream(const checkpoint *pt)
+    {
+        if (_zs.state)
+            inflateEnd(&_zs);
+        memset(&_zs, 0, sizeof(_zs));
+        _za.initstream(_zs);
+        int stat= inflateInit2(&_zs, pt ? -15 : 15+(_gzipped?16:0));
+        if (stat!=Z_OK)
+            throw "inflateinit error";
+
+        _outtail= 0;
+        _zs.avail_out= _outbuf.size();
+        _zs.next_out= &_outbuf.front();
+        _zs.avail_in= 0;
+        _eof= false;
+
+        if (pt==NULL) {
+            _f->setpos(_startofs);
+            _curpos= 0;
+            return;
+        }
+        _f->setpos(_startofs + pt->in - (pt->bits ? 1 : 0));
+        if (pt->bits) {
+            int c= _f->read8();
+            if (Z_OK!=inflatePrime(&_zs, pt->bits, c >> (8-pt->bits)))
+                throw "inflatePrime error";
+        }
+        if (!pt->window.empty() && Z_OK!=inflateSetDictionary(&_zs, &pt->window[0], pt->window.size()))
+            throw "inflateSetDictionary error";
+        _curpos= pt->out;
+    }
+    // returns the last checkpoint at or before 'off'
+    const checkpoint *findcheckpoint(uint64_t off) const
+    {
+        auto i= std::upper_bound(_index.begin(), _index.end(), off, [](uint64_t off, const checkpoint& pt) { return off < pt.out; });
+        if (i==_index.begin())
+            return NULL;
+        return &*(i-1);
+    }
+
+    void addcheckpoint(int bits, uint64_t in, uint64_t out, unsigned left, const uint8_t *window)
+    {
+        _index.emplace_back();
+        checkpoint& pt= _index.back();
+        pt.out= out;
+        pt.in= in;
+        pt.bits= bits;
+
+        // 'window' is circular, with the oldest data at WINSIZE-left
+        std::vector<uint8_t> w(window+WINSIZE-left, window+WINSIZE);
+        w.insert(w.end(), window, window+WINSIZE-left);
+        size_t len= std::min(out, uint64_t(WINSIZE));
+        pt.window.assign(w.end()-len, w.end());
+    }
+    bool haveindex() const { return !_index.empty(); }
 public:
     CompressedReader(ReadWriter_ptr f, bool gzipped= false)
-        : _f(f), _outtail(0), _curpos(0), _eof(false)
+        : _f(f), _gzipped(gzipped), _startofs(f->getpos()), _outtail(0), _curpos(0), _eof(false), _span(0), _size(0)
     {
         setreadonly();
 
         memset(&_zs, 0, sizeof(_zs));
-        _za.initstream(_zs);
-        int stat= inflateInit2(&_zs, 15+(gzipped?16:0));
-        if (stat!=Z_OK)
-            throw "inflateinit error";
-        _inbuf.resize(65536);
+        _inbuf.resize(CHUNK);
         _outbuf.resize(65536);
-        _zs.avail_out= 65536;
-        _zs.next_out= &_outbuf.front();
+        initstream(NULL);
     }
     virtual ~CompressedReader()
     {
@@ -79,60 +158,49 @@ public:
     {
         //printf("read(%d)  comp: in:%d, out:%d/%d.  @%llx\n", n, _inbuf.size(), _outbuf.size(), _outtail, _curpos);
         size_t totalread= 0;
-        size_t want= std::min(n, _outbuf.size()-_zs.avail_out-_outtail);
-        if (want) {
-            //printf("want1= %d\n", want);
-            if (p) {
-                memcpy(p, &_outbuf[_outtail], want);
-                p+= want;
+        while (true) {
+            size_t want= std::min(n, _outbuf.size()-_zs.avail_out-_outtail);
+            if (want) {
+                if (p) {
+                    memcpy(p, &_outbuf[_outtail], want);
+                    p+= want;
+                }
+                totalread+= want;
+                n-= want;
+                _outtail+= want;
             }
-            totalread+= want;
-            n-= want;
-            _outtail+= want;
-        }
-        if (n==0) {
-            _curpos += totalread;
-            return totalread;
-        }
-
-        // if no more inputdata -> read more
-        if (_zs.avail_in==0) {
-            _zs.avail_in= _f->read(&_inbuf[0], _inbuf.size());
-            _zs.next_in= &_inbuf[0];
+            if (n==0 || _eof)
+                break;
 
-            //printf("comp: read %d bytes\n", _inbuf.size(), hexdump(&_inbuf[0], std::min(size_t(64), _inbuf.size())).c_str());
-        }
-
-        if (_zs.avail_out==0) {
-            size_t remaining= _outbuf.size()-_zs.avail_out-_outtail;
-            if (remaining>0) {
-                memmove(&_outbuf[0], &_outbuf[_outtail], remaining);
+            // if no more inputdata -> read more
+            if (_zs.avail_in==0) {
+                _zs.avail_in= _f->read(&_inbuf[0], _inbuf.size());
+                _zs.next_in= &_inbuf[0];
+                if (_zs.avail_in==0) {
+                    _curpos += totalread;
+                    throw "CompressedReader: truncated stream";
+                }
             }
-            _zs.next_out= &_outbuf.front()+remaining;
-            _zs.avail_out= _outbuf.size()-remaining;
-            _outtail= 0;
-        }
 
-        int stati= inflate(&_zs, Z_SYNC_FLUSH);
-        if (stati!=Z_STREAM_END && stati!=Z_OK) {
-            _curpos += totalread;
-            throw "inflate error";
-        }
-        if (stati==Z_STREAM_END) {
-            //printf("comp: eof\n");
-            _eof= true;
-        }
+            if (_zs.avail_out==0) {
+                size_t remaining= _outbuf.size()-_zs.avail_out-_outtail;
+                if (remaining>0) {
+                    memmove(&_outbuf[0], &_outbuf[_outtail], remaining);
+                }
+                _zs.next_out= &_outbuf.front()+remaining;
+                _zs.avail_out= _outbuf.size()-remaining;
+                _outtail= 0;
+            }
 
-        size_t want2= std::min(n, _outbuf.size()-_zs.avail_out-_outtail);
-        if (want2) {
-            //printf("comp: want2= %d\n", want2);
-            if (p) {
-                memcpy(p, &_outbuf[_outtail], want2);
-                p+= want2;
+            int stati= inflate(&_zs, Z_SYNC_FLUSH);
+            if (stati!=Z_STREAM_END && stati!=Z_OK && stati!=Z_BUF_ERROR) {
+                _curpos += totalread;
+                throw "inflate error";
+            }
+            if (stati==Z_STREAM_END) {
+                //printf("comp: eof\n");
+                _eof= true;
             }
-            totalread+= want2;
-            n-= want2;
-            _outtail+= want2;
         }
         _curpos += totalread;
 
@@ -150,14 +218,20 @@ public:
 
     virtual void setpos(uint64_t off)
     {
-        if (off < _curpos)
-            throw "CompressedReader: backwards seeking not implemented.";
+        // restart from a checkpoint when going backwards, or when that skips a lot of inflating
+        if (off < _curpos || (haveindex() && off-_curpos > _span)) {
+            const checkpoint *pt= findcheckpoint(off);
+            if (off < _curpos || (pt && pt->out > _curpos))
+                initstream(pt);
+        }
         while (!eof() && off > _curpos)
             read(NULL, off-_curpos);
     }
     virtual uint64_t size()
     {
-        throw "CompressedReader: size not implemented";
+        if (!haveindex())
+            buildindex();
+        return _size;
     }
     virtual uint64_t getpos() const
     {
@@ -165,7 +239,123 @@ public:
     }
     virtual bool eof()
     {
-        return _eof && _outtail==_outbuf.size();
+        return _eof && _outtail==_outbuf.size()-_zs.avail_out;
+    }
+
+    // make a pass over the whole stream, recording a checkpoint every 'span' bytes.
+    void buildindex(uint64_t span= 1024*1024)
+    {
+        _index.clear();
+        _span= span;
+
+        ZAllocator za;
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        za.initstream(zs);
+        if (Z_OK!=inflateInit2(&zs, 15+(_gzipped?16:0)))
+            throw "inflateinit error";
+
+        std::vector<uint8_t> input(CHUNK);
+        std::vector<uint8_t> window(WINSIZE);
+        uint64_t totin= 0, totout= 0, last= 0;
+        int ret= Z_OK;
+        _f->setpos(_startofs);
+        try {
+            do {
+                zs.avail_in= _f->read(&input[0], input.size());
+                if (zs.avail_in==0)
+                    throw "CompressedReader: truncated stream";
+                zs.next_in= &input[0];
+                do {
+                    if (zs.avail_out==0) {
+                        zs.avail_out= WINSIZE;
+                        zs.next_out= &window[0];
+                    }
+                    totin += zs.avail_in;
+                    totout += zs.avail_out;
+                    ret= inflate(&zs, Z_BLOCK);
+                    totin -= zs.avail_in;
+                    totout -= zs.avail_out;
+                    if (ret==Z_NEED_DICT || ret==Z_MEM_ERROR || ret==Z_DATA_ERROR)
+                        throw "inflate error";
+                    if (ret==Z_STREAM_END)
+                        break;
+                    // bit 7: at the end of a block, bit 6: after the last block
+                    if ((zs.data_type & 128) && !(zs.data_type & 64) && (totout==0 || totout-last > span)) {
+                        addcheckpoint(zs.data_type & 7, totin, totout, zs.avail_out, &window[0]);
+                        last= totout;
+                    }
+                } while (zs.avail_in!=0);
+            } while (ret!=Z_STREAM_END);
+        }
+        catch(...) {
+            inflateEnd(&zs);
+            _index.clear();
+            throw;
+        }
+        inflateEnd(&zs);
+        _size= totout;
+
+        // continue reading where we were
+        uint64_t pos= _curpos;
+        initstream(findcheckpoint(pos));
+        setpos(pos);
+    }
+
+    // index format, all little endian:
+    //   "CZIX" version compressedsize size span npoints
+    //   npoints x { out in bits windowsize window }
+    void saveindex(ReadWriter_ptr w)
+    {
+        if (!haveindex())
+            buildindex();
+        w->write32le(0x58495a43);
+        w->write32le(1);
+        w->write64le(_f->size()-_startofs);
+        w->write64le(_size);
+        w->write64le(_span);
+        w->write32le(_index.size());
+        for (auto i= _index.begin() ; i!=_index.end() ; ++i) {
+            w->write64le(i->out);
+            w->write64le(i->in);
+            w->write8(i->bits);
+            w->write32le(i->window.size());
+            if (!i->window.empty())
+                w->write(&i->window[0], i->window.size());
+        }
+    }
+    // load an index saved with saveindex, throws when it does not match this stream.
+    void loadindex(ReadWriter_ptr r)
+    {
+        if (r->read32le()!=0x58495a43 || r->read32le()!=1)
+            throw "CompressedReader: not an index file";
+        if (r->read64le()!=_f->size()-_startofs)
+            throw "CompressedReader: index does not match";
+        uint64_t size= r->read64le();
+        uint64_t span= r->read64le();
+        uint32_t n= r->read32le();
+
+        // each checkpoint takes at least 21 bytes, check before allocating
+        uint64_t pos= r->getpos();
+        uint64_t fsize= r->size();
+        if (pos>fsize || n>(fsize-pos)/21)
+            throw "CompressedReader: truncated index";
+
+        std::vector<checkpoint> index(n);
+        for (auto i= index.begin() ; i!=index.end() ; ++i) {
+            i->out= r->read64le();
+            i->in= r->read64le();
+            i->bits= r->read8();
+            uint32_t wsize= r->read32le();
+            if (i->bits>7 || wsize>WINSIZE)
+                throw "CompressedReader: corrupt index";
+            i->window.resize(wsize);
+            if (wsize && wsize!=r->read(&i->window[0], wsize))
+                throw "CompressedReader: truncated index";
+        }
+        _index.swap(index);
+        _size= size;
+        _span= span;
     }
 };
 
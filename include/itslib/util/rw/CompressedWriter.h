@@ -0,0 +1,98 @@
+#ifndef _UTIL_RW_COMPRESSEDWRITER_H__
+#define _UTIL_RW_COMPRESSEDWRITER_H__
+#include <memory>
+#include <vector>
+#include "util/ReadWriter.h"
+#include "compress/compressor.h"
+
+// CompressedWriter passes everything written to it through a compressor,
+// like ZlibCompress or ParallelZlibCompress, and writes the result to another ReadWriter.
+//
+//   CompressedWriter w(std::make_shared<FileReader>("out.gz", FileReader::createnew),
+//                      std::make_shared<ParallelZlibCompress>(opt));
+//   w.write(data, size);
+//   w.finish();     // also done by the destructor
+//
+// positions and size are in uncompressed bytes. seeking is not possible.
+class CompressedWriter : public ReadWriter {
+    ReadWriter_ptr _w;
+    std::shared_ptr<compressor> _c;
+    std::vector<uint8_t> _outbuf;
+    uint64_t _curpos;
+    bool _finished;
+
+    void drain()
+    {
+        while (true) {
+            size_t n= _c->get(&_outbuf[0], _outbuf.size());
+            if (n==0)
+                break;
+            _w->write(&_outbuf[0], n);
+        }
+    }
+public:
+    CompressedWriter(ReadWriter_ptr w, std::shared_ptr<compressor> c)
+        : _w(w), _c(c), _outbuf(65536), _curpos(0), _finished(false)
+    {
+    }
+    virtual ~CompressedWriter()
+    {
+        try {
+            finish();
+        }
+        catch(...) {
+        }
+    }
+    // flush the compressor, no more data can be written after this.
+    void finish()
+    {
+        if (_finished)
+            return;
+        _finished= true;
+        _c->add(NULL, 0);
+        while (!_c->eof()) {
+            size_t n= _c->get(&_outbuf[0], _outbuf.size());
+            if (n)
+                _w->write(&_outbuf[0], n);
+        }
+    }
+
+    virtual size_t read(uint8_t * /*p*/, size_t /*n*/)
+    {
+        throw "CompressedWriter cannot read";
+    }
+    virtual void write(const uint8_t *p, size_t n)
+    {
+        if (_finished)
+            throw "CompressedWriter: write after finish";
+        while (n) {
+            size_t used= _c->add(p, n);
+            drain();
+            p += used;
+            n -= used;
+            _curpos += used;
+        }
+    }
+    virtual void setpos(uint64_t off)
+    {
+        if (off!=_curpos)
+            throw "CompressedWriter: seeking not possible";
+    }
+    virtual void truncate(uint64_t /*off*/)
+    {
+        throw "CompressedWriter: truncate not possible";
+    }
+    virtual uint64_t size()
+    {
+        return _curpos;
+    }
+    virtual uint64_t getpos() const
+    {
+        return _curpos;
+    }
+    virtual bool eof()
+    {
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,189 @@
+#ifndef _UTIL_RW_DECOMPRESSINGREADER_H__
+#define _UTIL_RW_DECOMPRESSINGREADER_H__
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "util/ReadWriter.h"
+#include "util/rw/CompressedReader.h"
+#include "compress/registry.h"
+
+// DecompressingReader reads a compressed stream from another ReadWriter,
+// using any decompressor from the compressorregistry.
+// the format is either named, or detected from the magic bytes at the current position of 'f'.
+//
+// only forward reading is efficient: backward seeks restart from the start of the stream,
+// and size() decompresses the whole stream once.
+//
+// open() picks the best reader for a stream: a CompressedReader for zlib and gzip,
+// which can build a seek index, a DecompressingReader for other formats.
+//
+//   #include "compress/zlib.h"
+//   #include "compress/zstd.h"
+//   ReadWriter_ptr r= DecompressingReader::open(std::make_shared<FileReader>("data.zst"));
+//
+class DecompressingReader : public ReadWriter {
+    // the nr of reads in a row which neither produce output nor hand over input,
+    // before the stream is considered truncated or corrupt
+    enum { MAXSTALLED= 16 };
+
+    ReadWriter_ptr _f;
+    uint64_t _startofs;
+    const compressorregistry::codec *_codec;
+    compressorregistry::decompressor_ptr _d;
+
+    // the decompressor keeps a pointer to the last buffer it accepted,
+    // so input is read alternately into two buffers.
+    std::vector<uint8_t> _inbuf[2];
+    int _next;              // the buffer to fill next
+    size_t _pending;        // nr of bytes in _inbuf[_next] which were not yet accepted
+    bool _inputdone;
+    std::vector<uint8_t> _skipbuf;
+
+    uint64_t _curpos;
+    uint64_t _size;         // valid when _sizeknown
+    bool _sizeknown;
+
+    static const compressorregistry::codec *detect(ReadWriter_ptr f)
+    {
+        uint64_t pos= f->getpos();
+        uint8_t hdr[compressorregistry::MAXMAGIC];
+        size_t n= f->read(hdr, sizeof(hdr));
+        f->setpos(pos);
+        return compressorregistry::detect(hdr, n);
+    }
+    void restart()
+    {
+        _f->setpos(_startofs);
+        _d= _codec->newdecompressor();
+        _next= 0;
+        _pending= 0;
+        _inputdone= false;
+        _curpos= 0;
+    }
+    // give the decompressor more input, returns true when it accepted some.
+    // at the end of the input the decompressor gets add(NULL, 0), so it can report truncation.
+    bool feed()
+    {
+        if (_pending==0 && !_inputdone) {
+            _pending= _f->read(&_inbuf[_next][0], _inbuf[_next].size());
+            if (_pending==0) {
+                _inputdone= true;
+                _d->add(NULL, 0);
+            }
+        }
+        if (_pending==0)
+            return false;
+        if (_d->add(&_inbuf[_next][0], _pending)==0)
+            return false;
+        _next ^= 1;
+        _pending= 0;
+        return true;
+    }
+    void init(const compressorregistry::codec *c)
+    {
+        if (c==NULL)
+            throw "DecompressingReader: unknown compression format";
+        _codec= c;
+        _inbuf[0].resize(65536);
+        _inbuf[1].resize(65536);
+        setreadonly();
+        restart();
+    }
+public:
+    DecompressingReader(ReadWriter_ptr f)
+        : _f(f), _startofs(f->getpos()), _codec(NULL), _sizeknown(false)
+    {
+        init(detect(f));
+    }
+    DecompressingReader(ReadWriter_ptr f, const std::string& codecname)
+        : _f(f), _startofs(f->getpos()), _codec(NULL), _sizeknown(false)
+    {
+        init(compressorregistry::find(codecname));
+    }
+    virtual ~DecompressingReader() { }
+
+    static ReadWriter_ptr open(ReadWriter_ptr f)
+    {
+        const compressorregistry::codec *c= detect(f);
+        if (c && c->name=="zlib")
+            return std::make_shared<CompressedReader>(f, false);
+        if (c && c->name=="gzip")
+            return std::make_shared<CompressedReader>(f, true);
+        if (c==NULL)
+            throw "DecompressingReader: unknown compression format";
+        return std::make_shared<DecompressingReader>(f, c->name);
+    }
+    const std::string& format() const { return _codec->name; }
+
+    virtual size_t read(uint8_t *p, size_t n)
+    {
+        size_t totalread= 0;
+        int stalled= 0;
+        while (n && !_d->eof()) {
+            uint8_t *dst= p;
+            size_t want= n;
+            if (p==NULL) {
+                if (_skipbuf.empty())
+                    _skipbuf.resize(65536);
+                dst= &_skipbuf[0];
+                want= std::min(n, _skipbuf.size());
+            }
+            size_t got= _d->get(dst, want);
+            if (got) {
+                if (p)
+                    p += got;
+                n -= got;
+                totalread += got;
+                stalled= 0;
+                continue;
+            }
+            if (_d->eof())
+                break;
+            // no output: either more input is needed, or the decompressor is still digesting its input
+            if (feed())
+                stalled= 0;
+            else if (++stalled>MAXSTALLED) {
+                _curpos += totalread;
+                throw "DecompressingReader: truncated stream";
+            }
+        }
+        _curpos += totalread;
+        return totalread;
+    }
+    virtual void write(const uint8_t *p, size_t n)
+    {
+        throw "DecompressingReader cannot write";
+    }
+    virtual void truncate(uint64_t off)
+    {
+        throw "DecompressingReader: truncate not implemented.";
+    }
+    virtual void setpos(uint64_t off)
+    {
+        if (off < _curpos)
+            restart();
+        while (!eof() && off > _curpos)
+            read(NULL, off-_curpos);
+    }
+    virtual uint64_t size()
+    {
+        if (!_sizeknown) {
+            uint64_t pos= _curpos;
+            while (!eof())
+                read(NULL, 1024*1024);
+            _size= _curpos;
+            _sizeknown= true;
+            setpos(pos);
+        }
+        return _size;
+    }
+    virtual uint64_t getpos() const
+    {
+        return _curpos;
+    }
+    virtual bool eof()
+    {
+        return _d->eof();
+    }
+};
+#endif
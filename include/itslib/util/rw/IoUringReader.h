@@ -0,0 +1,521 @@
+#ifndef _UTIL_RW_IOURINGREADER_H__
+#define _UTIL_RW_IOURINGREADER_H__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "err/posix.h"
+#include "vectorutils.h"
+#include "util/ReadWriter.h"
+#include "util/rw/FileReader.h"
+
+// IoUringReader is a linux only ReadWriter for reading large files or block devices,
+// which keeps many reads in flight.
+//
+// there are two ways to use it:
+//  - the normal ReadWriter interface: read() keeps 'readahead' blocks of 'blocksize'
+//    bytes in flight after the current position, so a sequential scan never waits
+//    for more than one block at a time.
+//  - read_async(ofs, len, cb): queue a read, the callback is called from poll() or wait(),
+//    on the calling thread.
+//
+// reads go through io_uring when the kernel allows it, otherwise through a small
+// pool of threads doing pread().
+// writes are synchronous pwrite() calls.
+
+// one read request, owned by IoUringReader
+struct asyncread {
+    uint64_t ofs;
+    uint8_t *buf;
+    size_t len;
+    ssize_t result;     // nr of bytes read, or -errno
+    struct iovec iov;
+    std::function<void(asyncread&)> done;
+};
+
+// interface to the two backends
+class asyncreadqueue {
+public:
+    virtual ~asyncreadqueue() { }
+    virtual const char*name() const= 0;
+    virtual size_t depth() const= 0;
+    virtual void submit(int fd, asyncread *r)= 0;
+    // returns a completed request, or NULL when 'block' is false and nothing completed yet.
+    virtual asyncread *complete(bool block)= 0;
+};
+
+// talks to the kernel directly with the io_uring syscalls, using the IORING_OP_READV
+// opcode, which is available since linux 5.1
+class uringqueue : public asyncreadqueue {
+    int _fd;
+    unsigned _entries;
+    unsigned _tosubmit;
+
+    void *_sqring;
+    size_t _sqsize;
+    void *_cqring;
+    size_t _cqsize;
+    io_uring_sqe *_sqes;
+    size_t _sqesize;
+
+    unsigned *_sqtail;
+    unsigned *_sqmask;
+    unsigned *_sqarray;
+    unsigned *_cqhead;
+    unsigned *_cqtail;
+    unsigned *_cqmask;
+    io_uring_cqe *_cqes;
+
+    static int setup(unsigned entries, io_uring_params *p)
+    {
+        return syscall(__NR_io_uring_setup, entries, p);
+    }
+    int enter(unsigned tosubmit, unsigned mincomplete, unsigned flags)
+    {
+        return syscall(__NR_io_uring_enter, _fd, tosubmit, mincomplete, flags, NULL, 0);
+    }
+    template<typename T>
+    static T *at(void *ring, unsigned ofs) { return reinterpret_cast<T*>(static_cast<uint8_t*>(ring)+ofs); }
+public:
+    // throws when io_uring is not available
+    uringqueue(unsigned entries)
+        : _fd(-1), _tosubmit(0), _sqring(MAP_FAILED), _cqring(MAP_FAILED), _sqes((io_uring_sqe*)MAP_FAILED)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        _fd= setup(entries, &p);
+        if (_fd==-1)
+            throw posixerror("io_uring_setup");
+        _entries= p.sq_entries;
+
+        _sqsize= p.sq_off.array + p.sq_entries*sizeof(unsigned);
+        _cqsize= p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            _sqsize= _cqsize= std::max(_sqsize, _cqsize);
+
+        _sqring= mmap(0, _sqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sqring==MAP_FAILED) {
+            close();
+            throw posixerror("mmap(sqring)");
+        }
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            _cqring= _sqring;
+        else {
+            _cqring= mmap(0, _cqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+            if (_cqring==MAP_FAILED) {
+                close();
+                throw posixerror("mmap(cqring)");
+            }
+        }
+        _sqesize= p.sq_entries*sizeof(io_uring_sqe);
+        _sqes= (io_uring_sqe*)mmap(0, _sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sqes==MAP_FAILED) {
+            close();
+            throw posixerror("mmap(sqes)");
+        }
+
+        _sqtail= at<unsigned>(_sqring, p.sq_off.tail);
+        _sqmask= at<unsigned>(_sqring, p.sq_off.ring_mask);
+        _sqarray= at<unsigned>(_sqring, p.sq_off.array);
+        _cqhead= at<unsigned>(_cqring, p.cq_off.head);
+        _cqtail= at<unsigned>(_cqring, p.cq_off.tail);
+        _cqmask= at<unsigned>(_cqring, p.cq_off.ring_mask);
+        _cqes= at<io_uring_cqe>(_cqring, p.cq_off.cqes);
+    }
+    virtual ~uringqueue()
+    {
+        close();
+    }
+    void close()
+    {
+        if (_sqes!=MAP_FAILED)
+            munmap(_sqes, _sqesize);
+        if (_cqring!=MAP_FAILED && _cqring!=_sqring)
+            munmap(_cqring, _cqsize);
+        if (_sqring!=MAP_FAILED)
+            munmap(_sqring, _sqsize);
+        if (_fd!=-1)
+            ::close(_fd);
+        _fd= -1;
+    }
+    virtual const char*name() const { return "io_uring"; }
+    virtual size_t depth() const { return _entries; }
+
+    // the caller must make sure no more than depth() requests are in flight.
+    // the request is passed to the kernel at the next complete() call.
+    virtual void submit(int fd, asyncread *r)
+    {
+        r->iov.iov_base= r->buf;
+        r->iov.iov_len= r->len;
+
+        unsigned tail= *_sqtail;
+        unsigned ix= tail & *_sqmask;
+        io_uring_sqe *sqe= &_sqes[ix];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode= IORING_OP_READV;
+        sqe->fd= fd;
+        sqe->off= r->ofs;
+        sqe->addr= (uint64_t)&r->iov;
+        sqe->len= 1;
+        sqe->user_data= (uint64_t)r;
+        _sqarray[ix]= ix;
+        __atomic_store_n(_sqtail, tail+1, __ATOMIC_RELEASE);
+        _tosubmit++;
+    }
+    virtual asyncread *complete(bool block)
+    {
+        while (true) {
+            unsigned head= *_cqhead;
+            if (head!=__atomic_load_n(_cqtail, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe *cqe= &_cqes[head & *_cqmask];
+                asyncread *r= (asyncread*)cqe->user_data;
+                r->result= cqe->res;
+                __atomic_store_n(_cqhead, head+1, __ATOMIC_RELEASE);
+                return r;
+            }
+            if (!block && _tosubmit==0)
+                return NULL;
+            int n= enter(_tosubmit, block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+            if (n==-1) {
+                if (errno==EINTR || errno==EAGAIN || errno==EBUSY)
+                    continue;
+                throw posixerror("io_uring_enter");
+            }
+            _tosubmit -= n;
+        }
+    }
+};
+
+// fallback for when io_uring is not available: a pool of threads doing pread
+class preadqueue : public asyncreadqueue {
+    struct job {
+        int fd;
+        asyncread *r;
+    };
+    std::vector<std::thread> _threads;
+    std::mutex _mtx;
+    std::condition_variable _condwork;
+    std::condition_variable _conddone;
+    std::deque<job> _work;
+    std::deque<asyncread*> _done;
+    size_t _depth;
+    bool _stopping;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (true) {
+            while (!_stopping && _work.empty())
+                _condwork.wait(lock);
+            if (_stopping)
+                return;
+            job j= _work.front();
+            _work.pop_front();
+            lock.unlock();
+
+            ssize_t n;
+            while ((n= ::pread(j.fd, j.r->buf, j.r->len, j.r->ofs))==-1 && errno==EINTR)
+                ;
+            j.r->result= n==-1 ? -errno : n;
+
+            lock.lock();
+            _done.push_back(j.r);
+            _conddone.notify_one();
+        }
+    }
+public:
+    preadqueue(unsigned nthreads, size_t depth)
+        : _depth(depth), _stopping(false)
+    {
+        for (unsigned i=0 ; i<nthreads ; i++)
+            _threads.emplace_back([this]() { worker(); });
+    }
+    virtual ~preadqueue()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stopping= true;
+        }
+        _condwork.notify_all();
+        for (auto i= _threads.begin() ; i!=_threads.end() ; ++i)
+            i->join();
+    }
+    virtual const char*name() const { return "pread"; }
+    virtual size_t depth() const { return _depth; }
+    virtual void submit(int fd, asyncread *r)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _work.push_back(job{fd, r});
+        lock.unlock();
+        _condwork.notify_one();
+    }
+    virtual asyncread *complete(bool block)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (block)
+            while (_done.empty())
+                _conddone.wait(lock);
+        if (_done.empty())
+            return NULL;
+        asyncread *r= _done.front();
+        _done.pop_front();
+        return r;
+    }
+};
+
+class IoUringReader : public ReadWriter {
+public:
+    // data points to the bytes read, n may be less than requested at the end of the file.
+    typedef std::function<void(uint64_t ofs, const uint8_t *data, size_t n)> readcallback;
+
+    enum iomode_t { AUTO, THREADPOOL };
+    struct options {
+        size_t blocksize;       // size of the readahead blocks
+        unsigned readahead;     // nr of blocks read ahead by read()
+        unsigned queuedepth;    // max nr of requests in flight
+        unsigned nthreads;      // for the pread fallback
+        iomode_t mode;
+        options() : blocksize(1024*1024), readahead(8), queuedepth(64), nthreads(8), mode(AUTO) { }
+    };
+private:
+    struct block {
+        uint64_t ofs;
+        ByteVector data;
+        size_t n;
+        bool done;
+    };
+    typedef std::shared_ptr<block> block_ptr;
+
+    std::string _filename;
+    int _fd;
+    options _opt;
+    std::unique_ptr<asyncreadqueue> _q;
+    size_t _inflight;
+    bool _closing;
+
+    uint64_t _pos;
+    uint64_t _size;
+    std::deque<block_ptr> _window;
+
+    void open(int flags)
+    {
+        _fd= ::open(_filename.c_str(), flags|O_CLOEXEC);
+        if (_fd==-1)
+            throw posixerror(std::string("opening ")+_filename);
+        _size= querysize();
+
+        if (_opt.mode==AUTO) {
+            try {
+                _q.reset(new uringqueue(_opt.queuedepth));
+            }
+            catch(posixerror&) {
+                // seccomp, old kernel, or disabled by sysctl
+            }
+        }
+        if (!_q)
+            _q.reset(new preadqueue(_opt.nthreads, _opt.queuedepth));
+    }
+    uint64_t querysize()
+    {
+        struct stat st;
+        if (-1==fstat(_fd, &st))
+            throw posixerror(std::string("statting ")+_filename);
+        if (S_ISREG(st.st_mode))
+            return st.st_size;
+        if (S_ISBLK(st.st_mode)) {
+            uint64_t devsize;
+            if (-1==ioctl(_fd, BLKGETSIZE64, &devsize))
+                throw posixerror("ioctl(BLKGETSIZE64)");
+            return devsize;
+        }
+        throw "not a file or blockdev";
+    }
+
+    void submit(asyncread *r)
+    {
+        while (_inflight>=_q->depth())
+            completeone(true);
+        _q->submit(_fd, r);
+        _inflight++;
+    }
+    // returns false when nothing was completed
+    bool completeone(bool block)
+    {
+        if (_inflight==0)
+            return false;
+        asyncread *r= _q->complete(block);
+        if (r==NULL)
+            return false;
+        _inflight--;
+        std::unique_ptr<asyncread> owner(r);
+        if (r->result<0) {
+            if (_closing)
+                return true;
+            errno= -r->result;
+            throw posixerror(std::string("reading ")+_filename);
+        }
+        if (r->done && !_closing)
+            r->done(*r);
+        return true;
+    }
+
+    // keep 'readahead' blocks in flight, starting at the block containing _pos
+    void prefetch()
+    {
+        while (!_window.empty() && _window.front()->ofs+_opt.blocksize <= _pos)
+            _window.pop_front();
+        if (!_window.empty() && _window.front()->ofs > _pos)
+            _window.clear();
+
+        uint64_t next= _window.empty() ? _pos - _pos%_opt.blocksize : _window.back()->ofs+_opt.blocksize;
+        while (_window.size()<_opt.readahead && next<_size) {
+            block_ptr b= std::make_shared<block>();
+            b->ofs= next;
+            b->data.resize(std::min(uint64_t(_opt.blocksize), _size-next));
+            b->n= 0;
+            b->done= false;
+
+            asyncread *r= new asyncread;
+            r->ofs= b->ofs;
+            r->buf= &b->data[0];
+            r->len= b->data.size();
+            // the block is kept alive by the request, even when it was dropped from the window
+            r->done= [b](asyncread& r) { b->n= r.result; b->done= true; };
+            submit(r);
+
+            _window.push_back(b);
+            next += _opt.blocksize;
+        }
+    }
+public:
+    IoUringReader(const std::string& filename, FileReader::readonly_t, const options& opt= options())
+        : _filename(filename), _fd(-1), _opt(opt), _inflight(0), _closing(false), _pos(0), _size(0)
+    {
+        setreadonly();
+        open(O_RDONLY);
+    }
+    IoUringReader(const std::string& filename, FileReader::readwrite_t, const options& opt= options())
+        : _filename(filename), _fd(-1), _opt(opt), _inflight(0), _closing(false), _pos(0), _size(0)
+    {
+        open(O_RDWR);
+    }
+    virtual ~IoUringReader()
+    {
+        // the kernel or the pool may still be writing into our buffers
+        _closing= true;
+        while (_inflight)
+            completeone(true);
+        _q.reset();
+        if (_fd!=-1)
+            ::close(_fd);
+    }
+    const char*backend() const { return _q->name(); }
+
+    // queue a read of 'len' bytes at 'ofs', 'cb' is called from poll() or wait().
+    // this blocks ( and calls callbacks ) when the queue is full.
+    void read_async(uint64_t ofs, size_t len, readcallback cb)
+    {
+        std::shared_ptr<ByteVector> buf= std::make_shared<ByteVector>(len);
+        asyncread *r= new asyncread;
+        r->ofs= ofs;
+        r->buf= buf->data();    // NULL for a zero length read
+        r->len= len;
+        r->done= [buf, cb](asyncread& r) { cb(r.ofs, buf->data(), r.result); };
+        submit(r);
+    }
+    // read into a caller owned buffer, which must stay valid until the callback was called.
+    void read_async(uint64_t ofs, uint8_t *p, size_t len, readcallback cb)
+    {
+        asyncread *r= new asyncread;
+        r->ofs= ofs;
+        r->buf= p;
+        r->len= len;
+        r->done= [cb](asyncread& r) { cb(r.ofs, r.buf, r.result); };
+        submit(r);
+    }
+    // call the callbacks of all completed reads, returns the nr completed.
+    size_t poll()
+    {
+        size_t n= 0;
+        while (completeone(false))
+            n++;
+        return n;
+    }
+    // wait for all outstanding reads, including readahead
+    void wait()
+    {
+        while (_inflight)
+            completeone(true);
+    }
+    size_t inflight() const { return _inflight; }
+
+    virtual size_t read(uint8_t *p, size_t n)
+    {
+        size_t total= 0;
+        while (n && _pos<_size) {
+            prefetch();
+            block_ptr b= _window.front();
+            while (!b->done)
+                completeone(true);
+
+            size_t bofs= _pos - b->ofs;
+            if (bofs>=b->n)
+                break;  // short read, file shrunk
+            size_t want= std::min(n, b->n-bofs);
+            memcpy(p, &b->data[bofs], want);
+            p += want;
+            n -= want;
+            total += want;
+            _pos += want;
+        }
+        return total;
+    }
+    virtual void write(const uint8_t *p, size_t n)
+    {
+        if (isreadonly())
+            throw "IoUringReader: write to readonly file";
+        _window.clear();
+        while (n) {
+            ssize_t r= ::pwrite(_fd, p, n, _pos);
+            if (r==-1) {
+                if (errno==EINTR)
+                    continue;
+                throw posixerror(std::string("writing ")+_filename);
+            }
+            p += r;
+            n -= r;
+            _pos += r;
+        }
+        _size= std::max(_size, _pos);
+    }
+    virtual void setpos(uint64_t off)
+    {
+        _pos= off;
+    }
+    virtual void truncate(uint64_t off)
+    {
+        _window.clear();
+        if (-1==ftruncate(_fd, off))
+            throw posixerror(std::string("truncating ")+_filename);
+        _size= off;
+    }
+    virtual uint64_t size() { return _size; }
+    virtual uint64_t getpos() const { return _pos; }
+    virtual bool eof() { return _pos>=_size; }
+};
+
+#endif
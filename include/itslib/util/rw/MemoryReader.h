@@ -73,6 +73,9 @@ public:
         return _size;
     }
 
+    // direct access to the whole buffer, valid until the next write, truncate or setbuf
+    const uint8_t *memory() const { return _mem; }
+
     void setgrowable() { _growable= true; }
     virtual void grow(size_t n)
     {
@@ -0,0 +1,209 @@
+#ifndef __UTIL_SPLITSTRINGVIEW_H__
+#define __UTIL_SPLITSTRINGVIEW_H__
+// splitting a line into tokens without allocating a std::string per token.
+//
+// the rules are the same as for SplitString from stringutils:
+//   - tokens are separated by one or more separator chars.
+//   - a "quoted" part may contain separators, a closing quote ends the token.
+//   - with bWithEscape, a backslash makes the next char literal.
+//   - false is returned for an unterminated quote or escape.
+//
+// tokens are passed as std::string_view. tokens without quotes or escapes point
+// into the input, others point into 'buffer', which is reserved to the input size,
+// so all views stay valid until the next split, or until the input changes.
+//
+//   std::string buf;
+//   std::vector<std::string_view> tokens;
+//   SplitStringView(line, tokens, buf);
+//
+//   stringsplitter split(",;", false);     // keeps the buffers and delimiter table
+//   split.split(line, [](std::string_view tok) { ... });
+//   if (split.split(line))
+//       for (auto tok : split.tokens()) ...
+//
+// the search for the next separator, quote or backslash is done 16 bytes at a time
+// with sse2, for up to 8 different chars.
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
+
+class splitdelimiters {
+    uint32_t _separators[8];    // 256 bit sets
+    uint32_t _specials[8];      // separators + quote + backslash
+    bool _withescape;
+    enum { MAXCHARS= 8 };
+    char _chars[MAXCHARS];      // the specials, for the simd search
+    int _nchars;                // more than MAXCHARS disables the simd search
+
+    static bool isin(const uint32_t *set, char c) { return (set[uint8_t(c)>>5]>>(c&31))&1; }
+    static void add(uint32_t *set, char c) { set[uint8_t(c)>>5] |= 1U<<(c&31); }
+    void addspecial(char c)
+    {
+        if (isin(_specials, c))
+            return;
+        add(_specials, c);
+        if (_nchars<MAXCHARS)
+            _chars[_nchars]= c;
+        _nchars++;
+    }
+public:
+    splitdelimiters(std::string_view separator= " \t", bool bWithEscape= true)
+        : _withescape(bWithEscape), _nchars(0)
+    {
+        memset(_separators, 0, sizeof(_separators));
+        memset(_specials, 0, sizeof(_specials));
+        for (char c : separator) {
+            add(_separators, c);
+            addspecial(c);
+        }
+        addspecial('"');
+        if (bWithEscape)
+            addspecial('\\');
+    }
+    bool isseparator(char c) const { return isin(_separators, c); }
+    bool isspecial(char c) const { return isin(_specials, c); }
+
+    // the first separator, quote or escape char in [p, end)
+    const char *findspecial(const char *p, const char *end) const
+    {
+#if defined(__SSE2__) && defined(__GNUC__)
+        if (_nchars<=MAXCHARS) {
+            __m128i c[MAXCHARS];
+            for (int i=0 ; i<_nchars ; i++)
+                c[i]= _mm_set1_epi8(_chars[i]);
+            for ( ; end-p>=16 ; p+=16) {
+                __m128i v= _mm_loadu_si128((const __m128i*)p);
+                __m128i m= _mm_cmpeq_epi8(v, c[0]);
+                for (int i=1 ; i<_nchars ; i++)
+                    m= _mm_or_si128(m, _mm_cmpeq_epi8(v, c[i]));
+                int bits= _mm_movemask_epi8(m);
+                if (bits)
+                    return p+__builtin_ctz(bits);
+            }
+        }
+#endif
+        while (p<end && !isspecial(*p))
+            p++;
+        return p;
+    }
+
+    // calls f(std::string_view) for each token
+    template<typename F>
+    bool split(std::string_view str, std::string& buffer, F f) const
+    {
+        buffer.clear();
+        buffer.reserve(str.size());
+
+        const char *p= str.data();
+        const char *end= p+str.size();
+        while (true) {
+            while (p<end && isseparator(*p))
+                p++;
+            if (p==end)
+                return true;
+
+            // the common case: a token without quotes or escapes
+            const char *tok= p;
+            p= findspecial(p, end);
+            if (p==end || isseparator(*p)) {
+                f(std::string_view(tok, p-tok));
+                continue;
+            }
+
+            // otherwise the token is unescaped into the buffer
+            size_t start= buffer.size();
+            buffer.append(tok, p-tok);
+            bool bQuoted= false;
+            bool bEscaped= false;
+            bool bClosed= false;
+            while (p<end && !bClosed) {
+                if (bEscaped) {
+                    buffer += *p++;
+                    bEscaped= false;
+                }
+                else if (bQuoted) {
+                    if (*p=='"') {
+                        bQuoted= false;
+                        bClosed= true;
+                        ++p;
+                    }
+                    else if (*p=='\\' && _withescape) {
+                        bEscaped= true;
+                        ++p;
+                    }
+                    else {
+                        const char *q= p+1;
+                        while (q<end && *q!='"' && *q!='\\')
+                            q++;
+                        buffer.append(p, q-p);
+                        p= q;
+                    }
+                }
+                else if (isseparator(*p)) {
+                    break;
+                }
+                else if (*p=='"') {
+                    bQuoted= true;
+                    ++p;
+                }
+                else if (*p=='\\' && _withescape) {
+                    bEscaped= true;
+                    ++p;
+                }
+                else {
+                    const char *q= findspecial(p+1, end);
+                    buffer.append(p, q-p);
+                    p= q;
+                }
+            }
+            // a closing quote always ends a token, also an empty one
+            if (bClosed || buffer.size()>start)
+                f(std::string_view(buffer.data()+start, buffer.size()-start));
+            if (bQuoted || bEscaped)
+                return false;
+        }
+    }
+};
+
+// splits into 'tokens', using 'buffer' for tokens which had to be unescaped.
+inline bool SplitStringView(std::string_view str, std::vector<std::string_view>& tokens, std::string& buffer, bool bWithEscape= true, std::string_view separator= " \t")
+{
+    tokens.clear();
+    return splitdelimiters(separator, bWithEscape).split(str, buffer, [&tokens](std::string_view tok) { tokens.push_back(tok); });
+}
+// calls f(std::string_view) for each token.
+template<typename F>
+bool SplitStringView(std::string_view str, F f, std::string& buffer, bool bWithEscape= true, std::string_view separator= " \t")
+{
+    return splitdelimiters(separator, bWithEscape).split(str, buffer, f);
+}
+
+// for splitting many lines with the same separators.
+class stringsplitter {
+    splitdelimiters _delims;
+    std::string _buffer;
+    std::vector<std::string_view> _tokens;
+public:
+    stringsplitter(std::string_view separator= " \t", bool bWithEscape= true)
+        : _delims(separator, bWithEscape)
+    {
+    }
+    template<typename F>
+    bool split(std::string_view str, F f)
+    {
+        return _delims.split(str, _buffer, f);
+    }
+    // splits into tokens()
+    bool split(std::string_view str)
+    {
+        _tokens.clear();
+        return _delims.split(str, _buffer, [this](std::string_view tok) { _tokens.push_back(tok); });
+    }
+    const std::vector<std::string_view>& tokens() const { return _tokens; }
+};
+#endif
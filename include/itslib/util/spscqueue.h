@@ -0,0 +1,288 @@
+#ifndef __SPSCQUEUE_H__
+#define __SPSCQUEUE_H__
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "util/queuebuf.h"  // for queueerror
+
+// spscqueue has the same read/write interface as queuebuf, but may only be used
+// with exactly one reader thread and one writer thread.
+//
+// in the common case no lock is taken: the writer publishes data by advancing _head,
+// the reader releases space by advancing _tail. each side keeps a private copy of
+// the other side's index, and only reloads the shared one when that copy says
+// the queue is full or empty.
+// the indices live on separate cache lines, so the two threads don't keep
+// stealing each other's line.
+//
+// only when a side has to wait, it sleeps on a futex ( or a condition variable
+// on non-linux systems ), the other side only makes a syscall when a waiter
+// is registered.
+template<class T>
+class spscqueue {
+    enum { CACHELINE= 64, SPINCOUNT= 100 };
+
+    // a place for one thread to sleep until the other side made progress.
+    struct waitpoint {
+        std::atomic<uint32_t> _seq;
+        std::atomic<bool> _waiting;
+#ifndef __linux__
+        std::mutex _mtx;
+        std::condition_variable _cond;
+#endif
+        waitpoint() : _seq(0), _waiting(false) { }
+
+        // called by the sleeping side, before checking its condition
+        uint32_t prepare()
+        {
+            _waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return _seq.load(std::memory_order_acquire);
+        }
+        // sleep until notify was called after 'prepare' returned 'seq'
+        void wait(uint32_t seq)
+        {
+#ifdef __linux__
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_seq), FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+            std::unique_lock<std::mutex> lock(_mtx);
+            while (_seq.load(std::memory_order_acquire)==seq)
+                _cond.wait(lock);
+#endif
+        }
+        void done()
+        {
+            _waiting.store(false, std::memory_order_relaxed);
+        }
+        // called by the other side, after it published its index
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!_waiting.load(std::memory_order_relaxed))
+                return;
+            wakeup();
+        }
+        void wakeup()
+        {
+#ifdef __linux__
+            _seq.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+            {
+                std::unique_lock<std::mutex> lock(_mtx);
+                _seq.fetch_add(1, std::memory_order_release);
+            }
+            _cond.notify_all();
+#endif
+        }
+    };
+public:
+    typedef T value_type;
+
+    spscqueue(size_t size, const char*name)
+        : _name(name), _buf(size), _stopped(false), _head(0), _tailcache(0), _nwrites(0), _tail(0), _headcache(0), _nreads(0)
+    {
+    }
+    ~spscqueue()
+    {
+        if (!_stopped)
+            logmsg("WARNING: queue %s not stopped\n", _name);
+        logmsg("queue-%s : write=%d, read=%d\t", _name, _nwrites, _nreads);
+    }
+
+    // interface for shared_ptr items
+    T read()
+    {
+        waitforread(1);
+        T data= _buf[_tail.load(std::memory_order_relaxed) % _buf.size()];
+        advancetail(1);
+        return data;
+    }
+    void read(T* data, size_t size)
+    {
+        waitforread(size);
+        copyout(data, size);
+        advancetail(size);
+    }
+    // used for reading a variable amount of data.
+    size_t read(T* data, size_t minsize, size_t maxsize)
+    {
+        size_t avail= waitforread(minsize);
+        size_t wantedsize= std::min(maxsize, avail);
+        copyout(data, wantedsize);
+        advancetail(wantedsize);
+        return wantedsize;
+    }
+    template<class V>
+    void readvec(V& vec, size_t size)
+    {
+        vec.resize(size);
+        read(&vec[0], vec.size());
+    }
+
+    // for reading the queue contents after it was stopped
+    template<class V>
+    void readbuf(V& vec)
+    {
+        vec.resize(usedsize());
+        copyout(&vec[0], vec.size());
+        advancetail(vec.size());
+    }
+
+    // interface for shared_ptr items
+    void write(T data)
+    {
+        waitforwrite(1);
+        _buf[_head.load(std::memory_order_relaxed) % _buf.size()]= data;
+        advancehead(1);
+    }
+    void write(const T* data, size_t size)
+    {
+        if (_buf.size()<size)
+            throw "spscqueue: datasize too large for buffer";
+        waitforwrite(size);
+        copyin(data, size);
+        advancehead(size);
+    }
+    void writeone(T v)
+    {
+        write(&v, 1);
+    }
+    template<class V>
+    void writevec(const V& vec)
+    {
+        write(&vec[0], vec.size());
+    }
+    void stop()
+    {
+        if (_stopped.exchange(true))
+            return;
+        _rdwait.wakeup();
+        _wrwait.wakeup();
+    }
+
+    size_t usedsize() const
+    {
+        uint64_t tail= _tail.load(std::memory_order_acquire);
+        return _head.load(std::memory_order_acquire) - tail;
+    }
+    size_t freesize() const { return _buf.size()-usedsize(); }
+    size_t maxsize() const { return _buf.size(); }
+private:
+    // returns the nr of items available, at least 'size'
+    size_t waitforread(size_t size)
+    {
+        uint64_t tail= _tail.load(std::memory_order_relaxed);
+        if (!_stopped.load(std::memory_order_relaxed) && _headcache-tail>=size)
+            return _headcache-tail;
+
+        for (int i=0 ; i<SPINCOUNT ; i++) {
+            if (_stopped.load(std::memory_order_acquire))
+                throw queueerror("stopped");
+            _headcache= _head.load(std::memory_order_acquire);
+            if (_headcache-tail>=size)
+                return _headcache-tail;
+            std::this_thread::yield();
+        }
+        while (true) {
+            uint32_t seq= _rdwait.prepare();
+            if (_stopped.load(std::memory_order_acquire)) {
+                _rdwait.done();
+                throw queueerror("stopped");
+            }
+            _headcache= _head.load(std::memory_order_acquire);
+            if (_headcache-tail>=size) {
+                _rdwait.done();
+                return _headcache-tail;
+            }
+            _rdwait.wait(seq);
+        }
+    }
+    void waitforwrite(size_t size)
+    {
+        uint64_t head= _head.load(std::memory_order_relaxed);
+        if (!_stopped.load(std::memory_order_relaxed) && _buf.size()-(head-_tailcache)>=size)
+            return;
+
+        for (int i=0 ; i<SPINCOUNT ; i++) {
+            if (_stopped.load(std::memory_order_acquire))
+                throw queueerror("stopped");
+            _tailcache= _tail.load(std::memory_order_acquire);
+            if (_buf.size()-(head-_tailcache)>=size)
+                return;
+            std::this_thread::yield();
+        }
+        while (true) {
+            uint32_t seq= _wrwait.prepare();
+            if (_stopped.load(std::memory_order_acquire)) {
+                _wrwait.done();
+                throw queueerror("stopped");
+            }
+            _tailcache= _tail.load(std::memory_order_acquire);
+            if (_buf.size()-(head-_tailcache)>=size) {
+                _wrwait.done();
+                return;
+            }
+            _wrwait.wait(seq);
+        }
+    }
+    void copyout(T* data, size_t size)
+    {
+        size_t ofs= _tail.load(std::memory_order_relaxed) % _buf.size();
+        size_t first= std::min(size, _buf.size()-ofs);
+        std::copy(&_buf[ofs], &_buf[ofs]+first, data);
+        std::copy(&_buf[0], &_buf[0]+(size-first), data+first);
+    }
+    void copyin(const T* data, size_t size)
+    {
+        size_t ofs= _head.load(std::memory_order_relaxed) % _buf.size();
+        size_t first= std::min(size, _buf.size()-ofs);
+        std::copy(data, data+first, &_buf[ofs]);
+        std::copy(data+first, data+size, &_buf[0]);
+    }
+    void advancetail(size_t size)
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed)+size, std::memory_order_release);
+        _nreads += size;
+        _wrwait.notify();
+    }
+    void advancehead(size_t size)
+    {
+        _head.store(_head.load(std::memory_order_relaxed)+size, std::memory_order_release);
+        _nwrites += size;
+        _rdwait.notify();
+    }
+
+    const char *_name;
+    std::vector<T> _buf;
+    std::atomic<bool> _stopped;
+
+    // written by the writer
+    alignas(CACHELINE) std::atomic<uint64_t> _head;
+    uint64_t _tailcache;
+    int _nwrites;
+
+    // written by the reader
+    alignas(CACHELINE) std::atomic<uint64_t> _tail;
+    uint64_t _headcache;
+    int _nreads;
+
+    alignas(CACHELINE) waitpoint _rdwait;
+    alignas(CACHELINE) waitpoint _wrwait;
+};
+
+typedef spscqueue<unsigned char> SpscByteQueue;
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef _UTIL_TIMERWHEEL_H_
+#define _UTIL_TIMERWHEEL_H_
+#include <stdint.h>
+#include <functional>
+#include <algorithm>
+
+// timerwheel is a hierarchical timing wheel, with 4 levels of 64 slots.
+//
+// time is measured in 'ticks', the caller decides what a tick is ( epollloop uses msec ).
+// a level 0 slot covers 1 tick, a level 1 slot 64 ticks, etc.
+// timers further away than 64^4 ticks are parked in the last level, and
+// re-inserted when that slot comes around.
+//
+// schedule and cancel are O(1), the timers are intrusive list nodes.
+// a timer cancels itself when destroyed.
+//
+// usage:
+//   timerwheel w(now);
+//   timerwheel::timer t([]() { printf("expired\n"); });
+//   w.schedule(t, now+5000);
+//   ...
+//   w.advance(now);     // calls the callback of all timers with expiry <= now
+//
+class timerwheel {
+public:
+    enum { LEVELS= 4, SLOTBITS= 6, SLOTS= 1<<SLOTBITS };
+    static const uint64_t NEVER= ~uint64_t(0);
+
+    class timer {
+        friend class timerwheel;
+        timer *_next;
+        timer *_prev;
+        uint64_t _expiry;
+        std::function<void()> _callback;
+
+        void link(timer *head)
+        {
+            _next= head->_next;
+            _prev= head;
+            head->_next->_prev= this;
+            head->_next= this;
+        }
+        void unlink()
+        {
+            _prev->_next= _next;
+            _next->_prev= _prev;
+            _next= _prev= nullptr;
+        }
+        // a sentinel list head points at itself
+        void makehead()
+        {
+            _next= _prev= this;
+        }
+        bool empty() const { return _next==this; }
+    public:
+        timer() : _next(nullptr), _prev(nullptr), _expiry(NEVER) { }
+        timer(std::function<void()> cb) : _next(nullptr), _prev(nullptr), _expiry(NEVER), _callback(cb) { }
+        ~timer() { cancel(); }
+        timer(const timer&)= delete;
+        timer& operator=(const timer&)= delete;
+
+        void callback(std::function<void()> cb) { _callback= cb; }
+
+        bool pending() const { return _next!=nullptr; }
+        uint64_t expiry() const { return _expiry; }
+        void cancel()
+        {
+            if (pending())
+                unlink();
+        }
+    };
+private:
+    timer _slots[LEVELS][SLOTS];
+    uint64_t _used[LEVELS];     // bitmap of non-empty slots
+    uint64_t _now;              // the last tick processed
+
+    static int shift(int level) { return level*SLOTBITS; }
+    static uint64_t span(int level) { return uint64_t(1)<<shift(level+1); }
+
+    // 'earliest' is the first tick which will still be processed
+    void place(timer& t, uint64_t earliest)
+    {
+        uint64_t when= std::max(t._expiry, earliest);
+        uint64_t delta= when-_now;
+        int level= 0;
+        while (level<LEVELS-1 && delta>=span(level))
+            level++;
+        if (delta>=span(level))
+            when= _now+span(level)-1;
+
+        int slot= (when>>shift(level)) & (SLOTS-1);
+        t.link(&_slots[level][slot]);
+        _used[level] |= uint64_t(1)<<slot;
+    }
+    // move the contents of a slot to 'list'
+    void takeslot(int level, int slot, timer& list)
+    {
+        timer& head= _slots[level][slot];
+        while (!head.empty()) {
+            timer *t= head._next;
+            t->unlink();
+            t->link(&list);
+        }
+        _used[level] &= ~(uint64_t(1)<<slot);
+    }
+    // redistribute a higher level slot over the lower levels
+    void cascade(int level)
+    {
+        int slot= (_now>>shift(level)) & (SLOTS-1);
+        if (level+1<LEVELS && slot==0)
+            cascade(level+1);
+
+        timer list; list.makehead();
+        takeslot(level, slot, list);
+        while (!list.empty()) {
+            timer *t= list._next;
+            t->unlink();
+            // called from advance, before slot _now is processed
+            place(*t, _now);
+        }
+    }
+public:
+    timerwheel(uint64_t now)
+        : _now(now)
+    {
+        for (int level=0 ; level<LEVELS ; level++) {
+            _used[level]= 0;
+            for (int slot=0 ; slot<SLOTS ; slot++)
+                _slots[level][slot].makehead();
+        }
+    }
+    ~timerwheel()
+    {
+        // detach remaining timers, so their destructors don't touch the wheel
+        for (int level=0 ; level<LEVELS ; level++)
+            for (int slot=0 ; slot<SLOTS ; slot++) {
+                timer& head= _slots[level][slot];
+                while (!head.empty())
+                    head._next->unlink();
+            }
+    }
+
+    // (re)schedule a timer, it will fire at the first advance() with now>=expiry
+    void schedule(timer& t, uint64_t expiry)
+    {
+        t.cancel();
+        t._expiry= expiry;
+        place(t, _now+1);
+    }
+
+    uint64_t now() const { return _now; }
+
+    // the earliest tick at which advance() may have work, or NEVER.
+    // this may be earlier than the actual first expiry, when that
+    // timer is still in a higher level slot.
+    uint64_t nextexpiry() const
+    {
+        uint64_t best= NEVER;
+        for (int level=0 ; level<LEVELS ; level++) {
+            if (_used[level]==0)
+                continue;
+            uint64_t base= _now>>shift(level);
+            int cur= base & (SLOTS-1);
+            // rotate so bit 0 is the slot after 'cur'
+            int r= (cur+1) & (SLOTS-1);
+            uint64_t rot= (_used[level]>>r) | (r ? _used[level]<<(SLOTS-r) : 0);
+            uint64_t k= __builtin_ctzll(rot)+1;
+            uint64_t t= (base+k)<<shift(level);
+            if (t<best)
+                best= t;
+        }
+        return best;
+    }
+
+    // fire all timers with expiry <= now.
+    // callbacks may schedule, cancel or destroy any timer.
+    void advance(uint64_t now)
+    {
+        timer expired; expired.makehead();
+        while (_now<now) {
+            uint64_t t= nextexpiry();
+            if (t>now) {
+                _now= now;
+                break;
+            }
+            _now= t;
+            int slot= _now & (SLOTS-1);
+            if (slot==0)
+                cascade(1);
+            takeslot(0, slot, expired);
+        }
+
+        while (!expired.empty()) {
+            timer *t= expired._next;
+            t->unlink();
+            if (t->_callback)
+                t->_callback();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef __UTIL_UTF8INDEX_H__
+#define __UTIL_UTF8INDEX_H__
+// a sidecar index for a large utf-8 buffer, mapping code point positions to byte offsets.
+//
+// utf8iterator has to step over every character for 'it+n' or 'it2-it1',
+// utf8index stores the byte offset of every K-th code point, so these take
+// at most K steps, and the iterators from utf8index::begin()/end() are
+// real random access iterators, usable with std::lower_bound, std::distance, etc.
+//
+//   utf8index ix(text, textlen);
+//   size_t n= ix.size();                     // nr of code points
+//   auto it= ix.begin()+1000;                // the 1000th code point
+//   size_t ofs= ix.offset(1000);             // ... and its byte offset
+//   size_t cp= ix.position(ofs);             // back to 1000
+//
+// a code point is counted at every byte which is not a continuation byte ( 80-bf ),
+// which is the same as what utf8iterator does for valid utf-8.
+// the buffer must stay unchanged while the index is in use.
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "util/chariterators.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+class utf8index {
+    const uint8_t *_p;
+    size_t _n;
+    size_t _k;
+    size_t _size;
+    std::vector<size_t> _offsets;   // _offsets[i] is the byte offset of code point i*_k
+
+public:
+    static bool iscontinuation(uint8_t b) { return (b&0xc0)==0x80; }
+    static int popcount64(uint64_t x)
+    {
+#ifdef __GNUC__
+        return __builtin_popcountll(x);
+#else
+        x= x - ((x>>1) & 0x5555555555555555ULL);
+        x= (x & 0x3333333333333333ULL) + ((x>>2) & 0x3333333333333333ULL);
+        x= (x + (x>>4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return int((x * 0x0101010101010101ULL)>>56);
+#endif
+    }
+    static int ctz64(uint64_t x)
+    {
+#ifdef __GNUC__
+        return __builtin_ctzll(x);
+#else
+        int n= 0;
+        while ((x&1)==0) { x>>=1; n++; }
+        return n;
+#endif
+    }
+    // bit i is set when p[i] starts a code point, for 64 bytes.
+    static uint64_t leadmask64(const uint8_t *p)
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+        // continuation bytes are -128..-65 as signed bytes
+        const __m128i limit= _mm_set1_epi8(-65);
+        uint64_t m= 0;
+        for (int i=0 ; i<4 ; i++) {
+            __m128i v= _mm_loadu_si128((const __m128i*)(p+16*i));
+            m |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)))) << (16*i);
+        }
+        return m;
+#else
+        uint64_t m= 0;
+        for (int i=0 ; i<64 ; i++)
+            if (!iscontinuation(p[i]))
+                m |= uint64_t(1)<<i;
+        return m;
+#endif
+    }
+    static uint64_t leadmask(const uint8_t *p, size_t n)
+    {
+        if (n>=64)
+            return leadmask64(p);
+        uint64_t m= 0;
+        for (size_t i=0 ; i<n ; i++)
+            if (!iscontinuation(p[i]))
+                m |= uint64_t(1)<<i;
+        return m;
+    }
+    // the nr of code points in [p, p+n)
+    static size_t countchars(const uint8_t *p, size_t n)
+    {
+        size_t count= 0;
+        for (size_t i=0 ; i<n ; i += 64)
+            count += popcount64(leadmask(p+i, n-i));
+        return count;
+    }
+    // the offset of the code point 'k' code points after the one at 'ofs'
+    size_t forward(size_t ofs, size_t k) const
+    {
+        while (k && ofs<_n) {
+            ofs++;
+            while (ofs<_n && iscontinuation(_p[ofs]))
+                ofs++;
+            k--;
+        }
+        return ofs;
+    }
+    size_t backward(size_t ofs, size_t k) const
+    {
+        while (k && ofs>0) {
+            ofs--;
+            while (ofs>0 && iscontinuation(_p[ofs]))
+                ofs--;
+            k--;
+        }
+        return ofs;
+    }
+
+    utf8index(const uint8_t *p, size_t n, size_t k= 64)
+        : _p(p), _n(n), _k(k ? k : 1), _size(0)
+    {
+        build();
+    }
+    void build()
+    {
+        _offsets.clear();
+        _offsets.reserve(_n/_k+1);
+        size_t count= 0;
+        size_t next= 0;     // the next code point to record
+        for (size_t i=0 ; i<_n ; i += 64) {
+            uint64_t m= leadmask(_p+i, _n-i);
+            size_t c= popcount64(m);
+            while (next < count+c) {
+                // find the (next-count)th set bit
+                uint64_t mm= m;
+                for (size_t j=count ; j<next ; j++)
+                    mm &= mm-1;
+                _offsets.push_back(i+ctz64(mm));
+                next += _k;
+            }
+            count += c;
+        }
+        _size= count;
+    }
+
+    const uint8_t *data() const { return _p; }
+    size_t bytes() const { return _n; }
+    // the nr of code points
+    size_t size() const { return _size; }
+    size_t samplerate() const { return _k; }
+
+    // the byte offset of code point 'pos', bytes() for pos>=size()
+    size_t offset(size_t pos) const
+    {
+        if (pos>=_size)
+            return _n;
+        return forward(_offsets[pos/_k], pos%_k);
+    }
+    // the code point containing byte 'ofs'
+    size_t position(size_t ofs) const
+    {
+        if (ofs>=_n)
+            return _size;
+        size_t i= std::upper_bound(_offsets.begin(), _offsets.end(), ofs) - _offsets.begin();
+        if (i==0)
+            return 0;   // only continuation bytes before the first code point
+        i--;
+        // the chars starting in (_offsets[i], ofs]
+        return i*_k + countchars(_p+_offsets[i]+1, ofs-_offsets[i]);
+    }
+
+    class iterator : public std::iterator<std::random_access_iterator_tag, uint32_t> {
+        const utf8index *_ix;
+        size_t _pos;
+        size_t _ofs;
+    public:
+        iterator()
+            : _ix(NULL), _pos(0), _ofs(0)
+        {
+        }
+        iterator(const utf8index *ix, size_t pos)
+            : _ix(ix), _pos(std::min(pos, ix->size())), _ofs(ix->offset(_pos))
+        {
+        }
+
+        // the byte offset and code point position
+        size_t offset() const { return _ofs; }
+        size_t position() const { return _pos; }
+        const uint8_t *ptr() const { return _ix->data()+_ofs; }
+
+        uint32_t operator*() const
+        {
+            return *utf8iterator<const uint8_t*>(ptr());
+        }
+        uint32_t operator[](difference_type n) const
+        {
+            return *((*this)+n);
+        }
+        iterator& operator++()
+        {
+            _ofs= _ix->forward(_ofs, 1);
+            _pos++;
+            return *this;
+        }
+        iterator& operator--()
+        {
+            _ofs= _ix->backward(_ofs, 1);
+            _pos--;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator copy(*this);
+            ++(*this);
+            return copy;
+        }
+        iterator operator--(int)
+        {
+            iterator copy(*this);
+            --(*this);
+            return copy;
+        }
+        iterator& operator+=(difference_type n)
+        {
+            size_t pos= _pos+n;
+            // short steps are done from the current position, longer ones through the index
+            if (n>=0 && size_t(n) < _ix->samplerate())
+                _ofs= _ix->forward(_ofs, n);
+            else if (n<0 && size_t(-n) < _ix->samplerate())
+                _ofs= _ix->backward(_ofs, -n);
+            else
+                _ofs= _ix->offset(pos);
+            _pos= pos;
+            return *this;
+        }
+        iterator& operator-=(difference_type n)
+        {
+            return (*this)+=(-n);
+        }
+        iterator operator+(difference_type n) const
+        {
+            iterator copy(*this);
+            copy += n;
+            return copy;
+        }
+        iterator operator-(difference_type n) const
+        {
+            iterator copy(*this);
+            copy -= n;
+            return copy;
+        }
+        difference_type operator-(const iterator& rhs) const
+        {
+            return difference_type(_pos) - difference_type(rhs._pos);
+        }
+
+        bool operator==(const iterator& rhs) const { return _pos == rhs._pos; }
+        bool operator!=(const iterator& rhs) const { return _pos != rhs._pos; }
+        bool operator<(const iterator& rhs) const  { return _pos <  rhs._pos; }
+        bool operator>(const iterator& rhs) const  { return _pos >  rhs._pos; }
+        bool operator<=(const iterator& rhs) const { return _pos <= rhs._pos; }
+        bool operator>=(const iterator& rhs) const { return _pos >= rhs._pos; }
+    };
+    typedef iterator const_iterator;
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, _size); }
+    iterator at(size_t pos) const { return iterator(this, pos); }
+};
+#endif
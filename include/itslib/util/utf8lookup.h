@@ -0,0 +1,59 @@
+// the simd utf-8 block validator, for one instruction set.
+// no include guard: utf8validate.h includes this once per instruction set, with UTF8V_V
+// defined as the traits, and UTF8V_TARGET as its target attribute.
+//
+// all functions which pass vectors have that target attribute, so the code is correct
+// without inlining, blocks itself only takes a pointer, and can be called from anywhere.
+
+template<>
+struct utf8lookup<UTF8V_V> : utf8tables {
+    typedef UTF8V_V V;
+    typedef V::vec vec;
+
+    // 'err' is nonzero where 'in' has an error, given the preceding block 'prev'
+    UTF8V_TARGET __attribute__((always_inline))
+    static void check(const vec& in, const vec& prev, vec& err)
+    {
+        vec prev1= V::prev<1>(in, prev);
+        vec sc= V::and_(V::and_(
+                    V::lookup(V::lut(byte1high()), V::shr4(prev1)),
+                    V::lookup(V::lut(byte1low()), V::and_(prev1, V::set1(0x0f)))),
+                    V::lookup(V::lut(byte2high()), V::shr4(in)));
+
+        // a continuation is required 2 bytes after e0-ff, and 3 bytes after f0-ff,
+        // the TWO_CONTS bit must be set exactly there.
+        vec third= V::subs(V::prev<2>(in, prev), V::set1(0xe0-0x80));
+        vec fourth= V::subs(V::prev<3>(in, prev), V::set1(0xf0-0x80));
+        vec must23= V::and_(V::or_(third, fourth), V::set1(0x80));
+        err= V::xor_(must23, sc);
+    }
+    // nonzero when the block ends in the middle of a multibyte sequence
+    UTF8V_TARGET __attribute__((always_inline))
+    static bool incomplete(const vec& in)
+    {
+        return V::any(V::subs(in, V::load(maxbyte()+32-V::SIZE)));
+    }
+
+    // the offset of the first block with an error, or of the first byte after the last whole block
+    UTF8V_TARGET
+    static size_t blocks(const uint8_t *p, size_t n)
+    {
+        size_t i= 0;
+        vec prev= V::zero();
+        for ( ; i+V::SIZE<=n ; i += V::SIZE) {
+            vec in= V::load(p+i);
+            if (V::isascii(in)) {
+                if (incomplete(prev))
+                    break;
+            }
+            else {
+                vec err;
+                check(in, prev, err);
+                if (V::any(err))
+                    break;
+            }
+            prev= in;
+        }
+        return i;
+    }
+};
@@ -0,0 +1,260 @@
+#ifndef __UTIL_UTF8VALIDATE_H__
+#define __UTIL_UTF8VALIDATE_H__
+// strict utf-8 validation of a buffer with a known length, as in rfc3629:
+// no overlong forms, no surrogates, nothing above 10ffff, no truncated sequences.
+//
+//   size_t ofs= utf8validate(p, n);
+//   if (ofs!=n)
+//       printf("invalid utf8 at offset %zd\n", ofs);
+//
+// the result is the offset of the first byte of the first sequence which is not
+// valid utf-8, or 'n' when the whole buffer is valid. nul bytes are valid.
+//
+// on x86 the bulk of the buffer is checked 32 ( avx2 ) or 16 ( ssse3 ) bytes at a time,
+// with the lookup table algorithm from Keiser and Lemire, 'Validating UTF-8 In Less Than
+// One Instruction Per Byte'. when a block has an error, the scalar validator takes
+// over from the last sequence boundary before that block, to find the exact offset.
+//
+// the simd code is compiled with target attributes, so no special compiler flags
+// are needed. define _NO_UTF8SIMD to leave out the simd code.
+#include <stdint.h>
+#include <string.h>
+
+// continue validating at offset 'i', which must be at a sequence boundary.
+inline size_t utf8validate_scalar(const uint8_t *p, size_t n, size_t i= 0)
+{
+    while (i<n) {
+        // skip ascii 8 bytes at a time
+        while (i+8<=n) {
+            uint64_t w;
+            memcpy(&w, p+i, 8);
+            if (w & 0x8080808080808080ULL)
+                break;
+            i += 8;
+        }
+        if (i==n)
+            break;
+        uint8_t b= p[i];
+        if (b<0x80) {
+            i++;
+            continue;
+        }
+        // the valid range of the second byte depends on the first byte
+        size_t len;
+        uint8_t lo= 0x80, hi= 0xbf;
+        if (b<0xc2)
+            return i;
+        else if (b<0xe0)
+            len= 2;
+        else if (b<0xf0) {
+            len= 3;
+            if (b==0xe0) lo= 0xa0;          // overlong
+            else if (b==0xed) hi= 0x9f;     // surrogates
+        }
+        else if (b<0xf5) {
+            len= 4;
+            if (b==0xf0) lo= 0x90;          // overlong
+            else if (b==0xf4) hi= 0x8f;     // above 10ffff
+        }
+        else
+            return i;
+        if (n-i<len)
+            return i;
+        if (p[i+1]<lo || p[i+1]>hi)
+            return i;
+        for (size_t k=2 ; k<len ; k++)
+            if ((p[i+k]&0xc0)!=0x80)
+                return i;
+        i += len;
+    }
+    return n;
+}
+
+#if !defined(_NO_UTF8SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define _HAVE_UTF8SIMD
+#include <immintrin.h>
+
+#define UTF8V_SSE __attribute__((target("ssse3"), always_inline))
+#define UTF8V_AVX2 __attribute__((target("avx2"), always_inline))
+
+struct utf8ssse3 {
+    typedef __m128i vec;
+    enum { SIZE= 16 };
+    UTF8V_SSE static vec load(const uint8_t *p) { return _mm_loadu_si128((const __m128i*)p); }
+    UTF8V_SSE static vec lut(const uint8_t *t) { return _mm_loadu_si128((const __m128i*)t); }
+    UTF8V_SSE static vec set1(uint8_t x) { return _mm_set1_epi8(x); }
+    UTF8V_SSE static vec zero() { return _mm_setzero_si128(); }
+    UTF8V_SSE static vec and_(const vec& a, const vec& b) { return _mm_and_si128(a, b); }
+    UTF8V_SSE static vec or_(const vec& a, const vec& b) { return _mm_or_si128(a, b); }
+    UTF8V_SSE static vec xor_(const vec& a, const vec& b) { return _mm_xor_si128(a, b); }
+    UTF8V_SSE static vec subs(const vec& a, const vec& b) { return _mm_subs_epu8(a, b); }
+    UTF8V_SSE static vec lookup(const vec& t, const vec& idx) { return _mm_shuffle_epi8(t, idx); }
+    UTF8V_SSE static vec shr4(const vec& a) { return _mm_and_si128(_mm_srli_epi16(a, 4), set1(0x0f)); }
+    // the stream shifted right by N bytes, with the last bytes of 'prev' shifted in
+    template<int N>
+    UTF8V_SSE static vec prev(const vec& in, const vec& prev) { return _mm_alignr_epi8(in, prev, 16-N); }
+    UTF8V_SSE static bool isascii(const vec& a) { return _mm_movemask_epi8(a)==0; }
+    UTF8V_SSE static bool any(const vec& a) { return _mm_movemask_epi8(_mm_cmpeq_epi8(a, zero()))!=0xffff; }
+};
+struct utf8avx2 {
+    typedef __m256i vec;
+    enum { SIZE= 32 };
+    UTF8V_AVX2 static vec load(const uint8_t *p) { return _mm256_loadu_si256((const __m256i*)p); }
+    UTF8V_AVX2 static vec lut(const uint8_t *t) { return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)t)); }
+    UTF8V_AVX2 static vec set1(uint8_t x) { return _mm256_set1_epi8(x); }
+    UTF8V_AVX2 static vec zero() { return _mm256_setzero_si256(); }
+    UTF8V_AVX2 static vec and_(const vec& a, const vec& b) { return _mm256_and_si256(a, b); }
+    UTF8V_AVX2 static vec or_(const vec& a, const vec& b) { return _mm256_or_si256(a, b); }
+    UTF8V_AVX2 static vec xor_(const vec& a, const vec& b) { return _mm256_xor_si256(a, b); }
+    UTF8V_AVX2 static vec subs(const vec& a, const vec& b) { return _mm256_subs_epu8(a, b); }
+    UTF8V_AVX2 static vec lookup(const vec& t, const vec& idx) { return _mm256_shuffle_epi8(t, idx); }
+    UTF8V_AVX2 static vec shr4(const vec& a) { return _mm256_and_si256(_mm256_srli_epi16(a, 4), set1(0x0f)); }
+    // alignr works per 128 bit lane, so first make a vector with the lanes [ prev.hi, in.lo ]
+    template<int N>
+    UTF8V_AVX2 static vec prev(const vec& in, const vec& prev) { return _mm256_alignr_epi8(in, _mm256_permute2x128_si256(prev, in, 0x21), 16-N); }
+    UTF8V_AVX2 static bool isascii(const vec& a) { return _mm256_movemask_epi8(a)==0; }
+    UTF8V_AVX2 static bool any(const vec& a) { return !_mm256_testz_si256(a, a); }
+};
+
+// the lookup tables, shared by all vector types
+struct utf8tables {
+    // error classes, a byte pair is invalid when its three lookups have a bit in common
+    enum {
+        TOO_SHORT= 1<<0,        // lead byte followed by ascii or another lead byte
+        TOO_LONG= 1<<1,         // ascii followed by a continuation
+        OVERLONG_3= 1<<2,
+        TOO_LARGE= 1<<3,
+        SURROGATE= 1<<4,
+        OVERLONG_2= 1<<5,
+        TOO_LARGE_1000= 1<<6,
+        OVERLONG_4= 1<<6,
+        TWO_CONTS= 1<<7,        // two continuations, must be part of a 3 or 4 byte sequence
+        CARRY= TOO_SHORT | TOO_LONG | TWO_CONTS,
+    };
+    // indexed by the high nibble of the previous byte
+    static const uint8_t *byte1high()
+    {
+        static const uint8_t t[16]= {
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2,
+            TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+        };
+        return t;
+    }
+    // indexed by the low nibble of the previous byte
+    static const uint8_t *byte1low()
+    {
+        static const uint8_t t[16]= {
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2,
+            CARRY,
+            CARRY,
+            CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+        };
+        return t;
+    }
+    // indexed by the high nibble of the current byte
+    static const uint8_t *byte2high()
+    {
+        static const uint8_t t[16]= {
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        };
+        return t;
+    }
+    // subtracted from the last block, only bytes >= c0, e0, f0 in the last 3 positions are left
+    static const uint8_t *maxbyte()
+    {
+        static const uint8_t t[32]= {
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0-1, 0xe0-1, 0xc0-1,
+        };
+        return t;
+    }
+};
+
+// the block validator, for one of the traits above.
+template<typename V>
+struct utf8lookup;
+
+#define UTF8V_V utf8ssse3
+#define UTF8V_TARGET __attribute__((target("ssse3")))
+#include "util/utf8lookup.h"
+#undef UTF8V_V
+#undef UTF8V_TARGET
+
+#define UTF8V_V utf8avx2
+#define UTF8V_TARGET __attribute__((target("avx2")))
+#include "util/utf8lookup.h"
+#undef UTF8V_V
+#undef UTF8V_TARGET
+
+struct utf8simd {
+    static int detect()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return 32;
+        if (__builtin_cpu_supports("ssse3"))
+            return 16;
+        return 0;
+    }
+    // the nr of bytes checked per step, 0 when the cpu has no usable simd support
+    static int blocksize()
+    {
+        static const int n= detect();
+        return n;
+    }
+    // checks whole blocks, returns the offset where the scalar validator has to continue.
+    static size_t validblocks(const uint8_t *p, size_t n)
+    {
+        size_t i;
+        if (blocksize()==32)
+            i= utf8lookup<utf8avx2>::blocks(p, n);
+        else if (blocksize()==16)
+            i= utf8lookup<utf8ssse3>::blocks(p, n);
+        else
+            return 0;
+        // back up to the sequence boundary before 'i', the bytes before it
+        // are valid, so this is at most 3 bytes back.
+        size_t r= i>=3 ? i-3 : 0;
+        while (r<i && (p[r]&0xc0)==0x80)
+            r++;
+        return r;
+    }
+};
+#undef UTF8V_SSE
+#undef UTF8V_AVX2
+#endif
+
+inline size_t utf8validate(const uint8_t *p, size_t n)
+{
+#ifdef _HAVE_UTF8SIMD
+    return utf8validate_scalar(p, n, utf8simd::validblocks(p, n));
+#else
+    return utf8validate_scalar(p, n);
+#endif
+}
+inline bool isvalidutf8(const uint8_t *p, size_t n)
+{
+    return utf8validate(p, n)==n;
+}
+#endif
@@ -21,11 +21,18 @@
 
 #include "debug.h"        // declarations for this file.
 #include "stringutils.h"
+#include "util/ctformat.h"
 #include "vectorutils.h"
 
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#endif
 #ifndef WIN32
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 #define _snprintf snprintf
 #define _vsnprintf vsnprintf
 #endif
@@ -322,9 +329,9 @@ void vwdebug(const WCHAR *msg, va_list ap)
 }
 #endif
 
-void vdebug(const char *msg, va_list ap)
+// sends 'buf' to all enabled outputs
+static void debugstring(const std::string& buf)
 {
-    std::string buf= vdebugmsg(msg, ap);
 #ifdef WIN32
     if (g_debugOutputFlags&DBG_WCHAROUTPUT) {
         wdebugoutput(ToWString(buf).c_str());
@@ -332,6 +339,10 @@ void vdebug(const char *msg, va_list ap)
 #endif
     debugoutput(buf.c_str());
 }
+void vdebug(const char *msg, va_list ap)
+{
+    debugstring(vdebugmsg(msg, ap));
+}
 
 #ifdef WIN32
 void wdebug(const WCHAR *msg, ...)
@@ -462,12 +473,12 @@ void debugt(const char *msg, ...)
 std::string dumponeunit(const uint8_t *p, size_t len, int unittype)
 {
     switch(unittype) {
-        case DUMPUNIT_BYTE: return stringformat("%02x", *p);
+        case DUMPUNIT_BYTE: return formatstring(FMTSTR("%02x"), *p);
         case DUMPUNIT_WORD:
                 if (len==1)
-                    return stringformat("__%02x", *p);
+                    return formatstring(FMTSTR("__%02x"), *p);
                 else
-                    return stringformat("%04x", *(uint16_t*)p);
+                    return formatstring(FMTSTR("%04x"), *(uint16_t*)p);
                 break;
         case DUMPUNIT_DWORD:
                 --unittype;
@@ -597,7 +608,289 @@ void writedumpline(int64_t llOffset, const std::string& line)
     else
         debug("%08x: %s\n", static_cast<uint32_t>(llOffset), line.c_str());
 }
-void bighexdump(int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags/*=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)*/)
+// bighexdump renders directly into this buffer, which is flushed to the sink in large chunks.
+class hexdumpbuffer {
+    hexdumpsink& _out;
+    std::vector<char> _buf;
+    size_t _used;
+public:
+    hexdumpbuffer(hexdumpsink& out, size_t linesize)
+        : _out(out), _buf(std::max(size_t(256*1024), 4*linesize)), _used(0)
+    {
+    }
+    // returns room for at least 'n' chars, use 'commit' to add them to the buffer
+    char *reserve(size_t n)
+    {
+        if (_used+n > _buf.size()) {
+            flush();
+            if (n > _buf.size())
+                _buf.resize(n);
+        }
+        return &_buf[_used];
+    }
+    void commit(char *end)
+    {
+        _used= end-&_buf[0];
+    }
+    void append(const char *p, size_t n)
+    {
+        char *q= reserve(n);
+        memcpy(q, p, n);
+        commit(q+n);
+    }
+    void flush()
+    {
+        if (_used)
+            _out.write(&_buf[0], _used);
+        _used= 0;
+    }
+};
+
+// "000102...feff", the same with a space after each, and the char asciidump uses for each byte
+struct hexdumptables {
+    char hex[512];
+    char hexspace[1024];
+    char ascii[256];
+    hexdumptables()
+    {
+        for (int i=0 ; i<256 ; i++) {
+            hex[2*i]= hexspace[4*i]= "0123456789abcdef"[i>>4];
+            hex[2*i+1]= hexspace[4*i+1]= "0123456789abcdef"[i&15];
+            hexspace[4*i+2]= hexspace[4*i+3]= ' ';
+            ascii[i]= (i>=' ' && i<='~') ? i : '.';
+        }
+    }
+};
+static const hexdumptables& dumptables()
+{
+    static const hexdumptables t;
+    return t;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define _HEXDUMP_SSSE3
+#include <immintrin.h>
+
+// the shuffles which spread the 32 hex digits of 16 bytes over 48 chars "xx xx ... xx "
+struct hexdumpshuffles {
+    uint8_t lo[3][16];      // indexes into the digits of bytes 0-7
+    uint8_t hi[3][16];      // indexes into the digits of bytes 8-15
+    uint8_t spaces[3][16];
+    hexdumpshuffles()
+    {
+        for (int j=0 ; j<48 ; j++) {
+            int idx= 2*(j/3) + j%3;
+            bool gap= j%3==2;
+            lo[j/16][j%16]= (!gap && idx<16) ? idx : 0x80;
+            hi[j/16][j%16]= (!gap && idx>=16) ? idx-16 : 0x80;
+            spaces[j/16][j%16]= gap ? ' ' : 0;
+        }
+    }
+};
+static const hexdumpshuffles& dumpshuffles()
+{
+    static const hexdumpshuffles t;
+    return t;
+}
+__attribute__((target("ssse3")))
+static void hex16ssse3(char *q, const uint8_t *p, const hexdumpshuffles& t)
+{
+    const __m128i digits= _mm_setr_epi8('0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f');
+    const __m128i nyble= _mm_set1_epi8(0x0f);
+    __m128i v= _mm_loadu_si128((const __m128i*)p);
+    __m128i h= _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nyble));
+    __m128i l= _mm_shuffle_epi8(digits, _mm_and_si128(v, nyble));
+    __m128i lo= _mm_unpacklo_epi8(h, l);
+    __m128i hi= _mm_unpackhi_epi8(h, l);
+    for (int k=0 ; k<3 ; k++) {
+        __m128i r= _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i*)t.lo[k])),
+                             _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i*)t.hi[k]))),
+                _mm_loadu_si128((const __m128i*)t.spaces[k]));
+        _mm_storeu_si128((__m128i*)(q+16*k), r);
+    }
+}
+// printable ascii stays, the rest becomes '.'
+__attribute__((target("sse2")))
+static void ascii16sse2(char *q, const uint8_t *p)
+{
+    __m128i v= _mm_loadu_si128((const __m128i*)p);
+    __m128i printable= _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    __m128i r= _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+    _mm_storeu_si128((__m128i*)q, r);
+}
+static bool hasssse3()
+{
+    __builtin_cpu_init();
+    static const bool b= __builtin_cpu_supports("ssse3");
+    return b;
+}
+#endif
+
+// the same as writedumpline's "%08x: "
+static char *renderoffset(char *q, int64_t llOffset)
+{
+    const char *hex= dumptables().hex;
+    uint32_t high= static_cast<uint32_t>(llOffset>>32);
+    uint32_t low= static_cast<uint32_t>(llOffset);
+    if (high) {
+        int shift= 28;
+        while ((high>>shift)==0)
+            shift -= 4;
+        for ( ; shift>=0 ; shift -= 4)
+            *q++ = hex[2*((high>>shift)&15)+1];
+    }
+    for (int shift=24 ; shift>=0 ; shift -= 8) {
+        memcpy(q, hex+2*((low>>shift)&0xff), 2);
+        q += 2;
+    }
+    *q++ = ':';
+    *q++ = ' ';
+    return q;
+}
+
+// produces the same as hexdumpunit + asciidump, including the padding of short lines
+static char *renderhexline(char *q, const uint8_t *p, size_t len, DumpUnitType unittype, size_t unitsperline, DumpFormat dumpformat)
+{
+    const hexdumptables& t= dumptables();
+    size_t unitsize= DumpUnitSize(unittype);
+    size_t bytesperline= unitsperline*unitsize;
+
+    if (dumpformat==DUMP_HEX_ASCII || dumpformat==DUMP_HEX) {
+        char *linestart= q;
+        if (unittype==DUMPUNIT_BYTE) {
+            size_t i= 0;
+#ifdef _HEXDUMP_SSSE3
+            if (hasssse3()) {
+                const hexdumpshuffles& s= dumpshuffles();
+                for ( ; i+16<=len ; i+=16, q+=48)
+                    hex16ssse3(q, p+i, s);
+            }
+#endif
+            // 4 byte stores, each overwriting the 4th byte of the previous
+            for ( ; i<len ; i++, q+=3)
+                memcpy(q, t.hexspace+4*p[i], 4);
+            q--;
+        }
+        else {
+            // units are little endian, missing bytes at the end are shown as '__'
+            for (size_t i=0 ; i<len ; i+=unitsize) {
+                if (i)
+                    *q++ = ' ';
+                size_t n= std::min(unitsize, len-i);
+                for (size_t k=unitsize ; k-->0 ; q+=2)
+                    memcpy(q, k<n ? t.hex+2*p[i+k] : "__", 2);
+            }
+        }
+        if (len < bytesperline) {
+            size_t charsinfullline= (2*unitsize+1)*unitsperline-1;
+            memset(q, ' ', charsinfullline-(q-linestart));
+            q= linestart+charsinfullline;
+        }
+    }
+    if (dumpformat==DUMP_HEX_ASCII) {
+        *q++ = ' ';
+        *q++ = ' ';
+    }
+    if (dumpformat==DUMP_HEX_ASCII || dumpformat==DUMP_ASCII) {
+        size_t i= 0;
+#ifdef _HEXDUMP_SSSE3
+        for ( ; i+16<=len ; i+=16)
+            ascii16sse2(q+i, p+i);
+#endif
+        for ( ; i<len ; i++)
+            q[i]= t.ascii[p[i]];
+        q += len;
+        if (len < bytesperline) {
+            memset(q, ' ', bytesperline-len);
+            q += bytesperline-len;
+        }
+    }
+    return q;
+}
+// in ascii mode different bytes can give the same line, and a short last line
+// 'b' is padded with spaces, so it is the same as 'a' when the rest of 'a' shows as spaces.
+static bool samehexline(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen, DumpFormat dumpformat)
+{
+    if (alen==blen && memcmp(a, b, blen)==0)
+        return true;
+    if (dumpformat!=DUMP_ASCII || blen>alen)
+        return false;
+    const char *ascii= dumptables().ascii;
+    for (size_t i=0 ; i<blen ; i++)
+        if (ascii[a[i]]!=ascii[b[i]])
+            return false;
+    for (size_t i=blen ; i<alen ; i++)
+        if (ascii[a[i]]!=' ')
+            return false;
+    return true;
+}
+
+static void writedumpline(hexdumpbuffer& out, int64_t llOffset, const std::string& line)
+{
+    char *q= renderoffset(out.reserve(32), llOffset);
+    out.commit(q);
+    out.append(line.c_str(), line.size());
+    out.append("\n", 1);
+}
+static void writesummary(hexdumpbuffer& out, int nSameCount)
+{
+    char *q= out.reserve(64);
+    q += sprintf(q, "*  [ 0x%x lines ]\n", nSameCount);
+    out.commit(q);
+}
+
+// the hex and ascii formats, rendered directly from the data, and
+// duplicate lines are recognized from the data, without rendering them.
+static void fasthexdump(hexdumpbuffer& out, int64_t llOffset, const uint8_t *data, size_t size, DumpUnitType dumpunittype, DumpFormat dumpformat, size_t unitsperline, bool bWithOffset, bool bSummarize, bool bLastBlock, size_t linesize)
+{
+    size_t bytesperline= unitsperline*DumpUnitSize(dumpunittype);
+    const uint8_t *prev= NULL;
+    size_t prevlen= 0;
+    int nSameCount=0;
+
+    for (size_t i=0 ; i<size ; i+=bytesperline) {
+        size_t len= bytesperline; if (len > size-i) len= size-i;
+
+        if (bSummarize && prev && samehexline(prev, prevlen, data+i, len, dumpformat)) {
+            nSameCount++;
+        }
+        else {
+            if (nSameCount==1) {
+                char *q= renderoffset(out.reserve(linesize), llOffset+i-bytesperline);
+                q= renderhexline(q, data+i-bytesperline, bytesperline, dumpunittype, unitsperline, dumpformat);
+                *q++ = '\n';
+                out.commit(q);
+            }
+            else if (nSameCount>1) {
+                writesummary(out, nSameCount);
+            }
+            nSameCount= 0;
+
+            char *q= out.reserve(linesize);
+            if (bWithOffset)
+                q= renderoffset(q, llOffset+i);
+            q= renderhexline(q, data+i, len, dumpunittype, unitsperline, dumpformat);
+            *q++ = '\n';
+            out.commit(q);
+        }
+        prev= data+i;
+        prevlen= len;
+    }
+    if (nSameCount==1) {
+        // the repeated line, which may be the short last line, at the same offset the strings path uses
+        char *q= renderoffset(out.reserve(linesize), llOffset+size-bytesperline);
+        q= renderhexline(q, prev, prevlen, dumpunittype, unitsperline, dumpformat);
+        *q++ = '\n';
+        out.commit(q);
+    }
+    else if (nSameCount>1)
+        writesummary(out, nSameCount);
+    if (bLastBlock && nSameCount>0)
+        writedumpline(out, llOffset+size, "");
+}
+
+void bighexdump(hexdumpsink& sink, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags)
 {
     DumpUnitType dumpunittype= dumpunit_from_flags(flags);
     DumpFormat dumpformat= dumpformat_from_flags(flags);
@@ -611,20 +904,24 @@ void bighexdump(int64_t llOffset, const uint8_t *data, size_t size, uint32_t fla
         unitsperline= 0x1000;
     size_t bytesperline= unitsperline*DumpUnitSize(dumpunittype);
 
+    if (dumpformat==DUMP_HEX_ASCII || dumpformat==DUMP_HEX || dumpformat==DUMP_ASCII) {
+        // offset, hex, 2 spaces, ascii, newline
+        size_t linesize= 32 + (2*DumpUnitSize(dumpunittype)+1)*unitsperline + 2 + bytesperline + 1;
+        hexdumpbuffer out(sink, linesize);
+        fasthexdump(out, llOffset, data, size, dumpunittype, dumpformat, unitsperline, bWithOffset, bSummarize, bLastBlock, linesize);
+        out.flush();
+        return;
+    }
+
     if (dumpformat==DUMP_STRINGS || dumpformat==DUMP_RAW) {
         bytesperline= size;
     }
 
+    hexdumpbuffer out(sink, 0);
     std::string prevline;
     int nSameCount=0;
 
     for (size_t i=0 ; i<size ; i+=bytesperline) {
-        // not using 'min' since msvc's header files are broken, and make it
-        // quite hard to include them in an order as not to redefine 'min' in
-        // an inconvenient way.
-
-        size_t len= bytesperline; if (len > size-i) len= size-i;
-
         std::string line;
         if (dumpformat==DUMP_STRINGS) {
             line= dumpstrings(data+i, size-i, bytesperline);
@@ -632,49 +929,91 @@ void bighexdump(int64_t llOffset, const uint8_t *data, size_t size, uint32_t fla
         if (dumpformat==DUMP_RAW) {
             line= dumpraw(data+i, size-i, bytesperline);
         }
-        if (dumpformat==DUMP_HEX_ASCII || dumpformat==DUMP_HEX) {
-            line= hexdumpunit(data+i, len, dumpunittype);
-            if (len < bytesperline) {
-                int charsinfullline= (2*DumpUnitSize(dumpunittype)+1)*unitsperline-1;
-                line.append(charsinfullline-line.size(), ' ');
-            }
-        }
-        if (dumpformat==DUMP_HEX_ASCII || dumpformat==DUMP_ASCII)  {
-            if (!line.empty())
-                line += "  ";
-            line += asciidump(data+i, len);
-            if (len < bytesperline) {
-                line.append(bytesperline-len, ' ');
-            }
-        }
 
         if (dumpformat!=DUMP_RAW && bSummarize && line == prevline) {
             nSameCount++;
         }
         else {
             if (nSameCount==1)
-                writedumpline(llOffset+i-bytesperline, prevline);
+                writedumpline(out, llOffset+i-bytesperline, prevline);
             else if (nSameCount>1) {
-                debug("*  [ 0x%x lines ]\n", nSameCount);
+                writesummary(out, nSameCount);
             }
             nSameCount= 0;
 
             if (bWithOffset)
-                writedumpline(llOffset+i, line);
-            else if (dumpformat==DUMP_RAW)
-                debug("%s", line.c_str());
-            else
-                debug("%s\n", line.c_str());
+                writedumpline(out, llOffset+i, line);
+            else {
+                out.append(line.c_str(), line.size());
+                if (dumpformat!=DUMP_RAW)
+                    out.append("\n", 1);
+            }
         }
 
         prevline= line;
     }
     if (nSameCount==1)
-        writedumpline(llOffset+size-bytesperline, prevline);
+        writedumpline(out, llOffset+size-bytesperline, prevline);
     else if (nSameCount>1)
-        debug("*  [ 0x%x lines ]\n", nSameCount);
+        writesummary(out, nSameCount);
     if (bLastBlock && nSameCount>0)
-        writedumpline(llOffset+size, "");
+        writedumpline(out, llOffset+size, "");
+    out.flush();
+}
+
+class debughexdumpsink : public hexdumpsink {
+public:
+    virtual void write(const char *p, size_t n)
+    {
+        debugstring(std::string(p, n));
+    }
+};
+class filehexdumpsink : public hexdumpsink {
+    FILE *_f;
+public:
+    filehexdumpsink(FILE *f) : _f(f) { }
+    virtual void write(const char *p, size_t n)
+    {
+        if (fwrite(p, 1, n, _f)!=n)
+            throw "bighexdump: write error";
+    }
+};
+class fdhexdumpsink : public hexdumpsink {
+    int _fd;
+public:
+    fdhexdumpsink(int fd) : _fd(fd) { }
+    virtual void write(const char *p, size_t n)
+    {
+        while (n) {
+#ifdef _WIN32
+            int r= _write(_fd, p, n>0x40000000 ? 0x40000000 : (unsigned)n);
+#else
+            ssize_t r= ::write(_fd, p, n);
+            if (r<0 && errno==EINTR)
+                continue;
+#endif
+            if (r<=0)
+                throw "bighexdump: write error";
+            p += r;
+            n -= r;
+        }
+    }
+};
+
+void bighexdump(int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags/*=hexdumpflags(DUMPUNIT_BYTE, 16, DUMP_HEX_ASCII)*/)
+{
+    debughexdumpsink out;
+    bighexdump(out, llOffset, data, size, flags);
+}
+void bighexdump(FILE *f, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags)
+{
+    filehexdumpsink out(f);
+    bighexdump(out, llOffset, data, size, flags);
+}
+void bighexdumpfd(int fd, int64_t llOffset, const uint8_t *data, size_t size, uint32_t flags)
+{
+    fdhexdumpsink out(fd);
+    bighexdump(out, llOffset, data, size, flags);
 }
 
 bool isSmartphone()
@@ -9,6 +9,9 @@
 // ToString(const chartype* p, size_t length /*=-1*/) { ... conversion code ... }
 // to 
 #include "stringutils.h"
+#include "util/base64.h"
+#include "util/hexcodec.h"
+#include "util/ctformat.h"
 #ifdef __GNUC__
 extern "C" {
 int strcasecmp(const char *, const char *);
@@ -21,8 +24,12 @@ int strcasecmp(const char *, const char *);
 
 // NOTE:  in the ms version of std::string  'clear' is not implemented,  use 'erase' instead.
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <algorithm>
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
 
 #ifdef __GNUC__
 #include <errno.h>
@@ -266,12 +273,95 @@ std::string stringvformat(const char *fmt, va_list ap)
     return str;
 }
 
+static inline char asciilower(char c)
+{
+    return (c>='A' && c<='Z') ? c|0x20 : c;
+}
+#if defined(__SSE2__) && defined(__GNUC__)
+static inline __m128i asciilower16(__m128i v)
+{
+    // signed compares, so bytes >= 0x80 are never upper case
+    __m128i upper= _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A'-1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z'+1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+// the nr of leading bytes which are equal after folding, up to n
+static size_t asciiequalprefix(const char *a, const char *b, size_t n)
+{
+    size_t i= 0;
+    for ( ; i+16<=n ; i+=16) {
+        __m128i va= asciilower16(_mm_loadu_si128((const __m128i*)(a+i)));
+        __m128i vb= asciilower16(_mm_loadu_si128((const __m128i*)(b+i)));
+        int bits= _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (bits!=0xffff)
+            return i+__builtin_ctz(~bits);
+    }
+    while (i<n && asciilower(a[i])==asciilower(b[i]))
+        i++;
+    return i;
+}
+#else
+static size_t asciiequalprefix(const char *a, const char *b, size_t n)
+{
+    size_t i= 0;
+    while (i<n && asciilower(a[i])==asciilower(b[i]))
+        i++;
+    return i;
+}
+#endif
+void stringtolower(char *dst, const char *src, size_t n)
+{
+    size_t i= 0;
+#if defined(__SSE2__) && defined(__GNUC__)
+    for ( ; i+16<=n ; i+=16)
+        _mm_storeu_si128((__m128i*)(dst+i), asciilower16(_mm_loadu_si128((const __m128i*)(src+i))));
+#endif
+    for ( ; i<n ; i++)
+        dst[i]= asciilower(src[i]);
+}
+int stringicompare(const char *a, size_t na, const char *b, size_t nb)
+{
+    size_t n= std::min(na, nb);
+    size_t i= asciiequalprefix(a, b, n);
+    if (i<n) {
+        // compared as 'char', like charicompare
+        char ca= asciilower(a[i]);
+        char cb= asciilower(b[i]);
+        return ca<cb ? -1 : 1;
+    }
+    return na<nb ? -1 : na>nb ? 1 : 0;
+}
+bool stringiequal(const char *a, size_t na, const char *b, size_t nb)
+{
+    return na==nb && asciiequalprefix(a, b, na)==na;
+}
+static inline uint64_t stringihashstep(uint64_t h, uint64_t x)
+{
+    // folds 8 chars at once: 0x80 >> 2 is the case bit
+    x |= swarbytesbetween(x, 'A'-1, 'Z'+1)>>2;
+    h= (h ^ x) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h>>29);
+}
+uint32_t stringihash(const char *p, size_t n)
+{
+    uint64_t h= n*0x9e3779b97f4a7c15ULL;
+    for ( ; n>=8 ; p+=8, n-=8)
+        h= stringihashstep(h, get64le(p));
+    if (n) {
+        uint64_t x= 0;
+        size_t i= 0;
+        if (n&4) { x= get32le(p);                        i += 4; }
+        if (n&2) { x |= uint64_t(get16le(p+i))<<(8*i);   i += 2; }
+        if (n&1) { x |= uint64_t(uint8_t(p[i]))<<(8*i);          }
+        h= stringihashstep(h, x);
+    }
+    h *= 0x9e3779b97f4a7c15ULL;
+    return uint32_t(h>>32);
+}
+
 std::string tolower(const std::string& str)
 {
-    std::string lstr; 
-    lstr.reserve(str.size());
-    for (std::string::const_iterator i=str.begin() ; i!=str.end() ; ++i)
-        lstr += (char)tolower(*i);
+    std::string lstr(str.size(), 0);
+    stringtolower(&lstr[0], str.data(), str.size());
     return lstr;
 }
 #if 0
@@ -310,16 +400,22 @@ void qword2hexchars(uint64_t d, char *p)
     dword2hexchars((d>>32), p);  p+=8;
     dword2hexchars(d, p);        p+=8;
 }
+void bytes2hexchars(const uint8_t *buf, size_t n, char *p)
+{
+    hexcodec::encode(buf, n, p);
+}
 //----------------------------------------------------------------------------
 
 void binary2hex(std::string &str, const uint8_t *buf, int nLength)
 {
-    str.resize(str.size()+nLength*3);
-    char *p= &str[str.size()-nLength*3];
-    while(nLength--)
-    {
-        byte2hexchars(*buf++, p); p+=2;
-    }
+    if (nLength<=0)
+        return;
+    str.resize(str.size()+nLength*2);
+    bytes2hexchars(buf, nLength, &str[str.size()-nLength*2]);
+}
+size_t hex2binary(const char *strfirst, const char *strlast, uint8_t *first, uint8_t *last)
+{
+    return hexcodec::decode(strfirst, strlast, first, last);
 }
 
 
@@ -327,11 +423,8 @@ std::string hash_as_string(const ByteVector& hash)
 {
     std::string str;
     str.resize(hash.size()*2);
-    char *p= &str[str.size()-hash.size()*2];
-    for (size_t i=0 ; i<hash.size() ; ++i)
-    {
-        byte2hexchars(hash[i], p); p+=2;
-    }
+    if (!hash.empty())
+        bytes2hexchars(&hash[0], hash.size(), &str[0]);
     return str;
 }
 
@@ -388,8 +481,8 @@ std::string hexdump(int64_t llOffset, const uint8_t *buf, int nLength, int nDump
         line.reserve(nCharsInLine);
 
         if (llOffset>>32)
-            line +=stringformat("%x", static_cast<uint32_t>(llOffset>>32));
-        line += stringformat("%08x", static_cast<uint32_t>(llOffset));
+            appendformat(line, FMTSTR("%x"), static_cast<uint32_t>(llOffset>>32));
+        appendformat(line, FMTSTR("%08x"), static_cast<uint32_t>(llOffset));
 
         switch(nDumpUnitSize)
         {
@@ -430,172 +523,306 @@ std::string hexdump(int64_t llOffset, const uint8_t *buf, int nLength, int nDump
     return all;
 }
 
-// todo: also recognize unicode strings
-std::string ascdump(const uint8_t *first, size_t size, const std::string& escaped, bool bBreakOnEol/*= false*/)
+// the ascdump output for each byte value
+struct ascdumptable {
+    enum { PLAIN, ESCAPE, HEX };
+    uint8_t cls[256];
+    char esc[256][4];
+    uint8_t esclen[256];
+    // the printable chars which are escaped, excluded from the bulk copy
+    char special[8];
+    int nspecial;       // more than 8 disables the simd scan
+
+    ascdumptable(const std::string& escaped)
+        : nspecial(0)
+    {
+        for (int c=0 ; c<256 ; c++) {
+            bool bNeedsEscape= escaped.find((char)c)!=escaped.npos || c=='\"' || c=='\\';
+            cls[c]= bNeedsEscape ? ESCAPE : isprint(c) ? PLAIN : HEX;
+            if (!bNeedsEscape)
+                continue;
+            switch(c) {
+                case '\n': memcpy(esc[c], "\\n", 2); esclen[c]= 2; break;
+                case '\r': memcpy(esc[c], "\\r", 2); esclen[c]= 2; break;
+                case '\t': memcpy(esc[c], "\\t", 2); esclen[c]= 2; break;
+                case '\"': memcpy(esc[c], "\\\"", 2); esclen[c]= 2; break;
+                case '\\': memcpy(esc[c], "\\\\", 2); esclen[c]= 2; break;
+                default:
+                    esc[c][0]= '\\';
+                    esc[c][1]= 'x';
+                    byte2hexchars(c, esc[c]+2);
+                    esclen[c]= 4;
+            }
+            if (c>=0x20 && c<0x7f) {
+                if (nspecial<8)
+                    special[nspecial]= c;
+                nspecial++;
+            }
+        }
+    }
+    // the end of the run of PLAIN bytes starting at p
+    const uint8_t *plainend(const uint8_t *p, const uint8_t *last) const
+    {
+#if defined(__SSE2__) && defined(__GNUC__)
+        if (nspecial<=8) {
+            // ascii printable, except for the escaped chars
+            const __m128i lo= _mm_set1_epi8(0x20);
+            const __m128i hi= _mm_set1_epi8(0x7f);
+            while (last-p>=16) {
+                __m128i v= _mm_loadu_si128((const __m128i*)p);
+                __m128i bad= _mm_or_si128(_mm_cmpgt_epi8(lo, v), _mm_cmpeq_epi8(v, hi));
+                for (int i=0 ; i<nspecial ; i++)
+                    bad= _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(special[i])));
+                int bits= _mm_movemask_epi8(bad);
+                if (bits) {
+                    p += __builtin_ctz(bits);
+                    // locales can have printable chars above 0x7f
+                    if (cls[*p]!=PLAIN)
+                        return p;
+                    p++;
+                }
+                else {
+                    p += 16;
+                }
+            }
+        }
+#endif
+        while (p<last && cls[*p]==PLAIN)
+            p++;
+        return p;
+    }
+};
+// counts the output size
+class ascdumpcounter {
+    size_t _n;
+    char _last;
+public:
+    ascdumpcounter() : _n(0), _last(0) { }
+    void put(char c) { _n++; _last= c; }
+    void put(const char *p, size_t n) { _n += n; _last= p[n-1]; }
+    size_t size() const { return _n; }
+    char lastchar() const { return _last; }
+};
+// writes to a buffer of the counted size
+class ascdumpwriter {
+    char *_first;
+    char *_p;
+public:
+    ascdumpwriter(char *p) : _first(p), _p(p) { }
+    void put(char c) { *_p++ = c; }
+    void put(const char *p, size_t n) { memcpy(_p, p, n); _p += n; }
+    size_t size() const { return _p-_first; }
+    char lastchar() const { return _p[-1]; }
+};
+static void ascdumptoolarge(const uint8_t *first, size_t size, size_t ressize)
 {
-    std::string result;
+    fprintf(stderr, "WARNING: ascdump with large output(buf=%d, res=%d\n", (int)size, (int)ressize);
+    fprintf(stderr, "hex: %s\n", hexdump(first, size).c_str());
+    throw "ascdump error";
+}
+template<typename SINK>
+void ascdumpto(SINK& out, const ascdumptable& t, const uint8_t *first, size_t size, bool bBreakOnEol)
+{
+    const size_t maxsize= 0x1000000;
+    const char *hexchars= hexcodec::bytechars();
     bool bQuoted= false;
     bool bLastWasEolChar= false;
 
-    bool bWarnedLarge= false;
     const uint8_t *p= first;
     const uint8_t *last= first+size;
     while (p<last)
     {
-        if (result.size()>0x1000000 && !bWarnedLarge) {
-            fprintf(stderr, "WARNING: ascdump with large output(buf=%d, res=%d\n", (int)size, (int)result.size());
-            fprintf(stderr, "hex: %s\n", hexdump(first, size).c_str());
-            throw "ascdump error";
-        }
+        if (out.size()>maxsize)
+            ascdumptoolarge(first, size, out.size());
 
-        bool bNeedsEscape= escaped.find((char)*p)!=escaped.npos 
-            || *p=='\"' 
-            || *p=='\\';
+        uint8_t c= *p;
+        bool bThisIsEolChar= (c==0x0a || c==0x0d || c==0);
 
-        bool bThisIsEolChar= (*p==0x0a || *p==0x0d || *p==0);
-
-        if ((p>first+1) && p[-2]==*p && p[-1]==*p && (*p==0 || *p==0xff)) {
+        if ((p>first+1) && p[-2]==c && p[-1]==c && (c==0 || c==0xff)) {
             const uint8_t *seqstart= p-2;
             while (p<last && *p==*seqstart)
                 p++;
-            result += stringformat(" [x%d]", p-seqstart);
+            char buf[32];
+            out.put(buf, formatbuffer(buf, sizeof(buf), FMTSTR(" [x%d]"), int(p-seqstart)));
             p--;
         }
         if (bLastWasEolChar && !bThisIsEolChar && bBreakOnEol) {
             if (bQuoted)
-                result += "\"";
+                out.put('\"');
             bQuoted= false;
-            result += "\n";
+            out.put('\n');
         }
 
-        if (isprint(*p) || bNeedsEscape) {
+        if (t.cls[c]==ascdumptable::HEX) {
+            if (bQuoted) {
+                out.put('\"');
+                bQuoted= false;
+            }
+            if (out.size())
+                out.put(',');
+            out.put(hexchars+2*c, 2);
+        }
+        else {
             if (!bQuoted) {
-                if (!result.empty() && *result.rbegin()!='\n')
-                    result += ",";
-                result += "\"";
+                if (out.size() && out.lastchar()!='\n')
+                    out.put(',');
+                out.put('\"');
                 bQuoted= true;
             }
-            if (bNeedsEscape) {
-                std::string escapecode;
-                switch(*p) {
-                    case '\n': escapecode= "\\n"; break;
-                    case '\r': escapecode= "\\r"; break;
-                    case '\t': escapecode= "\\t"; break;
-                    case '\"': escapecode= "\\\""; break;
-                    case '\\': escapecode= "\\\\"; break;
-                    default:
-                       escapecode= stringformat("\\x%02x", *p);
-                }
-                result += escapecode;
+            if (t.cls[c]==ascdumptable::ESCAPE) {
+                out.put(t.esc[c], t.esclen[c]);
             }
             else {
-                result += (char) *p;
-            }
-        }
-        else {
-            if (bQuoted) {
-                result += "\"";
-                bQuoted= false;
+                // copy the whole run of printable chars
+                const uint8_t *q= t.plainend(p+1, last);
+                // the size check above is done before each char
+                if (out.size()+(q-p)-1>maxsize)
+                    ascdumptoolarge(first, size, out.size()+(q-p)-1);
+                out.put((const char*)p, q-p);
+                p= q;
+                bLastWasEolChar= false;
+                continue;
             }
-            if (!result.empty())
-                result += ",";
-            result += stringformat("%02x", *p);
         }
         bLastWasEolChar= bThisIsEolChar;
 
         p++;
     }
 
-    if (bQuoted) {
-        result += "\"";
-        bQuoted= false;
-    }
+    if (bQuoted)
+        out.put('\"');
+}
 
+// todo: also recognize unicode strings
+void ascdump(std::string& result, const uint8_t *first, size_t size, const std::string& escaped/*= ""*/, bool bBreakOnEol/*= false*/)
+{
+    ascdumptable t(escaped);
+
+    // count first, so the output is written without reallocations
+    ascdumpcounter count;
+    ascdumpto(count, t, first, size, bBreakOnEol);
+    if (count.size()==0)
+        return;
+
+    size_t ofs= result.size();
+    result.resize(ofs+count.size());
+    ascdumpwriter out(&result[ofs]);
+    ascdumpto(out, t, first, size, bBreakOnEol);
+}
+std::string ascdump(const uint8_t *first, size_t size, const std::string& escaped/*= ""*/, bool bBreakOnEol/*= false*/)
+{
+    std::string result;
+    ascdump(result, first, size, escaped, bBreakOnEol);
     return result;
 }
 
+// cstrescape: control chars, '"' and '\\' are escaped
+static bool cstrneedsescape(char c)
+{
+    return unsigned(c)<unsigned(' ') || c=='"' || c=='\\';
+}
+static size_t cstrescapelen(char c)
+{
+    return c=='\n' || c=='\r' || c=='\t' || c=='"' || c=='\\' ? 2 : 4;
+}
+#if defined(__SSE2__) && defined(__GNUC__)
+// bit i is set when p[i] needs an escape, bits in 'hexbits' when it is escaped as \xNN
+static int cstrescapemask(const char *p, int& hexbits)
+{
+    __m128i v= _mm_loadu_si128((const __m128i*)p);
+    // 00-1f, the signed compare excludes 80-ff
+    __m128i ctrl= _mm_andnot_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), v), _mm_cmpgt_epi8(_mm_set1_epi8(' '), v));
+    __m128i named= _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    __m128i other= _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    hexbits= _mm_movemask_epi8(_mm_andnot_si128(named, ctrl));
+    return _mm_movemask_epi8(_mm_or_si128(ctrl, other));
+}
+#endif
+static size_t cstrescapedsize(const char *p, size_t n)
+{
+    size_t size= n;
+    size_t i= 0;
+#if defined(__SSE2__) && defined(__GNUC__)
+    for ( ; i+16<=n ; i+=16) {
+        int hexbits;
+        int bits= cstrescapemask(p+i, hexbits);
+        size += __builtin_popcount(bits) + 2*__builtin_popcount(hexbits);
+    }
+#endif
+    for ( ; i<n ; i++)
+        if (cstrneedsescape(p[i]))
+            size += cstrescapelen(p[i])-1;
+    return size;
+}
+// the first char needing an escape
+static const char *cstrplainend(const char *p, const char *last)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+    while (last-p>=16) {
+        int hexbits;
+        int bits= cstrescapemask(p, hexbits);
+        if (bits)
+            return p+__builtin_ctz(bits);
+        p += 16;
+    }
+#endif
+    while (p<last && !cstrneedsescape(*p))
+        p++;
+    return p;
+}
+void cstrescape(std::string& ostr, const char *p, size_t n)
+{
+    size_t size= cstrescapedsize(p, n);
+    if (size==0)
+        return;
+    size_t ofs= ostr.size();
+    ostr.resize(ofs+size);
+    char *o= &ostr[ofs];
+    const char *last= p+n;
+    while (p<last) {
+        const char *q= cstrplainend(p, last);
+        memcpy(o, p, q-p);
+        o += q-p;
+        p= q;
+        if (p==last)
+            break;
+        char c= *p++;
+        *o++ = '\\';
+        switch(c) {
+            case '\n': *o++ = 'n'; break;
+            case '\r': *o++ = 'r'; break;
+            case '\t': *o++ = 't'; break;
+            case '\\': *o++ = '\\'; break;
+            case '"': *o++ = '"'; break;
+            default:
+                *o++ = 'x';
+                byte2hexchars(uint8_t(c), o);
+                o += 2;
+        }
+    }
+}
+
 std::string GuidToString(const GUID *guid)
 {
-    return stringformat("{%08lx-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}",
+    return formatstring(FMTSTR("{%08lx-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}"),
             guid->Data1, guid->Data2, guid->Data3, guid->Data4[0], guid->Data4[1],
             guid->Data4[2] , guid->Data4[3] , guid->Data4[4],
             guid->Data4[5] , guid->Data4[6] , guid->Data4[7]);
 }
 
 
-// -1: invalid
-// -2: end
-static const int char2b64[]= {
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
-52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,
--1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14,
-15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
--1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
-41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
--1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-};
-
+std::string base64_encode(const uint8_t *data, size_t n)
+{
+    std::string b64; b64.resize(base64::encodedsize(n));
+    if (n)
+        base64::encode(data, n, &b64[0]);
+    return b64;
+}
 ByteVector base64_decode(const std::string& str)
 {
-    size_t b64size= int((str.size()+3)/4)*3;
-
-    int n=0;
-    uint32_t value= 0;
-    ByteVector data; data.reserve(b64size);
-    for (std::string::const_iterator i= str.begin() ; i!=str.end() ; i++)
-    {
-        int b= char2b64[((unsigned)*i)&0xff];
-        if (b>=0) {
-            value= (value<<6) | b;
-            n++;
-            if (n==4) {
-                data.push_back(value>>16);
-                data.push_back(value>>8);
-                data.push_back(value);
-                n= 0;
-                value= 0;
-            }
-        }
-        else if (b==-2)
-            break;
-    }
-    switch(n)
-    {
-        // fall through all!!
-        case 1: value <<= 6;  [[fallthrough]];
-        case 2: value <<= 6;  [[fallthrough]];
-        case 3: value <<= 6;  [[fallthrough]];
-        case 4: break;
-        case 0: break;
-    } 
-    switch(n)
-    {
-        case 4:
-                data.push_back(value>>16);
-                data.push_back(value>>8);
-                data.push_back(value);
-                break;
-        case 3:
-                data.push_back(value>>16);
-                data.push_back(value>>8);
-                break;
-        case 2:
-                data.push_back(value>>16);
-                break;
-        case 1:
-                // note: 1 base64 char should not happen
-        case 0:
-                break;
-    }
+    ByteVector data(base64::decodedsize(str.size()));
+    if (!data.empty())
+        data.resize(base64::decode(str.c_str(), str.size(), &data[0]));
     return data;
 }
 std::string utf8forchar(WCHAR c)
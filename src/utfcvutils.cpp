@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include "utfcvutils.h"
 
 // relevant rfcs:
@@ -32,6 +33,203 @@
 
 
 
+/////////////////////////////////////////////////////////
+// simd helpers
+//
+// the strings are NUL terminated, so their size is not known beforehand.
+// a 16 byte load is only done when it does not cross a page boundary, then it
+// cannot fault, even when it reads past the terminating NUL.
+// such loads are invisible to address sanitizers.
+//
+// copyrun<S,D> copies the run of symbols at 'src' which translate 1:1 to a single 'D'
+// symbol: ascii for utf8, or non surrogate BMP for utf16, and returns its length.
+// this is the bulk of most text, the conversion functions below handle everything else
+// one symbol at a time.
+#if defined(__SSE2__) || defined(_M_X64)
+#define _UTF_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define UTF_NO_SANITIZE __attribute__((no_sanitize_address))
+inline unsigned utfctz(unsigned x) { return __builtin_ctz(x); }
+inline unsigned utfpopcount(unsigned x) { return __builtin_popcount(x); }
+#else
+#define UTF_NO_SANITIZE
+inline unsigned utfctz(unsigned x) { unsigned n=0; while (!(x&1)) { x>>=1; n++; } return n; }
+inline unsigned utfpopcount(unsigned x) { unsigned n=0; while (x) { x&=x-1; n++; } return n; }
+#endif
+
+#ifdef _UTF_SSE2
+inline bool canload16(const void *p)
+{
+    return (reinterpret_cast<uintptr_t>(p) & 4095) <= 4096-16;
+}
+UTF_NO_SANITIZE inline __m128i load16(const void *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// returns a bitmask, per byte, of the symbols which can not be copied directly,
+// and stores the converted symbols when there are none.
+inline unsigned convertblock(__m128i v, utf16char_t *dst)
+{
+    unsigned bad= _mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    if (bad==0) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+    }
+    return bad;
+}
+inline unsigned convertblock(__m128i v, utf32char_t *dst)
+{
+    unsigned bad= _mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    if (bad==0) {
+        __m128i lo= _mm_unpacklo_epi8(v, _mm_setzero_si128());
+        __m128i hi= _mm_unpackhi_epi8(v, _mm_setzero_si128());
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(lo, _mm_setzero_si128()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+4), _mm_unpackhi_epi16(lo, _mm_setzero_si128()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+8), _mm_unpacklo_epi16(hi, _mm_setzero_si128()));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+12), _mm_unpackhi_epi16(hi, _mm_setzero_si128()));
+    }
+    return bad;
+}
+// utf16: ascii -> utf8
+inline unsigned convertblock(__m128i v, utf8char_t *dst)
+{
+    __m128i zero= _mm_setzero_si128();
+    __m128i bad= _mm_or_si128(_mm_cmpeq_epi16(v, zero),
+                        _mm_xor_si128(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x80)), zero), _mm_set1_epi8(-1)));
+    unsigned mask= _mm_movemask_epi8(bad);
+    if (mask==0)
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(v, v));
+    return mask;
+}
+// utf16: non surrogates -> utf32
+inline unsigned convertblock16(__m128i v, utf32char_t *dst)
+{
+    __m128i zero= _mm_setzero_si128();
+    __m128i bad= _mm_or_si128(_mm_cmpeq_epi16(v, zero),
+                        _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x800)), _mm_set1_epi16(-0x2800)));
+    unsigned mask= _mm_movemask_epi8(bad);
+    if (mask==0) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+4), _mm_unpackhi_epi16(v, zero));
+    }
+    return mask;
+}
+// utf32: ascii -> utf8
+inline unsigned convertblock32(__m128i v, utf8char_t *dst)
+{
+    __m128i good= _mm_and_si128(_mm_cmpgt_epi32(v, _mm_setzero_si128()), _mm_cmplt_epi32(v, _mm_set1_epi32(0x80)));
+    unsigned mask= _mm_movemask_epi8(good)^0xffff;
+    if (mask==0) {
+        __m128i w= _mm_packs_epi32(v, v);
+        w= _mm_packus_epi16(w, w);
+        int x= _mm_cvtsi128_si32(w);
+        memcpy(dst, &x, 4);
+    }
+    return mask;
+}
+// utf32: non surrogate BMP -> utf16
+inline unsigned convertblock32(__m128i v, utf16char_t *dst)
+{
+    __m128i good= _mm_and_si128(_mm_cmpgt_epi32(v, _mm_setzero_si128()), _mm_cmplt_epi32(v, _mm_set1_epi32(0x10000)));
+    __m128i sur= _mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf800)), _mm_set1_epi32(0xd800));
+    unsigned mask= _mm_movemask_epi8(_mm_andnot_si128(sur, good))^0xffff;
+    if (mask==0) {
+        // there is no unsigned 32 -> 16 bit pack in sse2
+        __m128i bias= _mm_set1_epi32(0x8000);
+        __m128i w= _mm_packs_epi32(_mm_sub_epi32(v, bias), _mm_sub_epi32(v, bias));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_add_epi16(w, _mm_set1_epi16(-0x8000)));
+    }
+    return mask;
+}
+inline unsigned convertblock(__m128i v, const utf16char_t *, utf32char_t *dst) { return convertblock16(v, dst); }
+inline unsigned convertblock(__m128i v, const utf16char_t *, utf8char_t *dst) { return convertblock(v, dst); }
+inline unsigned convertblock(__m128i v, const utf8char_t *, utf16char_t *dst) { return convertblock(v, dst); }
+inline unsigned convertblock(__m128i v, const utf8char_t *, utf32char_t *dst) { return convertblock(v, dst); }
+inline unsigned convertblock(__m128i v, const utf32char_t *, utf8char_t *dst) { return convertblock32(v, dst); }
+inline unsigned convertblock(__m128i v, const utf32char_t *, utf16char_t *dst) { return convertblock32(v, dst); }
+#endif
+
+// can 'c' be copied as a single symbol
+template<typename S, typename D>
+inline bool isdirect(S c)
+{
+    if (c==0)
+        return false;
+    if (sizeof(S)==1 || sizeof(D)==1)
+        return c<0x80;
+    if (sizeof(S)==2)
+        return c<0xd800 || c>=0xe000;
+    return c<0xd800 || (c>=0xe000 && c<0x10000);
+}
+template<typename S, typename D>
+size_t copyrun(const S *src, D *dst, size_t room)
+{
+    size_t i= 0;
+    while (i<room) {
+#ifdef _UTF_SSE2
+        const size_t B= 16/sizeof(S);
+        if (room-i>=B && canload16(src+i)) {
+            unsigned bad= convertblock(load16(src+i), src, dst+i);
+            if (bad==0) {
+                i += B;
+                continue;
+            }
+            size_t k= utfctz(bad)/sizeof(S);
+            for (size_t j=0 ; j<k ; j++)
+                dst[i+j]= src[i+j];
+            return i+k;
+        }
+#endif
+        if (!isdirect<S,D>(src[i]))
+            break;
+        dst[i]= src[i];
+        i++;
+    }
+    return i;
+}
+// room for the next 'copyrun' in the output, excluding the terminating NUL
+template<typename T>
+size_t outputroom(T*p, T*end, size_t size)
+{
+    if (size==AUTOSIZE)
+        return AUTOSIZE;
+    return p<end ? end-p : 0;
+}
+
+// decode one well formed utf8 sequence of 2 to 4 bytes, returns its length,
+// or 0 when it is not well formed, or would be refused by the conversion functions.
+// stops reading at the first byte which is not a continuation, so never reads past the NUL.
+inline int decodeutf8seq(const utf8char_t *p, utf32char_t& w)
+{
+    utf8char_t c= p[0];
+    if (c<0xc0)
+        return 0;
+    if ((p[1]&0xc0)!=0x80)
+        return 0;
+    if (c<0xe0) {
+        w= ((c&0x1f)<<6) | (p[1]&0x3f);
+        return 2;
+    }
+    if ((p[2]&0xc0)!=0x80)
+        return 0;
+    if (c<0xf0) {
+        w= ((c&0xf)<<12) | ((p[1]&0x3f)<<6) | (p[2]&0x3f);
+        if (w>=0xd800 && w<0xe000)
+            return 0;
+        return 3;
+    }
+    if (c>=0xf8 || (p[3]&0xc0)!=0x80)
+        return 0;
+    w= ((c&7)<<18) | ((p[1]&0x3f)<<12) | ((p[2]&0x3f)<<6) | (p[3]&0x3f);
+    if (w>=0x110000)
+        return 0;
+    return 4;
+}
+
 /////////////////////////////////////////////////////////
 //  <UTFNN>to<UTFNN>bytesneeded: calculate how many bytes exactly a conversion will need
 //
@@ -50,6 +248,21 @@ size_t utf8bytesneeded(utf32char_t c)
 size_t utf32toutf8bytesneeded(const utf32char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    // values above 7fffffff compare as negative
+    const __m128i zero= _mm_setzero_si128();
+    while (canload16(p)) {
+        __m128i v= load16(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)))
+            break;
+        __m128i big= _mm_cmplt_epi32(v, zero);
+        n += 4;
+        n += utfpopcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(big, _mm_cmpgt_epi32(v, _mm_set1_epi32(0x7f))))));
+        n += utfpopcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(big, _mm_cmpgt_epi32(v, _mm_set1_epi32(0x7ff))))));
+        n += utfpopcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(big, _mm_cmpgt_epi32(v, _mm_set1_epi32(0xffff))))));
+        p += 4;
+    }
+#endif
     while (*p)
         n += utf8bytesneeded(*p++);
     return n;
@@ -58,7 +271,26 @@ size_t utf16toutf8bytesneeded(const utf16char_t *p)
 {
     size_t n=0;
     utf32char_t w=0;
-    while (uint16_t c= *p++) {
+    while (true) {
+#ifdef _UTF_SSE2
+        // blocks without surrogates
+        const __m128i zero= _mm_setzero_si128();
+        if (canload16(p)) {
+            __m128i v= load16(p);
+            __m128i special= _mm_or_si128(_mm_cmpeq_epi16(v, zero),
+                    _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x800)), _mm_set1_epi16(-0x2800)));
+            if (_mm_movemask_epi8(special)==0) {
+                unsigned ascii= _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x80)), zero));
+                unsigned twobytes= _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x800)), zero));
+                n += 8*3 - (utfpopcount(ascii)+utfpopcount(twobytes))/2;
+                p += 8;
+                continue;
+            }
+        }
+#endif
+        uint16_t c= *p++;
+        if (!c)
+            break;
         if (c<0xd800 || c>=0xe000)
             n += utf8bytesneeded(c);
         else if (c<0xdc00) {
@@ -76,6 +308,16 @@ size_t utf16toutf8bytesneeded(const utf16char_t *p)
 size_t utf8charcount(const utf8char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    // continuation bytes 80..bf are -128..-65 as signed bytes
+    while (canload16(p)) {
+        __m128i v= load16(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())))
+            break;
+        n += utfpopcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))));
+        p += 16;
+    }
+#endif
     while (uint8_t c= *p++)
         if (c<0x80 || c>=0xc0)
             n++;
@@ -88,6 +330,17 @@ size_t utf8toutf32bytesneeded(const utf8char_t *p)
 size_t utf8toutf16bytesneeded(const utf8char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    // f0..ff, which need a surrogate pair, are -16..-1 as signed bytes
+    while (canload16(p)) {
+        __m128i v= load16(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())))
+            break;
+        n += utfpopcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))));
+        n += utfpopcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-17))) & _mm_movemask_epi8(v));
+        p += 16;
+    }
+#endif
     while (uint8_t c= *p++) {
         if (c<0x80 || c>=0xc0)
             n++;
@@ -99,6 +352,14 @@ size_t utf8toutf16bytesneeded(const utf8char_t *p)
 size_t utf32charcount(const utf32char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    while (canload16(p+n)) {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(load16(p+n), _mm_setzero_si128())))
+            break;
+        n += 4;
+    }
+    p += n;
+#endif
     while (*p++)
         n++;
     return n;
@@ -106,6 +367,18 @@ size_t utf32charcount(const utf32char_t *p)
 size_t utf32toutf16bytesneeded(const utf32char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    const __m128i zero= _mm_setzero_si128();
+    while (canload16(p)) {
+        __m128i v= load16(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)))
+            break;
+        // values above 7fffffff compare as negative
+        __m128i pair= _mm_or_si128(_mm_cmplt_epi32(v, zero), _mm_cmpgt_epi32(v, _mm_set1_epi32(0xffff)));
+        n += 4 + utfpopcount(_mm_movemask_ps(_mm_castsi128_ps(pair)));
+        p += 4;
+    }
+#endif
     while (utf32char_t c= *p++) {
         n++;
         if (c>=0x10000)
@@ -129,6 +402,20 @@ size_t utf8toutf32(const utf8char_t *p8, utf32char_t *p32, size_t maxsize)
     uint8_t c;
     while (checkend(p32,p32end,maxsize) && (c= *p8)!=0)
     {
+        if (n<0) {
+            size_t k= copyrun(p8, p32, outputroom(p32,p32end,maxsize));
+            if (k) {
+                p8 += k;
+                p32 += k;
+                continue;
+            }
+            int len;
+            if (c>=0xc0 && (len= decodeutf8seq(p8, w))!=0) {
+                *p32++ = w;
+                p8 += len;
+                continue;
+            }
+        }
         if (c<0x80)
             *p32++ = c;
         else if (c<0xc0) {
@@ -175,6 +462,12 @@ size_t utf32toutf8(const utf32char_t *p32, utf8char_t *p8, size_t maxsize)
     utf32char_t c;
     while (checkend(p8,p8end,maxsize) && (c= *p32)!=0)
     {
+        size_t k= copyrun(p32, p8, outputroom(p8,p8end,maxsize));
+        if (k) {
+            p32 += k;
+            p8 += k;
+            continue;
+        }
         if (c<0x80)
             *p8++ = c;
         else if (c<0x800) {
@@ -222,6 +515,14 @@ size_t utf16toutf32(const utf16char_t *p16, utf32char_t *p32, size_t maxsize)
     uint16_t c;
     while (checkend(p32,p32end,maxsize) && (c= *p16)!=0)
     {
+        if (n<0) {
+            size_t k= copyrun(p16, p32, outputroom(p32,p32end,maxsize));
+            if (k) {
+                p16 += k;
+                p32 += k;
+                continue;
+            }
+        }
         if (c<0xd800 || c>=0xe000)
             *p32++ = c;
         else if (c<0xdc00) {
@@ -254,6 +555,12 @@ size_t utf32toutf16(const utf32char_t *p32, utf16char_t *p16, size_t maxsize)
     utf32char_t c;
     while (checkend(p16,p16end,maxsize) && (c= *p32)!=0)
     {
+        size_t k= copyrun(p32, p16, outputroom(p16,p16end,maxsize));
+        if (k) {
+            p32 += k;
+            p16 += k;
+            continue;
+        }
         if (c<0x10000) {
             // break on invalid codes
             if (c>=0xd800 && c<0xe000)
@@ -286,6 +593,26 @@ size_t utf8toutf16(const utf8char_t *p8, utf16char_t *p16, size_t maxsize)
     uint8_t c;
     while (checkend(p16,p16end,maxsize) && (c= *p8)!=0)
     {
+        if (n<0) {
+            size_t k= copyrun(p8, p16, outputroom(p16,p16end,maxsize));
+            if (k) {
+                p8 += k;
+                p16 += k;
+                continue;
+            }
+            int len;
+            if (c>=0xc0 && (len= decodeutf8seq(p8, w))!=0 && (w<0x10000 || outputroom(p16,p16end,maxsize)>=2)) {
+                if (w<0x10000)
+                    *p16++ = w;
+                else {
+                    w -= 0x10000;
+                    *p16++ = 0xd800+(w>>10);
+                    *p16++ = 0xdc00+(w&0x3ff);
+                }
+                p8 += len;
+                continue;
+            }
+        }
         if (c<0x80)
             *p16++ = c;
         else if (c<0xc0) {
@@ -343,6 +670,14 @@ size_t utf16toutf8(const utf16char_t *p16, utf8char_t *p8, size_t maxsize)
     uint16_t c;
     while (checkend(p8,p8end,maxsize) && (c= *p16)!=0)
     {
+        if (n<0) {
+            size_t k= copyrun(p16, p8, outputroom(p8,p8end,maxsize));
+            if (k) {
+                p16 += k;
+                p8 += k;
+                continue;
+            }
+        }
         if ((c<0xd800) || (c>=0xe000)) {
             w = c;
             emit= true;
@@ -414,6 +749,17 @@ size_t utf16bytesneeded(const utf32char_t *p)
 size_t utf16charcount(const utf16char_t *p)
 {
     size_t n=0;
+#ifdef _UTF_SSE2
+    // count all but the low surrogates
+    while (canload16(p)) {
+        __m128i v= load16(p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128())))
+            break;
+        __m128i low= _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(-0x400)), _mm_set1_epi16(-0x2400));
+        n += 8 - utfpopcount(_mm_movemask_epi8(low))/2;
+        p += 8;
+    }
+#endif
     while (uint16_t c= *p++)
         if (c<0xdc00 || c>=0xe000)
             n++;